@@ -0,0 +1,122 @@
+# include "basestore.hh"
+
+# include <iostream>
+# include <fstream>
+# include <string>
+# include <vector>
+# include <cstdio>
+
+# include <unistd.h>
+
+# include "logger.hh"
+
+using namespace std;
+
+TagSet merge_tags (const TagSet & local, const TagSet & remote, const TagSet * base, ConflictPolicy policy) {
+  if (base == NULL) {
+    switch (policy) {
+      case CONFLICT_LOCAL:  return local;
+      case CONFLICT_REMOTE: return remote;
+      case CONFLICT_UNION:  break;
+    }
+
+    return (local | remote);
+  }
+
+  /* a tag changed on either side since the base is changed, a tag can
+   * not be added on one side and removed on the other. */
+  TagSet added   = (local - *base) | (remote - *base);
+  TagSet removed = (*base - local) | (*base - remote);
+
+  return ((*base | added) - removed);
+}
+
+BaseStore::BaseStore (string path, TagDict & dict) :
+  base_path (path),
+  dict (dict)
+{
+}
+
+bool BaseStore::load () {
+  entries.clear ();
+
+  ifstream f (base_path);
+  if (!f.good ()) return true;
+
+  string line;
+  while (getline (f, line)) {
+    if (line.empty ()) continue;
+
+    size_t p = line.find ('\t');
+    string id = line.substr (0, p);
+
+    Entry & e = entries[id];
+
+    while (p != string::npos) {
+      size_t n = line.find ('\t', p + 1);
+      string t = line.substr (p + 1, (n == string::npos ? n : n - p - 1));
+
+      if (!t.empty ()) e.tags.add (dict.intern (t));
+
+      p = n;
+    }
+  }
+
+  return !f.bad ();
+}
+
+bool BaseStore::save (function<bool(const string &)> keep) {
+  string tmp = base_path + ".tmp";
+
+  {
+    ofstream f (tmp, ios::trunc);
+
+    for (auto & e : entries) {
+      if (!e.second.seen && !keep (e.first)) continue;
+
+      if (e.first.find_first_of ("\t\n") != string::npos) continue;
+
+      f << e.first;
+      for (auto & t : dict.names (e.second.tags)) {
+        if (t.find_first_of ("\t\n") != string::npos) continue;
+        f << '\t' << t;
+      }
+      f << '\n';
+    }
+
+    f.close ();
+
+    if (!f.good ()) {
+      LOG_ERROR ("base: could not write: " << tmp);
+      unlink (tmp.c_str ());
+      return false;
+    }
+  }
+
+  if (rename (tmp.c_str (), base_path.c_str ()) != 0) {
+    LOG_ERROR ("base: could not write: " << base_path);
+    unlink (tmp.c_str ());
+    return false;
+  }
+
+  return true;
+}
+
+bool BaseStore::get (const string & id, TagSet & tags) {
+  auto f = entries.find (id);
+  if (f == entries.end ()) return false;
+
+  tags = f->second.tags;
+  return true;
+}
+
+void BaseStore::set (const string & id, const TagSet & tags) {
+  Entry & e = entries[id];
+  e.tags = tags;
+  e.seen = true;
+}
+
+size_t BaseStore::size () const {
+  return entries.size ();
+}
+
@@ -0,0 +1,62 @@
+# pragma once
+
+/* base state for bidirectional sync
+ *
+ * the tags last agreed on by both sides (db and files) are stored per
+ * message-id. in a bidirectional run the local (db) and remote (file)
+ * changes are computed against the base and merged, so that changes on
+ * both sides since the last run are kept.
+ *
+ * the store is a text file with one line per message:
+ *
+ *   <message-id> \t <tag> \t <tag> ..
+ *
+ */
+
+# include <string>
+# include <unordered_map>
+# include <functional>
+
+# include "tagset.hh"
+
+using namespace std;
+
+/* how to merge a message without a base (first sync of the message) */
+enum ConflictPolicy {
+  CONFLICT_UNION,   /* keep tags from both sides */
+  CONFLICT_LOCAL,   /* db tags win */
+  CONFLICT_REMOTE,  /* file tags win */
+};
+
+/* three-way merge of the local and remote tags with base, if base is
+ * NULL the conflict policy decides. */
+TagSet merge_tags (const TagSet & local, const TagSet & remote, const TagSet * base, ConflictPolicy policy);
+
+class BaseStore {
+  public:
+    BaseStore (string path, TagDict & dict);
+
+    /* load store, a missing file is an empty store */
+    bool load ();
+
+    /* save store (atomically replacing the old one), keep is called for
+     * each message not set during this run */
+    bool save (function<bool(const string &)> keep);
+
+    bool get (const string & id, TagSet & tags);
+    void set (const string & id, const TagSet & tags);
+
+    size_t size () const;
+
+  private:
+    struct Entry {
+      TagSet tags;
+      bool   seen = false;
+    };
+
+    string    base_path;
+    TagDict & dict;
+
+    unordered_map<string, Entry> entries;
+};
+
@@ -0,0 +1,70 @@
+# include "batcher.hh"
+
+# include <iostream>
+# include <cstdlib>
+# include <chrono>
+
+# include <notmuch.h>
+
+# include "error.hh"
+
+using namespace std;
+
+CommitBatcher::CommitBatcher (notmuch_database_t * db, int size, int interval_ms) :
+  db (db),
+  size (size),
+  interval (interval_ms)
+{
+}
+
+void CommitBatcher::begin () {
+  if (in_atomic) return;
+
+  notmuch_status_t s = notmuch_database_begin_atomic (db);
+  if (s != NOTMUCH_STATUS_SUCCESS) {
+    throw SyncError (string ("db: could not begin atomic section: ") + notmuch_status_to_string (s));
+  }
+
+  in_atomic = true;
+  pending   = 0;
+  opened    = chrono::steady_clock::now ();
+}
+
+void CommitBatcher::done () {
+  pending++;
+  messages++;
+
+  if (pending >= size || (chrono::steady_clock::now () - opened) >= interval) {
+    flush ();
+  }
+}
+
+void CommitBatcher::flush () {
+  if (!in_atomic) return;
+
+  auto t0 = chrono::steady_clock::now ();
+
+  notmuch_status_t s = notmuch_database_end_atomic (db);
+  if (s != NOTMUCH_STATUS_SUCCESS) {
+    throw SyncError (string ("db: could not commit atomic section: ") + notmuch_status_to_string (s));
+  }
+
+  chrono::duration<double> t = chrono::steady_clock::now () - t0;
+
+  commit_total += t;
+  if (t > commit_max) commit_max = t;
+
+  batches++;
+  in_atomic = false;
+  pending   = 0;
+}
+
+void CommitBatcher::print_stats () {
+  if (batches == 0) return;
+
+  cout << "*  commits: " << messages << " messages in " << batches << " batches, latency: "
+       << (commit_total.count () * 1000.0 / batches) << " ms [avg], "
+       << (commit_max.count () * 1000.0) << " ms [max], "
+       << (commit_total.count () * 1000.0) << " ms [total]." << endl;
+}
+
@@ -0,0 +1,44 @@
+# pragma once
+
+/* groups tag changes of several messages into one atomic notmuch
+ * transaction.
+ *
+ * a transaction is opened on the first message and committed when
+ * `size` messages have been written or `interval` ms have passed since it
+ * was opened, whichever comes first.
+ */
+
+# include <chrono>
+# include <notmuch.h>
+
+class CommitBatcher {
+  public:
+    CommitBatcher (notmuch_database_t * db, int size, int interval_ms);
+
+    /* call before writing to a message, opens a transaction if needed */
+    void begin ();
+
+    /* call when done writing to a message, commits if the batch is full */
+    void done ();
+
+    /* commit any open transaction */
+    void flush ();
+
+    void print_stats ();
+
+  private:
+    notmuch_database_t * db;
+    int size;
+    std::chrono::milliseconds interval;
+
+    bool in_atomic = false;
+    int  pending = 0;
+    std::chrono::steady_clock::time_point opened;
+
+    /* stats */
+    unsigned long batches  = 0;
+    unsigned long messages = 0;
+    std::chrono::duration<double> commit_total = std::chrono::duration<double>::zero ();
+    std::chrono::duration<double> commit_max   = std::chrono::duration<double>::zero ();
+};
+
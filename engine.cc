@@ -0,0 +1,1888 @@
+/* sync engine, see engine.hh
+ *
+ * Author: Gaute Hope <eg@gaute.vetsj.com> / 2014 (c) GNU GPL v3 or later.
+ */
+
+# include "engine.hh"
+
+# include <iostream>
+# include <fstream>
+# include <string>
+# include <sstream>
+# include <vector>
+# include <set>
+# include <algorithm>
+# include <functional>
+# include <chrono>
+# include <mutex>
+# include <csignal>
+# include <cstring>
+# include <cstdlib>
+# include <cctype>
+
+# include <strings.h>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include <boost/filesystem.hpp>
+
+# include "tokenizer.hh"
+# include "xkeywords.hh"
+# include "batcher.hh"
+# include "filecache.hh"
+# include "state.hh"
+# include "watcher.hh"
+# include "maildirwalk.hh"
+# include "journal.hh"
+# include "logger.hh"
+# include "error.hh"
+
+using namespace std;
+using namespace boost::filesystem;
+using namespace boost::posix_time;
+
+# define ustring Glib::ustring
+
+void SyncShared::init () {
+  for (auto & t : rules.ignored ()) ignore_set.add (tag_dict.intern (t));
+}
+
+SyncEngine::SyncEngine (SyncShared & s, const SyncConfig & config, notmuch_database_t * db) :
+  shared (s),
+  c (config),
+  nm_db (db)
+{
+  read_policy.drop  = c.cache_friendly;
+  read_policy.stats = &page_cache_stats;
+}
+
+SyncEngine::~SyncEngine () { }
+
+SyncReport SyncEngine::run () {
+  return guard ([&] () { sync_config (); });
+}
+
+SyncReport SyncEngine::sync_messages (const string & query) {
+  return guard ([&] () { sync_query (query); });
+}
+
+SyncReport SyncEngine::sync_files (const vector<string> & paths) {
+  return guard ([&] () { sync_paths (paths); });
+}
+
+SyncReport SyncEngine::watch (function<NmDatabase ()> open_db) {
+  /* the db is only open while a batch is synced */
+  NmDatabase db;
+  notmuch_database_t * own_db = nm_db;
+
+  SyncReport r = guard ([&] () { watch_maildir (open_db, db); }, false);
+
+  nm_db = own_db;
+
+  return r;
+}
+
+SyncReport SyncEngine::apply (const Plan & p) {
+  /* write with the options the plan was made with */
+  c.direction          = (Direction) p.direction;
+  c.x_keywords_padding = p.x_keywords_padding;
+  c.paranoid           = (p.flags & Plan::PARANOID);
+  c.remove_double_x_keywords_header = (p.flags & Plan::REMOVE_DOUBLE_X_KEYWORDS_HEADER);
+  c.enable_add_x_keywords_header    = !p.add_x_keyw_path.empty ();
+  c.add_x_keyw_path    = p.add_x_keyw_path;
+  c.journal_dir        = p.journal_dir;
+  c.plan_path.clear ();
+
+  return guard ([&] () { apply_plan (p); });
+}
+
+SyncReport SyncEngine::guard (function<void()> sync, bool need_db) { // {{{
+  /* set up, sync and finish, errors are returned in the report. what was
+   * set up is dropped on an error: queued file writes are not done and
+   * the caches and state are not saved. */
+  SyncReport r;
+
+  count_checked    = 0;
+  count_changed    = 0;
+  skipped_messages = 0;
+  full_run         = false;
+
+  double cpu0 = thread_cpu_ms ();
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now ();
+
+  try {
+    if (need_db && !nm_db) throw SyncError ("error: no database.");
+
+    start ();
+    sync ();
+    finish (t0, cpu0);
+
+  } catch (const exception & e) {
+    r.ok    = false;
+    r.error = e.what ();
+
+    journal.reset ();
+    uring.reset ();
+    file_cache.reset ();
+    base_store.reset ();
+    state.reset ();
+    plan.reset ();
+  }
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - t0;
+
+  r.checked = count_checked;
+  r.changed = count_changed;
+  r.skipped = skipped_messages;
+  r.elapsed = elapsed.count ();
+
+  return r;
+} // }}}
+
+void SyncEngine::start () { // {{{
+  /* set up everything but the database, throws SyncError */
+  if (!c.plan_path.empty ()) {
+    if (c.direction == BIDIRECTIONAL || c.maildir_flags || c.incremental || c.watch) {
+      throw SyncError ("error: a plan can only be made for a one-way sync without --flags, --incremental or --watch.");
+    }
+
+    plan.reset (new Plan ());
+    plan->db_path            = c.db_path;
+    plan->direction          = c.direction;
+    plan->x_keywords_padding = c.x_keywords_padding;
+    plan->flags              = (c.remove_double_x_keywords_header ? Plan::REMOVE_DOUBLE_X_KEYWORDS_HEADER : 0) |
+                               (c.paranoid ? Plan::PARANOID : 0);
+    plan->add_x_keyw_path    = (c.enable_add_x_keywords_header ? c.add_x_keyw_path : "");
+    plan->journal_dir        = c.journal_dir;
+
+# ifdef HAVE_NOTMUCH_GET_REV
+    /* changes made after this are detected when applying */
+    if (nm_db) {
+      const char * uuid;
+      plan->revision = notmuch_database_get_revision (nm_db, &uuid);
+      plan->uuid     = uuid;
+    }
+# endif
+
+    LOG_INFO ("=> plan: " << c.plan_path);
+  }
+
+  if (c.io_uring_depth > 0) {
+    uring.reset (new UringReader (c.io_uring_depth));
+
+    if (uring->init ()) {
+      uring->set_policy (&read_policy);
+      LOG_INFO ("=> io_uring: queue depth: " << uring->queue_depth ());
+    } else {
+      LOG_WARN ("warning: io_uring is not available, reading files on the worker threads.");
+      uring.reset ();
+    }
+  }
+
+  if (!c.file_cache_path.empty ()) {
+    file_cache.reset (new FileCache (c.file_cache_path));
+
+    if (!file_cache->load ()) {
+      LOG_WARN ("warning: file cache is invalid, starting with an empty cache.");
+    }
+
+    LOG_INFO ("=> file cache: " << c.file_cache_path);
+  }
+
+  if (c.direction == BIDIRECTIONAL) {
+    base_store.reset (new BaseStore (c.base_path, shared.tag_dict));
+
+    if (!base_store->load ()) {
+      throw SyncError ("error: could not load base state: " + c.base_path);
+    }
+
+    LOG_INFO ("=> base state: " << c.base_path << " (" << base_store->size () << " messages)");
+  }
+
+  /* write journal, this also replays writes interrupted by a crash */
+  journal.reset (new WriteJournal (c.journal_dir, c.batch_size));
+
+  if (!c.dryrun && !plan) {
+    if (!journal->open ()) {
+      throw SyncError ("error: could not open journal: " + c.journal_dir);
+    }
+
+    int n = journal->recover ();
+    if (n < 0) {
+      throw SyncError ("error: could not recover writes from journal: " + c.journal_dir);
+    }
+
+    if (n > 0) {
+      LOG_INFO ("=> journal: recovered " << n << " interrupted writes.");
+    }
+
+  } else if (journal->pending_recovery ()) {
+    LOG_WARN ("warning: the journal has interrupted writes, run without --dry-run or --plan to recover them.");
+  }
+} // }}}
+
+void SyncEngine::sync_config () { // {{{
+  /* the query (or walk) of the config, incremental if enabled */
+# ifdef HAVE_NOTMUCH_GET_REV
+  const char * uuid;
+  unsigned long revision = notmuch_database_get_revision (nm_db, &uuid);
+  LOG_INFO ("* db: current revision: " << revision);
+# endif
+
+  string query = c.query;
+
+  /* messages (re)indexed since the last run, for --indexed-keywords */
+  string changed;
+
+  /* incremental sync: restrict query to what changed since the last run {{{ */
+  if (c.incremental) {
+    state.reset (new SyncState (c.state_path));
+
+    if (!state->load ()) {
+      throw SyncError ("error: could not load state file: " + c.state_path);
+    }
+
+    state_key = string (c.direction == TAG_TO_KEYWORD ? "tag-to-keyword" : "keyword-to-tag") + ":" + c.query;
+
+    /* the time and revision are taken before any messages are
+     * checked, changes made during the run are picked up next time. */
+    state_now.time = time (NULL);
+# ifdef HAVE_NOTMUCH_GET_REV
+    state_now.uuid     = uuid;
+    state_now.revision = revision;
+# endif
+
+    SyncState::Entry last;
+    if (!state->get (state_key, last)) {
+      LOG_INFO ("=> incremental: no previous run, doing full sync.");
+
+    } else if (last.uuid != state_now.uuid) {
+      LOG_INFO ("=> incremental: database uuid changed, doing full sync.");
+
+    } else if (c.direction == TAG_TO_KEYWORD) {
+      /* messages with tag changes since the last run, the last revision
+       * itself was already synced */
+      query = "(" + c.query + ") AND lastmod:" + to_string (last.revision + 1) + ".." + to_string (state_now.revision);
+      LOG_INFO ("=> incremental: query: " << query);
+
+    } else {
+# ifdef HAVE_NOTMUCH_GET_REV
+      changed = "lastmod:" + to_string (last.revision + 1) + ".." + to_string (state_now.revision);
+# endif
+
+      /* message files modified since the last run */
+      c.mtime_set = true;
+      c.only_after_mtime = from_time_t (last.time);
+      LOG_INFO ("=> incremental: only working on messages with mtime newer than: " << to_simple_string (c.only_after_mtime));
+    }
+  }
+  /* }}} */
+
+  if (!c.index_prefix.empty ()) {
+    if (index_configured ()) {
+      set<string> checked;
+      sync_indexed (query, changed, checked);
+
+      /* without lastmod the files changed since the threshold are
+       * checked from the files */
+      if (changed.empty () && c.mtime_set) {
+        LOG_INFO ("=> index: checking files changed since: " << to_simple_string (c.only_after_mtime));
+
+        if (!c.walk_path.empty ()) sync_walk (c.walk_path, &checked);
+        else sync_query (query, &checked);
+      }
+
+      return;
+    }
+
+    LOG_WARN ("warning: index.header." << c.index_prefix << " is not set to X-Keywords in the database, checking every message file.");
+  }
+
+  if (!c.walk_path.empty () && c.mtime_set) {
+    sync_walk (c.walk_path);
+  } else {
+    /* also the first incremental run with --walk */
+    full_run = !c.mtime_set;
+    sync_query (query);
+  }
+} // }}}
+
+bool SyncEngine::index_configured () { // {{{
+  /* true if notmuch indexes X-Keywords under the prefix */
+# ifdef HAVE_NOTMUCH_GET_CONFIG
+  char * v = NULL;
+  notmuch_status_t s = notmuch_database_get_config (nm_db, ("index.header." + c.index_prefix).c_str (), &v);
+
+  string header = (v ? v : "");
+  free (v);
+
+  return (s == NOTMUCH_STATUS_SUCCESS && strcasecmp (header.c_str (), "X-Keywords") == 0);
+# else
+  return false;
+# endif
+} // }}}
+
+/* the words of a keyword as the index sees them (roughly: the terms of
+ * the xapian term generator), lowercase alphanumeric runs */
+static vector<string> index_words (const string & k) {
+  vector<string> w;
+  string cur;
+
+  for (unsigned char ch : k) {
+    if (isalnum (ch) || ch >= 0x80) {
+      cur += tolower (ch);
+    } else if (!cur.empty ()) {
+      w.push_back (cur);
+      cur.clear ();
+    }
+  }
+
+  if (!cur.empty ()) w.push_back (cur);
+
+  return w;
+}
+
+/* a quoted query term */
+static string query_term (const string & prefix, const string & v) {
+  string q = prefix + ":\"";
+
+  for (char ch : v) {
+    if (ch == '"') q += '"';
+    q += ch;
+  }
+
+  return q + "\"";
+}
+
+void SyncEngine::sync_indexed (const string & query, const string & changed, set<string> & checked) { // {{{
+  /* keyword-to-tag with the set of messages to check found by queries on
+   * the indexed X-Keywords header instead of by reading every file: per
+   * tag (its keyword K) the messages with K but without the tag, and with
+   * the tag but without K. the header is indexed as text, so a match is a
+   * match of the words of K: these are candidates, their files are read
+   * and the tags changed by the usual path. when the words of K are part
+   * of another keyword K2, the messages with the tag and K2 are checked as
+   * well, a removed K could otherwise hide behind K2.
+   *
+   * keywords that are not a tag of any message yet can not be queried:
+   * the messages matching changed (those indexed by notmuch new since the
+   * last incremental run, e.g. new mail) are checked as well. */
+  PhaseTimer qt (metrics, PHASE_QUERY);
+  chrono::time_point<chrono::steady_clock> t0 = chrono::steady_clock::now ();
+
+  const string & prefix = c.index_prefix;
+
+  /* tags and their keywords */
+  vector<pair<string, string>> tags;
+
+  {
+    NmTags all (notmuch_database_get_all_tags (nm_db));
+    for (; notmuch_tags_valid (all.get ()); notmuch_tags_move_to_next (all.get ())) {
+      string t = notmuch_tags_get (all.get ());
+
+      if (shared.ignore_set.has (shared.tag_dict.intern (t))) continue;
+
+      tags.push_back (make_pair (t, shared.tag_keyword (t)));
+    }
+  }
+
+  vector<vector<string>> words;
+  for (auto & t : tags) words.push_back (index_words (t.second));
+
+  /* the tags with a word in their keyword, to find the keywords that
+   * contain another without comparing every pair */
+  unordered_map<string, vector<size_t>> by_word;
+  for (size_t j = 0; j < tags.size (); j++) {
+    for (auto & w : words[j]) {
+      vector<size_t> & l = by_word[w];
+      if (l.empty () || l.back () != j) l.push_back (j);
+    }
+  }
+
+  vector<string> ids; /* in the order found */
+  unsigned int   queries = 0;
+
+  auto collect = [&] (const string & q) -> unsigned int {
+    /* notmuch only takes * for all messages on its own */
+    string full = ((query.empty () || query == "*") ? q : "(" + query + ") AND " + q);
+
+    NmQuery nq (notmuch_query_create (nm_db, full.c_str ()));
+    queries++;
+
+    /* freed with the query */
+    notmuch_messages_t * messages;
+    if (notmuch_query_search_messages_st (nq.get (), &messages) != NOTMUCH_STATUS_SUCCESS) {
+      throw SyncError ("db: failed to search messages: " + q);
+    }
+
+    unsigned int n = 0;
+    for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages)) {
+      NmMessage m (notmuch_messages_get (messages));
+      string id = notmuch_message_get_message_id (m.get ());
+
+      n++;
+      if (checked.insert (id).second) ids.push_back (id);
+    }
+
+    return n;
+  };
+
+  for (size_t i = 0; i < tags.size (); i++) {
+    const string & t = tags[i].first;
+    const string & k = tags[i].second;
+
+    if (words[i].empty ()) {
+      /* not in the index, e.g. only punctuation */
+      LOG_VERBOSE ("*  index: keyword can not be queried, checking all messages with tag: " << t);
+      collect (query_term ("tag", t));
+      continue;
+    }
+
+    unsigned int add = collect (query_term (prefix, k) + " AND NOT " + query_term ("tag", t));
+    unsigned int rem = collect (query_term ("tag", t) + " AND NOT " + query_term (prefix, k));
+
+    /* keywords containing the words of k, among the tags with the least
+     * common word of k */
+    const vector<size_t> * with = NULL;
+    for (auto & w : words[i]) {
+      const vector<size_t> & l = by_word[w];
+      if (!with || l.size () < with->size ()) with = &l;
+    }
+
+    for (size_t j : *with) {
+      if (j == i || words[j].size () <= words[i].size ()) continue;
+
+      if (search (words[j].begin (), words[j].end (), words[i].begin (), words[i].end ()) != words[j].end ()) {
+        rem += collect (query_term ("tag", t) + " AND " + query_term (prefix, tags[j].second));
+      }
+    }
+
+    if (add > 0 || rem > 0) {
+      LOG_VERBOSE ("*  index: " << t << " (" << k << "): " << add << " messages without the tag, " << rem << " to check for removal");
+    }
+  }
+
+  if (!changed.empty ()) {
+    unsigned int n = collect (changed);
+    LOG_VERBOSE ("*  index: " << n << " messages changed since the last run (" << changed << ")");
+  }
+
+  qt.stop ();
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - t0;
+  LOG_INFO ("*  index: " << tags.size () << " tags, " << queries << " queries, " << ids.size () << " messages to check in " << (elapsed.count () * 1000.0) << " ms.");
+
+  /* the candidates are read whatever their mtime */
+  bool mtime_set = c.mtime_set;
+  c.mtime_set = false;
+
+  size_t i = 0;
+
+  try {
+    sync_each ([&] () -> NmMessage {
+        while (i < ids.size ()) {
+          notmuch_message_t * m = NULL;
+          notmuch_status_t s = notmuch_database_find_message (nm_db, ids[i++].c_str (), &m);
+
+          if (s == NOTMUCH_STATUS_SUCCESS && m) return NmMessage (m);
+        }
+
+        return NmMessage ();
+      }, ids.size ());
+
+  } catch (...) {
+    c.mtime_set = mtime_set;
+    throw;
+  }
+
+  c.mtime_set = mtime_set;
+} // }}}
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal (int) {
+  watch_stop = 1;
+}
+
+void SyncEngine::watch_maildir (function<NmDatabase ()> open_db, NmDatabase & db) { // {{{
+  /* keyword-to-tag sync of changed files until interrupted, the db is
+   * only opened while a batch of changes is synced, so that it is not
+   * kept locked while idle. */
+  const string & root = c.watch_path;
+  MaildirWatcher w (root);
+
+  if (!w.start ()) throw SyncError ("error: could not watch maildir: " + root);
+
+  LOG_INFO ("=> watching: " << root << " (" << w.watches () << " directories)");
+
+  /* interrupt poll () instead of restarting it */
+  struct sigaction sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = watch_signal;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  set<string> paths;
+  bool overflow = false;
+  bool retry    = false;
+  int  delay    = 0;    /* s, until the failed batch is retried */
+
+  while (!watch_stop) {
+    /* a failed batch is retried with the same paths, the events that came
+     * in meanwhile are queued by inotify and read after it succeeds */
+    if (!retry && !w.wait (paths, overflow, c.watch_debounce)) break;
+
+    chrono::time_point<chrono::steady_clock> bt0 = chrono::steady_clock::now ();
+    int changed0 = count_changed;
+
+    try {
+      db = open_db ();
+      nm_db = db.get ();
+
+      if (overflow) {
+        LOG_INFO ("=> watch: events lost or new directories, checking all messages..");
+        sync_query (c.query);
+
+      } else {
+        /* restricted to the query, the same messages as above */
+        sync_paths (vector<string> (paths.begin (), paths.end ()));
+      }
+
+    } catch (const SyncError & e) {
+      /* most likely the db is locked by another writer (e.g. notmuch new
+       * after new mail), keep watching and try again later. */
+      db.reset ();
+      nm_db = NULL;
+
+      delay = min (max (2 * delay, 1), 60);
+      retry = true;
+
+      LOG_ERROR (e.what ());
+      LOG_WARN ("=> watch: batch of " << paths.size () << " files failed, retrying in " << delay << " s..");
+
+      /* returns early on SIGINT or SIGTERM */
+      sleep (delay);
+      continue;
+    }
+
+    db.reset ();
+    nm_db = NULL;
+
+    retry = false;
+    delay = 0;
+
+    save_metrics ();
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - bt0;
+    LOG_INFO ("=> watch: " << paths.size () << " files changed, " << (count_changed - changed0) << " messages updated in " << elapsed.count () << " s.");
+
+    paths.clear ();
+  }
+
+  LOG_INFO ("=> watch: stopping.");
+} // }}}
+
+void SyncEngine::apply_plan (const Plan & p) { // {{{
+  /* apply the tag changes and file rewrites of a plan. a message changed
+   * in the db since the scan (its lastmod is newer than the revision of
+   * the plan) or a file changed on disk may have been changed by someone
+   * else, its entry is skipped. the rewrites of the files of a changed
+   * message are skipped as well, their keywords are of the old tags. */
+  set<string> stale;
+
+# ifdef HAVE_NOTMUCH_GET_REV
+  const char * uuid;
+  unsigned long revision = notmuch_database_get_revision (nm_db, &uuid);
+
+  if (!p.messages.empty () || !p.files.empty ()) {
+    if (p.uuid != uuid) {
+      throw SyncError ("error: the plan was made for another database (uuid changed), scan again.");
+    }
+
+    if (revision > p.revision) {
+      string q = "lastmod:" + to_string (p.revision + 1) + ".." + to_string (revision);
+
+      NmQuery query (notmuch_query_create (nm_db, q.c_str ()));
+
+      /* freed with the query */
+      notmuch_messages_t * messages;
+      if (notmuch_query_search_messages_st (query.get (), &messages) != NOTMUCH_STATUS_SUCCESS) {
+        throw SyncError ("db: failed to search messages.");
+      }
+
+      for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages)) {
+        NmMessage m (notmuch_messages_get (messages));
+        stale.insert (notmuch_message_get_message_id (m.get ()));
+      }
+    }
+
+    LOG_INFO ("* db: plan revision: " << p.revision << ", current revision: " << revision << ", messages changed since: " << stale.size ());
+  }
+# else
+  if (!p.messages.empty () || !p.files.empty ()) {
+    LOG_WARN ("warning: notmuch without lastmod support, messages changed since the plan was made are not detected.");
+  }
+# endif
+
+  /* tag changes {{{ */
+  CommitBatcher batch (nm_db, c.batch_size, c.batch_interval);
+  batcher = &batch;
+
+  try {
+    for (auto & m : p.messages) {
+      count_checked++;
+
+      if (stale.count (m.id)) {
+        LOG_VERBOSE ("changed since the plan was made, skipping: " << m.id);
+        skipped_messages++;
+        continue;
+      }
+
+      notmuch_message_t * message = NULL;
+      notmuch_status_t s = notmuch_database_find_message (nm_db, m.id.c_str (), &message);
+      NmMessage owned (message);
+
+      if (s != NOTMUCH_STATUS_SUCCESS || !message) {
+        LOG_VERBOSE ("not in the database, skipping: " << m.id);
+        skipped_messages++;
+        continue;
+      }
+
+      TagSet add, rem;
+      for (uint32_t t : m.add) add.add (shared.tag_dict.intern (p.tags[t]));
+      for (uint32_t t : m.rem) rem.add (shared.tag_dict.intern (p.tags[t]));
+
+      LOG_DEBUG ("==> message: " << m.id);
+
+      if (write_db_tags (message, add, rem)) count_changed++;
+    }
+
+  } catch (...) {
+    /* keep the messages done before the error */
+    batcher = NULL;
+
+    try {
+      batch.flush ();
+    } catch (const SyncError & e) {
+      LOG_ERROR (e.what ());
+    }
+
+    throw;
+  }
+
+  batch.flush ();
+  batcher = NULL;
+  /* }}} */
+
+  /* file rewrites, written when the journal is committed {{{ */
+  for (auto & f : p.files) {
+    count_checked++;
+
+    FileSnapshot snap;
+    snap.path = f.path;
+
+    if (stale.count (f.id)) {
+      /* the keywords are of the old tags */
+      LOG_VERBOSE ("message changed since the plan was made, skipping file: " << f.path);
+      skipped_messages++;
+      continue;
+    }
+
+    if (stat (f.path.c_str (), &snap.st) != 0 || !f.unchanged (snap.st)) {
+      LOG_VERBOSE ("file changed since the plan was made, skipping: " << f.path);
+      skipped_messages++;
+      continue;
+    }
+
+    LOG_DEBUG ("file: " << f.path);
+
+    write_keywords (snap, f.keywords, f.id);
+    count_changed++;
+  }
+  /* }}} */
+} // }}}
+
+void SyncEngine::finish (chrono::steady_clock::time_point t0, double cpu0) { // {{{
+  /* write any queued file changes, save the caches and state and print
+   * the summary (at the info level). the writes are done first, only the
+   * summary is printed under the output lock so that the output of engines
+   * finishing at the same time is not mixed. */
+  if (c.direction != KEYWORD_TO_TAG) {
+    PhaseTimer t (metrics, PHASE_REWRITE);
+    journal->commit ();
+  }
+
+  if (file_cache) {
+    /* files not looked up are only pruned after a full run, other runs
+     * skip unchanged files without a lookup */
+    function<bool(const string &)> keep;
+
+    if (full_run) {
+      keep = [&] (const string & p) {
+        /* keep files still known to notmuch */
+        notmuch_message_t * m = NULL;
+        notmuch_status_t s = notmuch_database_find_message_by_filename (
+            nm_db, p.c_str (), &m);
+        NmMessage owned (m);
+
+        return (s == NOTMUCH_STATUS_SUCCESS && m != NULL);
+      };
+    }
+
+    file_cache->save (keep);
+  }
+
+  if (base_store) {
+    if (!c.dryrun) {
+      bool saved = base_store->save ([&] (const string & id) {
+          /* keep messages still in the db */
+          notmuch_message_t * m = NULL;
+          notmuch_status_t s = notmuch_database_find_message (
+              nm_db, id.c_str (), &m);
+          NmMessage owned (m);
+
+          return (s == NOTMUCH_STATUS_SUCCESS && m != NULL);
+        });
+
+      if (!saved) {
+        throw SyncError ("error: could not save base state.");
+      }
+    }
+
+    base_store.reset ();
+  }
+
+  if (plan) {
+    if (!plan->save (c.plan_path)) {
+      throw SyncError ("error: could not write plan: " + c.plan_path);
+    }
+
+    if (!c.plan_batch_path.empty () && !plan->save_batch (c.plan_batch_path)) {
+      throw SyncError ("error: could not write plan: " + c.plan_batch_path);
+    }
+  }
+
+  if (state) {
+    /* only store the new state after a successful run */
+    if (!c.dryrun) {
+      state->set (state_key, state_now);
+
+      if (!state->save ()) {
+        throw SyncError ("error: could not save state file: " + c.state_path);
+      }
+    }
+
+    state.reset ();
+  }
+
+  save_metrics ();
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - t0;
+
+  /* summary {{{ */
+  logger.flush ();
+
+  if (logger.enabled (LEVEL_INFO)) {
+    unique_lock<mutex> lk (shared.output_m);
+
+    if (c.direction != KEYWORD_TO_TAG) journal->print_stats ();
+    if (uring) uring->print_stats ();
+
+    page_cache_stats.print ();
+
+    if (logger.enabled (LEVEL_VERBOSE)) metrics.print ();
+
+    if (file_cache) file_cache->print_stats ();
+
+    if (plan) cout << "=> plan: " << plan->messages.size () << " messages to tag and " << plan->files.size () << " files to rewrite, apply with: --apply " << c.plan_path << endl;
+
+    /* the cpu time of the thread of the engine, the reads on the worker
+     * threads are shared with other engines and not included */
+    cout << "=> done" << (c.label.empty () ? "" : " (" + c.label + ")") << ", checked: " << count_checked << " messages and changed: " << count_changed << " messages (skipped: " << skipped_messages << ") in " << (thread_cpu_ms () - cpu0) << " ms [cpu, engine thread], " << elapsed.count() << " s [real time]." << endl;
+  }
+  /* }}} */
+
+  journal.reset ();
+  uring.reset ();
+  file_cache.reset ();
+  plan.reset ();
+} // }}}
+
+void SyncEngine::sync_query (const ustring & q, const set<string> * skip) { // {{{
+  /* sync all messages matching query, except those in skip */
+  double cpu0 = thread_cpu_ms ();
+  PhaseTimer qt (metrics, PHASE_QUERY);
+
+  NmQuery query (notmuch_query_create (nm_db,
+      q.c_str()));
+
+  notmuch_status_t st;
+  unsigned int total_messages;
+  st = notmuch_query_count_messages_st (query.get (), &total_messages);
+
+  if (st != NOTMUCH_STATUS_SUCCESS) {
+    throw SyncError ("db: failed to get message count.");
+  }
+
+  LOG_INFO ("*  messages to check: " << total_messages);
+
+  /* freed with the query */
+  notmuch_messages_t * messages;
+  st = notmuch_query_search_messages_st (query.get (), &messages);
+
+  if (st != NOTMUCH_STATUS_SUCCESS) {
+    throw SyncError ("db: failed to search messages.");
+  }
+
+  LOG_INFO ("*  query time: " << (thread_cpu_ms () - cpu0) << " ms.");
+  qt.stop ();
+
+  sync_each ([&] () -> NmMessage {
+      while (notmuch_messages_valid (messages)) {
+        NmMessage message (notmuch_messages_get (messages));
+        notmuch_messages_move_to_next (messages);
+
+        if (skip && skip->count (notmuch_message_get_message_id (message.get ()))) continue;
+
+        return message;
+      }
+
+      return NmMessage ();
+    }, total_messages);
+} // }}}
+
+void SyncEngine::sync_each (function<NmMessage ()> next, unsigned int total_messages) { // {{{
+  /* read and commit messages until next () returns NULL */
+  CommitBatcher batch (nm_db, c.batch_size, c.batch_interval);
+  batcher = &batch;
+
+  try {
+    /* on an error the jobs in flight are dropped before the batch is
+     * closed */
+    size_t threads = (shared.pool ? shared.pool->size () : 1);
+
+    Pipeline<MessageJob> pipeline (shared.pool, 16 * threads,
+        [this] (MessageJob & j) { read_message (j); },
+        [this] (MessageJob & j) { commit_message (j); });
+
+    unsigned int submitted = 0;
+
+    /* with io_uring the files of queue depth messages are read at once
+     * before the messages are handed to the pipeline */
+    vector<unique_ptr<MessageJob>> pending;
+
+    auto submit_pending = [&] () {
+      vector<MessageJob *> jobs;
+      for (auto & j : pending) jobs.push_back (j.get ());
+
+      prefetch_headers (jobs);
+      for (auto & j : pending) pipeline.submit (j.release ());
+      pending.clear ();
+    };
+
+    while (NmMessage message = next ()) {
+      LOG_DEBUG ("==> working on message (" << submitted << " of " << total_messages << "): " << notmuch_message_get_message_id (message.get ()));
+
+      unique_ptr<MessageJob> j (new MessageJob ());
+      gather_message (*j, move (message));
+
+      if (uring) {
+        pending.push_back (move (j));
+        if (pending.size () >= uring->queue_depth ()) submit_pending ();
+      } else {
+        /* the pipeline is deep enough that the pages have arrived by the
+         * time a worker reads the job */
+        if (c.cache_friendly) prefetch_pages (*j);
+        pipeline.submit (j.release ());
+      }
+
+      submitted++;
+    }
+
+    if (!pending.empty ()) submit_pending ();
+
+    pipeline.finish ();
+
+  } catch (...) {
+    /* commit the messages completed before the error (a message that
+     * failed half way is never thawed and not written), so that the
+     * database is not left with an open transaction. */
+    batcher = NULL;
+
+    try {
+      batch.flush ();
+    } catch (const SyncError & e) {
+      LOG_ERROR (e.what ());
+    }
+
+    throw;
+  }
+
+  batch.flush ();
+  batcher = NULL;
+
+  logger.flush ();
+
+  if (logger.enabled (LEVEL_INFO)) {
+    lock_guard<mutex> lk (shared.output_m);
+    batch.print_stats ();
+  }
+} // }}}
+
+void SyncEngine::sync_paths (const vector<string> & paths, const set<string> * skip) { // {{{
+  /* sync the messages of the given files. files are mapped back to
+   * messages, several files may belong to the same message. files not
+   * yet in the db are picked up by notmuch new, messages not matching the
+   * query of the config are skipped. */
+  vector<NmMessage> messages;
+  set<string> ids;
+
+  for (const string & p : paths) {
+    notmuch_message_t * m = NULL;
+    notmuch_status_t s = notmuch_database_find_message_by_filename (
+        nm_db, p.c_str (), &m);
+    NmMessage message (m);
+
+    if (s != NOTMUCH_STATUS_SUCCESS || m == NULL) {
+      LOG_VERBOSE ("not in db, skipping: " << p);
+      continue;
+    }
+
+    const char * id = notmuch_message_get_message_id (m);
+    if (skip && skip->count (id)) continue;
+
+    if (ids.insert (id).second) {
+      messages.push_back (move (message));
+    }
+  }
+
+  /* only the messages of the query, as when syncing the query itself
+   * (one query per batch of ids) {{{ */
+  if (!c.query.empty () && c.query != "*" && !messages.empty ()) {
+    set<string> in;
+    auto it = ids.begin ();
+
+    while (it != ids.end ()) {
+      string q = "(" + c.query + ") AND (";
+
+      for (int n = 0; n < 100 && it != ids.end (); n++, it++) {
+        if (n > 0) q += " OR ";
+        q += query_term ("id", *it);
+      }
+
+      q += ")";
+
+      NmQuery query (notmuch_query_create (nm_db, q.c_str ()));
+
+      /* freed with the query */
+      notmuch_messages_t * found;
+      if (notmuch_query_search_messages_st (query.get (), &found) != NOTMUCH_STATUS_SUCCESS) {
+        throw SyncError ("db: failed to search messages.");
+      }
+
+      for (; notmuch_messages_valid (found); notmuch_messages_move_to_next (found)) {
+        NmMessage m (notmuch_messages_get (found));
+        in.insert (notmuch_message_get_message_id (m.get ()));
+      }
+    }
+
+    auto out = remove_if (messages.begin (), messages.end (), [&] (const NmMessage & m) {
+        const char * id = notmuch_message_get_message_id (m.get ());
+
+        if (in.count (id)) return false;
+
+        LOG_VERBOSE ("not in query, skipping: " << id);
+        return true;
+      });
+
+    messages.erase (out, messages.end ());
+  }
+  /* }}} */
+
+  size_t i = 0;
+  sync_each ([&] () -> NmMessage {
+      return (i < messages.size () ? move (messages[i++]) : NmMessage ());
+    }, messages.size ());
+} // }}}
+
+void SyncEngine::sync_walk (const string & root, const set<string> * skip) { // {{{
+  /* find changed files by walking the maildir instead of the query */
+  chrono::time_point<chrono::steady_clock> t0 = chrono::steady_clock::now ();
+
+  vector<string>   paths;
+  MaildirWalkStats ws;
+
+  if (!maildir_walk (root, to_time_t (c.only_after_mtime), c.walk_prune, paths, ws)) {
+    throw SyncError ("error: could not walk maildir: " + root);
+  }
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - t0;
+  LOG_INFO ("*  walk: " << ws.dirs << " directories listed, " << ws.pruned
+       << " pruned, " << ws.files << " files checked, " << ws.changed
+       << " changed in " << (elapsed.count () * 1000.0) << " ms.");
+
+  sync_paths (paths, skip);
+} // }}}
+
+void SyncEngine::prefetch_headers (vector<MessageJob *> & jobs) { // {{{
+  /* stat all files of the messages and read the headers of those that
+   * will be read by read_message (), in batches through io_uring. */
+  vector<HeaderRead *> all;
+
+  for (MessageJob * j : jobs) {
+    j->reads.resize (j->filenames.size ());
+
+    for (size_t i = 0; i < j->filenames.size (); i++) {
+      j->reads[i].path = j->filenames[i];
+      all.push_back (&j->reads[i]);
+    }
+  }
+
+  /* timed per batch */
+  {
+    PhaseTimer t (metrics, PHASE_STAT);
+    if (!uring->stat (all)) throw SyncError ("error: io_uring failed while reading message files.");
+  }
+
+  vector<HeaderRead *> to_read;
+  for (HeaderRead * r : all) {
+    if (!r->stat_ok) continue;
+
+    if (c.mtime_set && from_time_t (r->st.st_mtime) < c.only_after_mtime) continue;
+
+    if (file_cache && file_cache->contains (r->st)) continue;
+
+    to_read.push_back (r);
+  }
+
+  PhaseTimer t (metrics, PHASE_READ);
+  if (!uring->read (to_read)) throw SyncError ("error: io_uring failed while reading message files.");
+} // }}}
+
+void SyncEngine::prefetch_pages (MessageJob & j) { // {{{
+  /* note which files are already in the page cache and start reading the
+   * headers of those that are not and will be read by read_message (). */
+  for (const string & fnm : j.filenames) {
+    long cached = -1;
+
+    int fd = open (fnm.c_str (), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      struct stat st;
+      bool want = (fstat (fd, &st) == 0);
+
+      if (want && c.mtime_set && from_time_t (st.st_mtime) < c.only_after_mtime) want = false;
+      if (want && file_cache && file_cache->contains (st)) want = false;
+
+      if (want) {
+        cached = cached_bytes (fd, 4096);
+        if (cached == 0) ::prefetch_pages (fd, 4096);
+      }
+
+      close (fd);
+    }
+
+    j.cached.push_back (cached);
+  }
+} // }}}
+
+void SyncEngine::gather_message (MessageJob & j, NmMessage message) { // {{{
+  /* collect the file names and db tags of a message, this touches
+   * the database and must run on the main thread. */
+  PhaseTimer t (metrics, PHASE_FILENAMES);
+
+  j.message = move (message);
+
+  NmFilenames nm_fnms (notmuch_message_get_filenames (j.message.get ()));
+  for (;
+       notmuch_filenames_valid (nm_fnms.get ());
+       notmuch_filenames_move_to_next (nm_fnms.get ())) {
+
+    j.filenames.push_back (notmuch_filenames_get (nm_fnms.get ()));
+  }
+
+  /* get tags from db */
+  NmTags nm_tags (notmuch_message_get_tags (j.message.get ()));
+  for (;
+       notmuch_tags_valid (nm_tags.get ());
+       notmuch_tags_move_to_next (nm_tags.get ())) {
+
+    const char * tag = notmuch_tags_get (nm_tags.get ());
+    j.db_tags.add (shared.tag_dict.intern (tag));
+  }
+
+  /* remove ignored tags */
+  j.db_tags -= shared.ignore_set;
+} // }}}
+
+void SyncEngine::read_message (MessageJob & j) { // {{{
+  /* read the X-Keywords of all the files of a message, this does not
+   * touch the database and may run on a worker thread. */
+
+  for (size_t i = 0; i < j.filenames.size (); i++) {
+    const string & fnm = j.filenames[i];
+
+    /* stat and header read ahead of time with io_uring */
+    HeaderRead * pre = (j.reads.empty () ? NULL : &j.reads[i]);
+
+    FileSnapshot f;
+    f.path = fnm;
+
+    bool stat_ok;
+    if (pre) {
+      stat_ok = pre->stat_ok;
+      f.st    = pre->st;
+    } else {
+      PhaseTimer t (metrics, PHASE_STAT);
+      stat_ok = (stat (fnm.c_str (), &f.st) == 0);
+    }
+
+    if (!stat_ok) {
+      throw SyncError ("file does not exist: db out of sync: " + fnm);
+    }
+
+    /* only add file if mtime is newer than specified */
+    if (c.mtime_set) {
+      ptime last_write = from_time_t (f.st.st_mtime);
+
+      if (last_write >= c.only_after_mtime) {
+        j.mtime_changed = true;
+      }
+    }
+
+    if ((c.mtime_set && j.mtime_changed) || !c.mtime_set) {
+      /* check if we have xkeyw header on this file */
+      PageCachePolicy policy = read_policy;
+      if (!j.cached.empty ()) policy.was_cached = j.cached[i];
+
+      read_snapshot (f, (pre && pre->read_ok ? &pre->buf : NULL), &policy);
+
+      if (!f.header.found) {
+        /* no such field */
+        if (c.enable_add_x_keywords_header) {
+          LOG_WARN ("warning: no X-Keywords header for file, will be added for file: " << fnm);
+        } else {
+          LOG_WARN ("warning: no X-Keywords header for file, skipping: " << fnm);
+          j.skipped_files++;
+          continue;
+        }
+      }
+    }
+
+    LOG_DEBUG ("* message file: " << fnm);
+
+    j.files.push_back (f);
+  }
+
+  if (j.files.size () == 0) {
+    j.state = MessageJob::NO_FILES;
+    return;
+  }
+
+  if (c.mtime_set && !j.mtime_changed) {
+    j.state = MessageJob::NOT_CHANGED;
+    return;
+  }
+
+  /* get and test if keywords are consistent between all files */
+  PhaseTimer t (metrics, PHASE_DIFF);
+  bool consistent = keywords_consistency_check (j.files, j.file_tags);
+  j.state = (consistent ? MessageJob::READY : MessageJob::INCONSISTENT);
+} // }}}
+
+void SyncEngine::commit_message (MessageJob & j) { // {{{
+  /* compare and apply the changes of a message, in query order on the
+   * main thread. */
+
+  /* destroyed with the job */
+  notmuch_message_t * message = j.message.get ();
+  TagSet & file_tags = j.file_tags;
+  TagSet & db_tags   = j.db_tags;
+
+  skipped_messages += j.skipped_files;
+
+  switch (j.state) {
+    case MessageJob::NO_FILES:
+      LOG_INFO ("no files with x-keywords header, skipping message.");
+      skipped_messages++;
+      count_checked++;
+      return;
+
+    case MessageJob::NOT_CHANGED:
+      LOG_DEBUG ("=> message _not_ changed, skipping..");
+
+      skipped_messages++;
+      count_checked++;
+      return;
+
+    case MessageJob::INCONSISTENT:
+      if (c.paranoid) {
+        throw SyncError ("=> error: inconsistent tags for files!");
+      } else {
+        LOG_ERROR ("=> error: inconsistent tags for files!");
+        /* possibly keep going? */
+        LOG_WARN ("=> skipping message.");
+        count_checked++;
+        skipped_messages++;
+        return;
+      }
+
+    case MessageJob::READY:
+      break;
+  }
+
+  if (c.mtime_set) {
+    LOG_VERBOSE ("=> " << notmuch_message_get_message_id (message) << " changed, checking..");
+  }
+
+  bool changed = false;
+
+  if (c.direction == KEYWORD_TO_TAG) { // {{{
+    /* keyword to tag mode */
+
+    PhaseTimer dt (metrics, PHASE_DIFF);
+
+    /* tags to add */
+    TagSet add = file_tags - db_tags;
+    if (c.only_remove) add = TagSet ();
+
+    /* tags to remove */
+    TagSet rem = db_tags - file_tags;
+    if (c.only_add) rem = TagSet ();
+
+    dt.stop ();
+
+    changed = write_db_tags (message, add, rem);
+
+    if (changed) count_changed++;
+
+    // }}}
+  } else if (c.direction == TAG_TO_KEYWORD) { /* tag to keyword mode {{{ */
+
+    PhaseTimer dt (metrics, PHASE_DIFF);
+
+    /* tags to add */
+    TagSet add = db_tags - file_tags;
+
+    /* tags to remove */
+    TagSet rem = file_tags - db_tags;
+
+    dt.stop ();
+
+    TagSet new_file_tags = file_tags;
+
+    if (!c.only_remove) {
+      if (!add.empty ()) {
+        LOG_DEBUG ("=> adding tags: " << tag_list (shared.tag_dict.names (add)) << (c.dryrun ? "[dryrun]" : ""));
+
+        new_file_tags |= add;
+
+        changed = true;
+      }
+    }
+
+    if (!c.only_add) {
+      if (!rem.empty ()) {
+        LOG_DEBUG ("=> removing tags: " << tag_list (shared.tag_dict.names (rem)) << (c.dryrun ? "[dryrun]" : ""));
+
+        new_file_tags -= rem;
+        changed = true;
+      }
+    }
+
+    if (changed) {
+      write_file_tags (j, new_file_tags);
+      count_changed++;
+    }
+
+    /* check maildir flags */
+    if (c.maildir_flags) {
+      LOG_DEBUG ("checking maildir flags..");
+
+      PhaseTimer t (metrics, PHASE_FLAGS);
+      notmuch_message_tags_to_maildir_flags (message);
+    }
+
+    // }}}
+  } else { /* bidirectional mode {{{ */
+
+    const char * id = notmuch_message_get_message_id (message);
+
+    TagSet base;
+    bool   has_base = base_store->get (id, base);
+
+    PhaseTimer dt (metrics, PHASE_DIFF);
+    TagSet merged = merge_tags (db_tags, file_tags, (has_base ? &base : NULL), c.conflict_policy);
+    dt.stop ();
+
+    LOG_DEBUG ("=> base tags: " << (has_base ? tag_list (shared.tag_dict.names (base)) : "(none)"));
+
+    /* local side: db */
+    bool db_changed = write_db_tags (message, merged - db_tags, db_tags - merged);
+
+    /* remote side: files */
+    bool files_changed = (merged != file_tags);
+    if (files_changed) {
+      LOG_DEBUG ("=> file tags: " << tag_list (shared.tag_dict.names (merged)) << (c.dryrun ? "[dryrun]" : ""));
+
+      write_file_tags (j, merged);
+    }
+
+    if (c.maildir_flags && (db_changed || files_changed) && !c.dryrun) {
+      PhaseTimer t (metrics, PHASE_FLAGS);
+      notmuch_message_tags_to_maildir_flags (message);
+    }
+
+    if (!c.dryrun) base_store->set (id, merged);
+
+    changed = db_changed || files_changed;
+    if (changed) count_changed++;
+  } // }}}
+
+  LOG_AT ((changed ? LEVEL_VERBOSE : LEVEL_DEBUG),
+      "* message (" << count_checked << "), file tags (" << file_tags.size()
+      << "): " << tag_list (shared.tag_dict.names (file_tags))
+      << ", db tags (" << db_tags.size() << "): " << tag_list (shared.tag_dict.names (db_tags)));
+
+  LOG_DEBUG ("==> message (" << count_checked << ") done.");
+
+  count_checked++;
+} // }}}
+
+bool SyncEngine::write_db_tags (notmuch_message_t * message, const TagSet & add_set, const TagSet & rem_set) { // {{{
+  /* apply tag changes to the db as part of a batch, with -f the maildir
+   * flags are synced to tags as well. returns true if there were any
+   * changes. */
+
+  /* tags to add */
+  vector<string> add = shared.tag_dict.names (add_set);
+
+  /* tags to remove */
+  vector<string> rem = shared.tag_dict.names (rem_set);
+
+  bool changed = (add.size () > 0 || rem.size () > 0);
+
+  if (plan) {
+    if (changed) {
+      LOG_DEBUG ("=> plan: adding tags: " << tag_list (add) << ", removing tags: " << tag_list (rem));
+      plan->add_message (notmuch_message_get_message_id (message), add, rem);
+    }
+
+    return changed;
+  }
+
+  /* apply all changes to the message at once, as part of a batch */
+  bool write = !c.dryrun && (changed || (c.maildir_flags && c.direction == KEYWORD_TO_TAG));
+
+  if (write) {
+    batcher->begin ();
+    notmuch_message_freeze (message);
+  }
+
+  /* check maildir flags */
+  if (c.maildir_flags && c.direction == KEYWORD_TO_TAG) {
+    /* may change path of file */
+    LOG_DEBUG ("checking maildir flags..");
+
+    PhaseTimer t (metrics, PHASE_FLAGS);
+    notmuch_message_maildir_flags_to_tags (message);
+  }
+
+  /* only timed if anything is written */
+  PhaseTimer t (metrics, PHASE_DB_WRITE);
+  if (!write || !changed) t.cancel ();
+
+  if (add.size () > 0) {
+    LOG_DEBUG ("=> adding tags: " << tag_list (add) << (c.dryrun ? "[dryrun]" : ""));
+
+    if (!c.dryrun) {
+      for (auto t : add) {
+        notmuch_status_t s = notmuch_message_add_tag (
+            message,
+            t.c_str());
+
+        if (s != NOTMUCH_STATUS_SUCCESS) {
+          throw SyncError ("error: could not add tag " + t + " to message.");
+        }
+
+      }
+    }
+  }
+
+  if (rem.size () > 0) {
+    LOG_DEBUG ("=> removing tags: " << tag_list (rem) << (c.dryrun ? "[dryrun]" : ""));
+
+    if (!c.dryrun) {
+      for (auto t : rem) {
+        notmuch_status_t s = notmuch_message_remove_tag (
+            message,
+            t.c_str());
+
+        if (s != NOTMUCH_STATUS_SUCCESS) {
+          throw SyncError ("error: could not remove tag " + t + " from message.");
+        }
+
+      }
+
+    }
+  }
+
+  if (write) {
+    notmuch_status_t s = notmuch_message_thaw (message);
+    if (s != NOTMUCH_STATUS_SUCCESS) {
+      throw SyncError ("error: could not thaw message.");
+    }
+
+    batcher->done ();
+  }
+
+  return changed;
+} // }}}
+
+void SyncEngine::write_file_tags (MessageJob & j, TagSet new_file_tags) { // {{{
+  /* write new keywords to all files of a message, keywords that are
+   * normally ignored are kept. */
+
+  /* get file tags with normally ignored kws */
+  TagSet & file_tags_all = j.files[0].all;
+  new_file_tags |= (file_tags_all - j.file_tags);
+
+  string id = notmuch_message_get_message_id (j.message.get ());
+
+  for (FileSnapshot & f : j.files) {
+    LOG_DEBUG ("old tags: " << tag_list (shared.tag_dict.names (j.file_tags)));
+    LOG_DEBUG ("new tags: " << tag_list (shared.tag_dict.names (new_file_tags)));
+
+    LOG_DEBUG ("file: " << f.path);
+
+    vector<string>  names = shared.tag_dict.names (new_file_tags);
+    write_tags (f, vector<ustring> (names.begin (), names.end ()), id);
+  }
+} // }}}
+
+bool SyncEngine::keywords_consistency_check (MessageSnapshot &files, TagSet &file_tags) { // {{{
+  /* check if all source files for one message have the same tags, outputs
+   * all discovered tags to file_tags */
+
+  bool first = true;
+  bool valid = true;
+
+  for (FileSnapshot & f : files) {
+    /* files skipped by the mtime check have not been read yet */
+    if (!f.read) read_snapshot (f, NULL, &read_policy);
+
+    if (!f.header.found) {
+      if (c.paranoid) {
+        throw SyncError ("error: no X-Keywords header for file: " + f.path);
+      }
+
+      LOG_INFO ("warning: no X-Keywords header for file: " << f.path);
+    }
+
+    if (first) {
+      first = false;
+      file_tags = f.tags;
+    } else if (f.tags != file_tags) {
+      valid = false;
+      file_tags |= f.tags;
+    }
+  }
+
+  return valid;
+} // }}}
+
+void SyncEngine::read_snapshot (FileSnapshot & f, const string * buf, PageCachePolicy * policy) { // {{{
+  /* read the X-Keywords header of a file into the snapshot, through the
+   * file cache if enabled, and parse its keywords. if buf is set it holds
+   * the already read header block of the file. */
+
+  string value;
+  bool   found;
+
+  if (file_cache && file_cache->lookup (f.st, value, found)) {
+    f.header = XKeywordsHeader ();
+    f.header.found = found;
+
+    if (found) {
+      XKeywordsField xf;
+      xf.value = value;
+      xf.line_begin = xf.value_begin = xf.value_end = 0;
+      f.header.fields.push_back (xf);
+    }
+
+  } else {
+    string read_buf;
+
+    if (!buf) {
+      PhaseTimer t (metrics, PHASE_READ);
+
+      if (!read_header_block (f.path.c_str (), read_buf, policy)) {
+        throw SyncError ("could not open file: " + f.path);
+      }
+
+      buf = &read_buf;
+    }
+
+    metrics.add_read (buf->size ());
+
+    {
+      PhaseTimer t (metrics, PHASE_PARSE);
+      scan_x_keywords (buf->data (), buf->size (), f.header);
+    }
+
+    f.scanned = true;
+
+    if (file_cache) {
+      file_cache->put (f.st, f.path, f.header.joined (), f.header.found);
+    }
+  }
+
+  f.read = true;
+  f.all  = parse_keywords (f.header);
+  f.tags = f.all - shared.ignore_set;
+
+  LOG_DEBUG ("tags after ignore: " << tag_list (shared.tag_dict.names (f.tags)));
+} // }}}
+
+TagSet SyncEngine::parse_keywords (const XKeywordsHeader & xkeyw) { // {{{
+  /* return the set of tags of the keywords in the X-Keywords header */
+
+  if (!xkeyw.found) return TagSet ();
+
+  PhaseTimer t (metrics, PHASE_DECODE);
+
+  string x_keywords = xkeyw.joined ();
+
+  LOG_DEBUG ("parsing keywords: " << x_keywords);
+
+  /* split, decode and map keywords straight into the tag set */
+  TagSet tags;
+  string scratch;
+
+  split_keywords (x_keywords, scratch, [&] (boost::string_view k) {
+      tags.add (shared.keyword_tag_id (k));
+    });
+
+  LOG_DEBUG ("tags after map: " << tag_list (shared.tag_dict.names (tags), "'"));
+
+  return tags;
+} // }}}
+
+void SyncEngine::write_tags (FileSnapshot & snap, vector<ustring> tags, const string & id) { // {{{
+  /* write tags back to the X-Keywords header */
+
+  /* reverse map and encode */
+  for (auto &t : tags) {
+    t = quote_keyword (shared.tag_keyword (t.raw ()));
+  }
+
+  sort (tags.begin (), tags.end());
+
+  ustring newh;
+  bool first = true;
+  for (auto t : tags) {
+    if (!first) newh = newh + ",";
+    first = false;
+    newh = newh + t;
+  }
+
+  write_keywords (snap, newh.raw (), id);
+} // }}}
+
+void SyncEngine::write_keywords (FileSnapshot & snap, const string & newv, const string & id) { // {{{
+  /* write a new value of the X-Keywords header, in place if it fits */
+  PhaseTimer t (metrics, PHASE_REWRITE);
+
+  const string & msg_path = snap.path;
+
+  LOG_DEBUG ("=> writing new x-keywords: " << newv);
+
+  /* use the header offsets from the snapshot, unless the file has
+   * changed since or they came from the file cache */
+  struct stat st;
+  if (!snap.scanned || stat (msg_path.c_str (), &st) != 0 || !snap.unchanged (st)) {
+    if (!scan_x_keywords (msg_path.c_str (), snap.header)) {
+      throw SyncError ("could not open file: " + msg_path);
+    }
+
+    snap.scanned = true;
+  }
+
+  XKeywordsHeader & xkeyw = snap.header;
+
+  if (xkeyw.fields.size () == 1 && xkeyw.fields[0].value == newv) {
+    LOG_VERBOSE ("x-keywords header unchanged, not writing: " << msg_path);
+    return;
+  }
+
+  if (plan) {
+    /* written by apply (), if the file is still as it was read */
+    LOG_VERBOSE ("plan: rewrite: " << msg_path);
+    plan->add_file (msg_path, id, snap.st, newv);
+    return;
+  }
+
+  if (xkeyw.fields.size () == 1 && c.x_keywords_padding > 0) {
+    XKeywordsField & f = xkeyw.fields[0];
+
+    /* try to fit the new value into the existing field (including its
+     * padding), this only touches the header bytes and leaves the rest
+     * of the file alone. */
+    string v = " " + newv;
+    size_t slot = f.value_end - f.value_begin;
+
+    if (v.size () <= slot) {
+      v.append (slot - v.size (), ' ');
+
+      if (c.dryrun) {
+        LOG_INFO ("dryrun: would update X-Keywords in place: " << msg_path);
+        return;
+      }
+
+      LOG_VERBOSE ("updating X-Keywords in place: " << msg_path);
+
+      metrics.add_written (v.size ());
+
+      string p = msg_path;
+      journal->patch (msg_path, f.value_begin, v, [this, p, newv] () {
+          update_file_cache (p, newv);
+        });
+
+      return;
+    }
+
+    LOG_VERBOSE ("x-keywords padding exceeded, rewriting: " << msg_path);
+  }
+
+  /* full rewrite */
+  string newline = "X-Keywords: " + newv;
+  if (newv.size () < (size_t) c.x_keywords_padding) {
+    newline.append (c.x_keywords_padding - newv.size (), ' ');
+  }
+
+  std::ifstream orig (msg_path.c_str(), ios::binary);
+  stringstream contents_s;
+  contents_s << orig.rdbuf ();
+  orig.close ();
+
+  string contents = contents_s.str ();
+  metrics.add_read (contents.size ());
+
+  if ((size_t) xkeyw.header_end > contents.size ()) {
+    throw SyncError ("could not read until end of header: " + msg_path);
+  }
+
+  string new_contents;
+  off_t  pos = 0;
+
+  for (auto & f : xkeyw.fields) {
+    LOG_DEBUG ("=> current xkeywords header: " << contents.substr (f.line_begin, f.value_end - f.line_begin));
+
+    new_contents.append (contents, pos, f.line_begin - pos);
+    pos = f.value_end;
+
+    if (&f != &xkeyw.fields.front ()) {
+      if (c.paranoid) {
+        throw SyncError ("found more than one X-Keywords header, failing: " + msg_path);
+      } else {
+        if (c.remove_double_x_keywords_header) {
+          LOG_WARN ("found more than one X-Keywords header, skipping redundant lines..");
+
+          /* skip line break as well */
+          if (contents[pos] == '\r') pos++;
+          if (contents[pos] == '\n') pos++;
+          continue;
+        } else {
+          LOG_WARN ("found more than one X-Keywords header, both are being updated.");
+        }
+      }
+    }
+
+    new_contents.append (newline);
+  }
+
+  if (!xkeyw.found) {
+    LOG_WARN ("could not find exisiting X-Keywords header.");
+    if (c.enable_add_x_keywords_header) {
+      path m_p = absolute(path(msg_path.c_str()));
+
+      /* test if path is in allowed path */
+      bool allowed = false;
+      while (m_p != path("/")) {
+        if (m_p == path (c.add_x_keyw_path)) {
+          allowed = true;
+          break;
+        }
+        m_p = m_p.parent_path();
+      }
+
+      if (allowed) {
+        LOG_WARN ("adding new X-Keywords header for " << msg_path);
+
+        /* insert before the empty line ending the header block */
+        off_t end = xkeyw.header_end;
+        if (end > 0 && contents[end-1] == '\n' &&
+            (end == 1 || contents[end-2] == '\n' ||
+             (contents[end-2] == '\r' && (end == 2 || contents[end-3] == '\n')))) {
+          end--;
+          if (end > 0 && contents[end-1] == '\r') end--;
+        }
+
+        new_contents.append (contents, 0, end);
+        new_contents.append (newline + "\n");
+        pos = end;
+
+      } else {
+        LOG_WARN ("not allowed to add X-Keywords header for: " << msg_path);
+      }
+
+    } else {
+      throw SyncError ("could not find existing X-Keywords header: " + msg_path);
+    }
+  }
+
+  new_contents.append (contents, pos, string::npos);
+
+  if (c.dryrun) {
+    char fname[1024] = "/tmp/keywsync-XXXXXX";
+    int tmpfd = mkstemp (fname);
+
+    ssize_t r;
+    r = write (tmpfd, new_contents.c_str(), new_contents.size());
+
+    if (r == -1) {
+      close (tmpfd);
+      throw SyncError ("failed writing file!");
+    }
+
+    close (tmpfd);
+
+    LOG_INFO ("dryrun: new file located in: " << fname);
+    return;
+  }
+
+  /* the header block is replaced, the body is moved along with it. the
+   * write is done when the journal is committed. */
+  size_t body_len = contents.size () - xkeyw.header_end;
+
+  LOG_VERBOSE ("rewriting: " << msg_path);
+
+  metrics.add_written (new_contents.size ());
+
+  string p = msg_path;
+  journal->rewrite (msg_path,
+      contents.substr (0, xkeyw.header_end),
+      new_contents.substr (0, new_contents.size () - body_len),
+      contents.substr (xkeyw.header_end),
+      [this, p, newv] () {
+        update_file_cache (p, newv);
+      });
+
+} // }}}
+
+/* utils {{{ */
+
+double thread_cpu_ms () {
+  /* clock () is the cpu time of the whole process, which includes the
+   * other engines running at the same time */
+  struct timespec ts;
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+string tag_list (const vector<string> & tags, const char * quote) {
+  string l;
+  for (auto & t : tags) {
+    l += quote;
+    l += t;
+    l += quote;
+    l += " ";
+  }
+
+  return l;
+}
+
+void SyncEngine::save_metrics () {
+  /* a failure to write the metrics does not fail the sync */
+  if (!c.metrics_json_path.empty () && !metrics.save_json (c.metrics_json_path)) {
+    LOG_WARN ("warning: could not write metrics: " << c.metrics_json_path);
+  }
+
+  if (!c.metrics_prom_path.empty () && !metrics.save_prometheus (c.metrics_prom_path)) {
+    LOG_WARN ("warning: could not write metrics: " << c.metrics_prom_path);
+  }
+}
+
+void SyncEngine::update_file_cache (const string & p, const string & value) {
+  if (!file_cache) return;
+
+  struct stat st;
+  if (stat (p.c_str (), &st) == 0) {
+    file_cache->put (st, p, value, true);
+  }
+}
+
+unsigned int SyncShared::keyword_tag_id (boost::string_view k) {
+  /* decode and map a keyword to a tag, memoized per distinct keyword */
+  string keyword (k.data (), k.size ());
+
+  {
+    unique_lock<mutex> lk (keyword_ids_m);
+    auto f = keyword_ids.find (keyword);
+    if (f != keyword_ids.end ()) return f->second;
+  }
+
+  string t = keyword;
+  string d;
+  switch (utf7.decode (keyword, d)) {
+    case Utf7Codec::PLAIN:
+      break;
+
+    case Utf7Codec::INVALID:
+      LOG_INFO ("error: invalid utf8 in keywords");
+      t = d;
+      break;
+
+    case Utf7Codec::CONVERTED:
+      t = d;
+      break;
+  }
+
+  string tag = rules.to_tag (t);
+  unsigned int id = tag_dict.intern (tag);
+
+  LOG_DEBUG ("keyword: " << keyword << " -> tag: " << tag);
+
+  unique_lock<mutex> lk (keyword_ids_m);
+  keyword_ids[keyword] = id;
+
+  return id;
+}
+
+string SyncShared::tag_keyword (const string & tag) {
+  string k = rules.to_keyword (tag);
+
+  string e;
+  if (utf7.encode (k, e) != Utf7Codec::PLAIN) k = e;
+
+  return k;
+}
+
+NmDatabase setup_db (const char * db_path, notmuch_database_mode_t mode) {
+
+  notmuch_database_t * db;
+  auto s = notmuch_database_open (db_path,
+      mode,
+      &db);
+
+  if (s != NOTMUCH_STATUS_SUCCESS) {
+    throw SyncError ("db: could not open database.");
+  }
+
+  return NmDatabase (db);
+}
+
+/* }}} */
+
@@ -0,0 +1,325 @@
+# pragma once
+
+/* sync engine (libkeywsync)
+ *
+ * one sync job: the messages of a query (or of a set of files) of one
+ * notmuch database in one direction, with its own options, counters,
+ * metrics, journal and caches.
+ *
+ * the keyword <-> tag tables and the worker pool are shared by all the
+ * engines of a process (SyncShared), so that several jobs can run at the
+ * same time on different databases, each from its own thread. an engine
+ * is only used from the thread owning its database.
+ *
+ * the database is opened (read-write) and closed by the caller, e.g. a
+ * mail client syncing the files of a message after changing its tags:
+ *
+ *   SyncShared shared;          // once, rules set up before init ()
+ *   shared.init ();
+ *
+ *   SyncConfig c;
+ *   c.direction   = TAG_TO_KEYWORD;
+ *   c.journal_dir = db_path + "/.notmuch/keywsync-journal";
+ *
+ *   SyncEngine e (shared, c, db);
+ *   SyncReport r = e.sync_files (filenames);
+ *   if (!r.ok) ..r.error..
+ *
+ * with plan_path set nothing is written: the changes are recorded in a
+ * plan (plan.hh) for apply (), and the database may be opened read-only.
+ *
+ * errors are returned in the report, nothing exits. output goes through
+ * the logger (logger.hh), set its level to LEVEL_WARN for a quiet engine.
+ */
+
+# include <vector>
+# include <string>
+# include <memory>
+# include <mutex>
+# include <functional>
+# include <unordered_map>
+# include <set>
+# include <chrono>
+# include <ctime>
+
+# include <glibmm.h>
+
+# include <boost/utility/string_view.hpp>
+# include <boost/date_time/posix_time/posix_time.hpp>
+
+# include <notmuch.h>
+
+# include "tagset.hh"
+# include "rules.hh"
+# include "utf7.hh"
+# include "snapshot.hh"
+# include "basestore.hh"
+# include "state.hh"
+# include "uring.hh"
+# include "pagecache.hh"
+# include "metrics.hh"
+# include "pipeline.hh"
+# include "handles.hh"
+# include "plan.hh"
+
+class CommitBatcher;
+class FileCache;
+class WriteJournal;
+
+enum Direction {
+  NONE,
+  TAG_TO_KEYWORD,
+  KEYWORD_TO_TAG,
+  BIDIRECTIONAL,
+};
+
+/* tables and threads shared by all engines, set up once */
+struct SyncShared {
+  /* keyword <-> tag rules, see rules.hh and examples/keywsync.rules */
+  Rules rules;
+
+  Utf7Codec utf7;
+
+  /* all tags seen during the run, and the ignored ones as a set */
+  TagDict tag_dict;
+  TagSet  ignore_set;
+
+  /* keyword -> tag id, memoized */
+  std::unordered_map<std::string, unsigned int> keyword_ids;
+  std::mutex keyword_ids_m;
+
+  /* reads message files, NULL: read on the thread of the engine */
+  WorkerPool * pool = NULL;
+
+  /* the summaries of engines running at the same time are not mixed */
+  std::mutex output_m;
+
+  /* call once the rules are set up */
+  void init ();
+
+  unsigned int keyword_tag_id (boost::string_view);
+
+  /* the keyword written for a tag (mapped and encoded, not quoted) */
+  std::string tag_keyword (const std::string &);
+};
+
+/* options of one job, paths are resolved */
+struct SyncConfig {
+  std::string db_path;
+  std::string query;    /* for run (), also restricts sync_files () */
+
+  /* shown with the summary if set */
+  std::string label;
+
+  Direction direction = NONE;
+
+  bool mtime_set = false;
+  boost::posix_time::ptime only_after_mtime;
+
+  bool        incremental = false;
+  std::string state_path;
+
+  bool        watch = false;
+  std::string watch_path;
+  int         watch_debounce = 200;
+
+  std::string walk_path;
+  bool        walk_prune = true;
+
+  /* keyword-to-tag: find the messages to check with queries on the
+   * X-Keywords header indexed by notmuch under this prefix */
+  std::string index_prefix;
+
+  bool dryrun  = false;
+  bool paranoid = false;
+  bool only_add = false;
+  bool only_remove = false;
+  bool maildir_flags = false;
+  bool enable_add_x_keywords_header = false;
+  std::string add_x_keyw_path;
+
+  bool remove_double_x_keywords_header = true;
+
+  /* pad X-Keywords to this width when writing, allows in-place updates */
+  int x_keywords_padding = 0;
+
+  int batch_size = 100;
+  int batch_interval = 1000; /* ms */
+
+  std::string file_cache_path;
+  bool        cache_friendly = false;
+  int         io_uring_depth = 0; /* 0: disabled */
+
+  std::string journal_dir;
+
+  /* bidirectional sync */
+  std::string    base_path;
+  ConflictPolicy conflict_policy = CONFLICT_UNION;
+
+  /* per-phase timings and byte counts, written to these files if set */
+  std::string metrics_json_path;
+  std::string metrics_prom_path;
+
+  /* record the changes in a plan instead of writing them, the tag
+   * changes are also written as notmuch tag --batch input if set */
+  std::string plan_path;
+  std::string plan_batch_path;
+};
+
+/* per-message work passed through the pipeline */
+struct MessageJob {
+  enum State {
+    READY,
+    NO_FILES,
+    NOT_CHANGED,
+    INCONSISTENT,
+  };
+
+  NmMessage message;
+
+  std::vector<std::string> filenames;
+  TagSet                   db_tags;   /* ignored tags removed */
+
+  /* filled in by read_message () */
+  State           state = READY;
+  MessageSnapshot files;     /* files with an X-Keywords header */
+  TagSet          file_tags;
+  bool            mtime_changed = false;
+  int             skipped_files = 0;
+
+  /* filled in by prefetch_headers () with io_uring, one per filename */
+  std::vector<HeaderRead> reads;
+
+  /* filled in by prefetch_pages () with --cache-friendly, bytes of each
+   * file that were in the page cache before prefetching */
+  std::vector<long>       cached;
+};
+
+/* outcome of a sync */
+struct SyncReport {
+  bool   ok = true;
+  std::string error;        /* what failed, if not ok */
+
+  int checked = 0;     /* messages */
+  int changed = 0;
+  int skipped = 0;
+
+  double elapsed = 0;  /* s */
+};
+
+class SyncEngine {
+  public:
+    /* db stays owned by the caller, it may be NULL for watch () */
+    SyncEngine (SyncShared &, const SyncConfig &, notmuch_database_t * db = NULL);
+    ~SyncEngine ();
+
+    /* the sync of the config: its query (or walk), incremental if set */
+    SyncReport run ();
+
+    /* sync the messages matching query */
+    SyncReport sync_messages (const std::string & query);
+
+    /* sync the messages of these message files, files not in the
+     * database or whose message does not match the query of the config
+     * (if set) are skipped */
+    SyncReport sync_files (const std::vector<std::string> & paths);
+
+    /* keyword-to-tag sync of changed files until interrupted, the
+     * database is opened with open_db while a batch is synced. */
+    SyncReport watch (std::function<NmDatabase ()> open_db);
+
+    /* apply a plan made by an earlier run with plan_path, with the options
+     * it was made with. entries for messages or files changed since are
+     * skipped, and the files of messages changed since. counts entries
+     * instead of messages. */
+    SyncReport apply (const Plan &);
+
+    /* of all syncs of this engine */
+    const Metrics & get_metrics () const { return metrics; }
+
+  private:
+    SyncShared & shared;
+    SyncConfig   c;
+
+    int count_checked = 0;
+    int count_changed = 0;
+    int skipped_messages = 0;
+
+    /* every message of the query was looked at, see finish () */
+    bool full_run = false;
+
+    notmuch_database_t * nm_db;
+
+    CommitBatcher * batcher = NULL;
+    std::unique_ptr<FileCache>    file_cache;
+    std::unique_ptr<WriteJournal> journal;
+
+    /* batched reads with io_uring, NULL if disabled or unavailable */
+    std::unique_ptr<UringReader>  uring;
+
+    /* base state for bidirectional sync */
+    std::unique_ptr<BaseStore>    base_store;
+
+    /* incremental sync, saved after a successful run */
+    std::unique_ptr<SyncState>    state;
+    SyncState::Entry              state_now;
+    std::string                   state_key;
+
+    /* page cache use of message file reads */
+    PageCacheStats  page_cache_stats;
+    PageCachePolicy read_policy;
+
+    Metrics metrics;
+
+    /* changes of a run with plan_path, saved after a successful run */
+    std::unique_ptr<Plan> plan;
+
+    /* start, sync and finish, catching errors into the report */
+    SyncReport guard (std::function<void()> sync, bool need_db = true);
+
+    /* journal recovery, caches and base state */
+    void start ();
+
+    /* write queued changes, save the caches and print the summary */
+    void finish (std::chrono::steady_clock::time_point t0, double cpu0);
+
+    void save_metrics ();
+
+    void sync_config      ();
+    void sync_query       (const Glib::ustring &, const std::set<std::string> * skip = NULL);
+    void sync_each        (std::function<NmMessage ()> next, unsigned int total);
+    void sync_paths       (const std::vector<std::string> & paths, const std::set<std::string> * skip = NULL);
+    void prefetch_headers (std::vector<MessageJob *> &);
+    void prefetch_pages   (MessageJob &);
+    void sync_walk        (const std::string & root, const std::set<std::string> * skip = NULL);
+    bool index_configured ();
+    void sync_indexed     (const std::string & query, const std::string & changed, std::set<std::string> & checked);
+    void watch_maildir    (std::function<NmDatabase ()> open_db, NmDatabase & db);
+    void apply_plan       (const Plan &);
+
+    void gather_message (MessageJob &, NmMessage);
+    void read_message   (MessageJob &);
+    void commit_message (MessageJob &);
+
+    bool write_db_tags   (notmuch_message_t *, const TagSet & add, const TagSet & rem);
+    void write_file_tags (MessageJob &, TagSet);
+
+    bool   keywords_consistency_check (MessageSnapshot &, TagSet &);
+    void   read_snapshot (FileSnapshot &, const std::string * buf = NULL, PageCachePolicy * policy = NULL);
+    TagSet parse_keywords (const XKeywordsHeader &);
+    /* id: of the message of the file, recorded in a plan */
+    void   write_tags (FileSnapshot &, std::vector<Glib::ustring> tags, const std::string & id);
+    void   write_keywords (FileSnapshot &, const std::string & value, const std::string & id);
+
+    void update_file_cache (const std::string &, const std::string &);
+};
+
+/* open a notmuch database (read-write by default), throws SyncError */
+NmDatabase setup_db (const char *, notmuch_database_mode_t = NOTMUCH_DATABASE_MODE_READ_WRITE);
+
+/* cpu time of the calling thread */
+double thread_cpu_ms ();
+
+/* tags separated (and followed) by a space, for logging */
+std::string tag_list (const std::vector<std::string> &, const char * quote = "");
+
@@ -0,0 +1,17 @@
+# pragma once
+
+/* errors that abort a sync
+ *
+ * thrown instead of exiting, so that open handles are released on the way
+ * out. the open transaction is closed with the messages completed before
+ * the error, the engine returns the message in its report (engine.hh).
+ */
+
+# include <stdexcept>
+# include <string>
+
+class SyncError : public std::runtime_error {
+  public:
+    SyncError (const std::string & what) : std::runtime_error (what) { }
+};
+
@@ -0,0 +1,262 @@
+# include "filecache.hh"
+
+# include <iostream>
+# include <string>
+# include <vector>
+# include <map>
+# include <cstring>
+# include <cstdio>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+# include "logger.hh"
+
+using namespace std;
+
+static const char cache_magic[8] = { 'K', 'W', 'S', 'C', 'A', 'C', 'H', '1' };
+
+FileCache::FileCache (string path) : cache_path (path) {
+}
+
+FileCache::~FileCache () {
+  if (mapped) munmap (mapped, mapped_size);
+}
+
+int64_t FileCache::mtime_ns (const struct stat & st) {
+  return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool FileCache::load () {
+  int fd = open (cache_path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    /* no cache yet */
+    return true;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (Header)) {
+    close (fd);
+    return false;
+  }
+
+  void * p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (p == MAP_FAILED) return false;
+
+  const Header * h = (const Header *) p;
+  uint64_t space = st.st_size - sizeof (Header);
+
+  if (memcmp (h->magic, cache_magic, sizeof (cache_magic)) != 0 ||
+      h->count > space / sizeof (Record) ||
+      h->pool_size != space - h->count * sizeof (Record)) {
+    munmap (p, st.st_size);
+    return false;
+  }
+
+  /* every string must be in the pool */
+  const Record * recs = (const Record *) ((const char *) p + sizeof (Header));
+  for (uint64_t i = 0; i < h->count; i++) {
+    const Record & r = recs[i];
+
+    if ((uint64_t) r.path_off + r.path_len > h->pool_size ||
+        (uint64_t) r.value_off + r.value_len > h->pool_size) {
+      munmap (p, st.st_size);
+      return false;
+    }
+  }
+
+  mapped      = p;
+  mapped_size = st.st_size;
+  header      = h;
+  records     = (const Record *) ((const char *) p + sizeof (Header));
+  pool        = (const char *) (records + h->count);
+
+  seen.assign (h->count, 0);
+
+  return true;
+}
+
+const FileCache::Record * FileCache::find (Key k) {
+  if (!header) return NULL;
+
+  /* records are sorted on (dev, ino) */
+  size_t lo = 0, hi = header->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    Key mk (records[mid].dev, records[mid].ino);
+
+    if (mk < k) lo = mid + 1;
+    else hi = mid;
+  }
+
+  if (lo < header->count && Key (records[lo].dev, records[lo].ino) == k)
+    return &records[lo];
+
+  return NULL;
+}
+
+bool FileCache::contains (const struct stat & st) {
+  Key k (st.st_dev, st.st_ino);
+  int64_t mt = mtime_ns (st);
+
+  unique_lock<mutex> lk (m);
+
+  auto c = changed.find (k);
+  if (c != changed.end ()) {
+    return (c->second.size == (uint64_t) st.st_size && c->second.mtime_ns == mt);
+  }
+
+  const Record * r = find (k);
+  return (r && r->size == (uint64_t) st.st_size && r->mtime_ns == mt);
+}
+
+bool FileCache::lookup (const struct stat & st, string & value, bool & found) {
+  Key k (st.st_dev, st.st_ino);
+  int64_t mt = mtime_ns (st);
+
+  unique_lock<mutex> lk (m);
+
+  auto c = changed.find (k);
+  if (c != changed.end ()) {
+    if (c->second.size == (uint64_t) st.st_size && c->second.mtime_ns == mt) {
+      value = c->second.value;
+      found = c->second.found;
+      hits++;
+      return true;
+    }
+
+    misses++;
+    return false;
+  }
+
+  const Record * r = find (k);
+  if (r) {
+    seen[r - records] = 1;
+
+    if (r->size == (uint64_t) st.st_size && r->mtime_ns == mt) {
+      value = string (pool + r->value_off, r->value_len);
+      found = (r->flags & FLAG_FOUND);
+      hits++;
+      return true;
+    }
+  }
+
+  misses++;
+  return false;
+}
+
+void FileCache::put (const struct stat & st, const string & path, const string & value, bool found) {
+  Entry e;
+  e.size     = st.st_size;
+  e.mtime_ns = mtime_ns (st);
+  e.path     = path;
+  e.value    = value;
+  e.found    = found;
+
+  unique_lock<mutex> lk (m);
+  changed[Key (st.st_dev, st.st_ino)] = e;
+}
+
+bool FileCache::save (function<bool(const string &)> keep) {
+  unique_lock<mutex> lk (m);
+
+  if (!keep && changed.empty ()) return true;
+
+  /* merge unchanged records with changes */
+  map<Key, Entry> all;
+
+  unsigned long pruned = 0;
+
+  if (header) {
+    for (uint64_t i = 0; i < header->count; i++) {
+      const Record & r = records[i];
+      Key k (r.dev, r.ino);
+
+      if (changed.count (k)) continue;
+
+      Entry e;
+      e.size     = r.size;
+      e.mtime_ns = r.mtime_ns;
+      e.path     = string (pool + r.path_off, r.path_len);
+      e.value    = string (pool + r.value_off, r.value_len);
+      e.found    = (r.flags & FLAG_FOUND);
+
+      if (!seen[i] && keep && !keep (e.path)) {
+        pruned++;
+        continue;
+      }
+
+      all[k] = e;
+    }
+  }
+
+  for (auto & c : changed) all[c.first] = c.second;
+
+  vector<Record> recs;
+  string         strings;
+
+  recs.reserve (all.size ());
+
+  for (auto & a : all) {
+    Record r;
+    memset (&r, 0, sizeof (r));
+
+    r.dev      = get<0> (a.first);
+    r.ino      = get<1> (a.first);
+    r.size     = a.second.size;
+    r.mtime_ns = a.second.mtime_ns;
+    r.flags    = (a.second.found ? FLAG_FOUND : 0);
+
+    r.path_off = strings.size ();
+    r.path_len = a.second.path.size ();
+    strings   += a.second.path;
+
+    r.value_off = strings.size ();
+    r.value_len = a.second.value.size ();
+    strings    += a.second.value;
+
+    recs.push_back (r);
+  }
+
+  Header h;
+  memcpy (h.magic, cache_magic, sizeof (cache_magic));
+  h.count     = recs.size ();
+  h.pool_size = strings.size ();
+
+  /* write new cache next to the old one and replace it */
+  string tmp = cache_path + ".tmp";
+  FILE * f = fopen (tmp.c_str (), "wb");
+  if (f == NULL) {
+    LOG_ERROR ("cache: could not write: " << tmp);
+    return false;
+  }
+
+  bool ok = (fwrite (&h, sizeof (h), 1, f) == 1);
+  if (ok && recs.size () > 0)
+    ok = (fwrite (recs.data (), sizeof (Record), recs.size (), f) == recs.size ());
+  if (ok && strings.size () > 0)
+    ok = (fwrite (strings.data (), strings.size (), 1, f) == 1);
+
+  ok = (fclose (f) == 0) && ok;
+
+  if (!ok || rename (tmp.c_str (), cache_path.c_str ()) != 0) {
+    LOG_ERROR ("cache: could not write: " << cache_path);
+    unlink (tmp.c_str ());
+    return false;
+  }
+
+  if (pruned > 0) {
+    LOG_INFO ("*  cache: pruned " << pruned << " files no longer in the database.");
+  }
+
+  return true;
+}
+
+void FileCache::print_stats () {
+  cout << "*  cache: " << hits << " hits, " << misses << " misses." << endl;
+}
+
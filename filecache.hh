@@ -0,0 +1,106 @@
+# pragma once
+
+/* persistent cache of X-Keywords values per message file
+ *
+ * files are identified by (dev, inode) and considered unchanged as long as
+ * their size and mtime (ns) are the same as when they were cached. an
+ * unchanged file is served from the cache without being opened.
+ *
+ * the cache file is a sorted array of fixed size records followed by a
+ * string pool, it is mmap'ed read-only when loaded. changes during a run
+ * are kept in memory and merged into a new cache file on save (). records
+ * of files not seen during the run are only kept if `keep` returns true for
+ * their path, only pass it after a run that looked at every file.
+ */
+
+# include <string>
+# include <vector>
+# include <map>
+# include <tuple>
+# include <mutex>
+# include <functional>
+# include <cstdint>
+# include <sys/stat.h>
+
+using namespace std;
+
+class FileCache {
+  public:
+    FileCache (string path);
+    ~FileCache ();
+
+    /* load cache file if it exists, returns false if it is invalid */
+    bool load ();
+
+    /* save cache, keep is called for each unseen file (if set). without
+     * keep nothing is written unless there are changes */
+    bool save (function<bool(const string &)> keep);
+
+    /* look up file, returns true and sets value and found if the
+     * cached entry is still valid. */
+    bool lookup (const struct stat & st, string & value, bool & found);
+
+    /* true if there is a valid entry for the file, not counted as a
+     * lookup */
+    bool contains (const struct stat & st);
+
+    /* add or update file */
+    void put (const struct stat & st, const string & path, const string & value, bool found);
+
+    void print_stats ();
+
+  private:
+    struct Header {
+      char     magic[8];
+      uint64_t count;
+      uint64_t pool_size;
+    };
+
+    struct Record {
+      uint64_t dev;
+      uint64_t ino;
+      uint64_t size;
+      int64_t  mtime_ns;
+
+      uint32_t path_off;
+      uint32_t path_len;
+      uint32_t value_off;
+      uint32_t value_len;
+      uint32_t flags;
+      uint32_t pad;
+    };
+
+    static const uint32_t FLAG_FOUND = 1;
+
+    struct Entry {
+      uint64_t size;
+      int64_t  mtime_ns;
+      string   path;
+      string   value;
+      bool     found;
+    };
+
+    typedef tuple<uint64_t, uint64_t> Key;
+
+    string cache_path;
+
+    /* mapped cache file */
+    void *         mapped = NULL;
+    size_t         mapped_size = 0;
+    const Header * header = NULL;
+    const Record * records = NULL;
+    const char *   pool = NULL;
+    vector<char>   seen; /* record has been looked up this run */
+
+    /* entries added or updated during this run */
+    map<Key, Entry> changed;
+
+    mutex m;
+
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+
+    const Record * find (Key);
+    static int64_t mtime_ns (const struct stat &);
+};
+
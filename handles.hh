@@ -0,0 +1,39 @@
+# pragma once
+
+/* owning handles for notmuch and glib objects
+ *
+ * notmuch objects are talloc'ed under their parent (a message under its
+ * query or the database) and otherwise only freed with the parent, which
+ * makes a forgotten destroy a leak for the rest of the run. these release
+ * them when they go out of scope, also when an error is thrown.
+ */
+
+# include <memory>
+# include <notmuch.h>
+# include <glib.h>
+
+struct NmDeleter {
+  void operator() (notmuch_database_t * d)  { notmuch_database_destroy (d); }
+  void operator() (notmuch_query_t * q)     { notmuch_query_destroy (q); }
+  void operator() (notmuch_messages_t * m)  { notmuch_messages_destroy (m); }
+  void operator() (notmuch_message_t * m)   { notmuch_message_destroy (m); }
+  void operator() (notmuch_filenames_t * f) { notmuch_filenames_destroy (f); }
+  void operator() (notmuch_tags_t * t)      { notmuch_tags_destroy (t); }
+};
+
+/* destroying the database closes it, a transaction that is still open is
+ * discarded. */
+typedef std::unique_ptr<notmuch_database_t, NmDeleter>  NmDatabase;
+typedef std::unique_ptr<notmuch_query_t, NmDeleter>     NmQuery;
+typedef std::unique_ptr<notmuch_messages_t, NmDeleter>  NmMessages;
+typedef std::unique_ptr<notmuch_message_t, NmDeleter>   NmMessage;
+typedef std::unique_ptr<notmuch_filenames_t, NmDeleter> NmFilenames;
+typedef std::unique_ptr<notmuch_tags_t, NmDeleter>      NmTags;
+
+struct GFreeDeleter {
+  void operator() (char * c) { g_free (c); }
+};
+
+/* string allocated by glib */
+typedef std::unique_ptr<char, GFreeDeleter> GChars;
+
@@ -0,0 +1,59 @@
+# include "jobs.hh"
+
+# include <iostream>
+# include <fstream>
+# include <string>
+# include <vector>
+# include <map>
+
+using namespace std;
+
+bool load_jobs (const string & path, vector<JobLine> & jobs) {
+  ifstream f (path);
+  if (!f.good ()) {
+    cerr << "jobs: could not open: " << path << endl;
+    return false;
+  }
+
+  string line;
+  int    lineno = 0;
+
+  while (getline (f, line)) {
+    lineno++;
+
+    size_t b = line.find_first_not_of (" \t\r");
+    if (b == string::npos || line[b] == '#') continue;
+
+    JobLine j;
+    j.line = lineno;
+
+    if (!split_args (line, j.args)) {
+      cerr << "jobs: unterminated quote or escape on line " << lineno << " of " << path << endl;
+      return false;
+    }
+
+    jobs.push_back (j);
+  }
+
+  return true;
+}
+
+vector<vector<size_t>> group_jobs (const vector<string> & keys) {
+  vector<vector<size_t>> groups;
+  map<string, size_t>    index;
+
+  for (size_t i = 0; i < keys.size (); i++) {
+    auto f = index.find (keys[i]);
+
+    if (f == index.end ()) {
+      index[keys[i]] = groups.size ();
+      groups.push_back (vector<size_t> ());
+      groups.back ().push_back (i);
+    } else {
+      groups[f->second].push_back (i);
+    }
+  }
+
+  return groups;
+}
+
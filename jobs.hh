@@ -0,0 +1,40 @@
+# pragma once
+
+/* job files
+ *
+ * a job file lists several syncs to run in one process, one job per line
+ * with the same options as on the command line:
+ *
+ *   # keywords to tags for both accounts, then tags back for gmail
+ *   -m /home/me/.mail -q "folder:gmail" -k -i
+ *   -m /home/me/work  -q "*" -k --file-cache /home/me/.cache/work.kwc
+ *   -m /home/me/.mail -q "folder:gmail" -t --pad-x-keywords 80
+ *
+ * blank lines and lines starting with '#' are skipped. arguments are split
+ * like a shell would (quotes and backslashes, split_args in tokenizer.hh),
+ * nothing is expanded.
+ *
+ * jobs on the same database run in the order they are listed, jobs on
+ * different databases may run at the same time.
+ */
+
+# include <string>
+# include <vector>
+
+# include "tokenizer.hh"
+
+using namespace std;
+
+struct JobLine {
+  int            line;
+  vector<string> args;
+};
+
+/* read a job file, returns false if it can not be read or a line can not
+ * be split */
+bool load_jobs (const string & path, vector<JobLine> & jobs);
+
+/* group the indices of keys by key in the order of first appearance, the
+ * order within a group is kept */
+vector<vector<size_t>> group_jobs (const vector<string> & keys);
+
@@ -0,0 +1,440 @@
+# include "journal.hh"
+
+# include <iostream>
+# include <string>
+# include <vector>
+# include <set>
+# include <algorithm>
+# include <cstring>
+# include <cerrno>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <dirent.h>
+# include <sys/stat.h>
+
+# include "error.hh"
+# include "logger.hh"
+
+using namespace std;
+
+static const char     journal_magic[4] = { 'K', 'W', 'J', '2' };
+static const uint64_t max_field = 1ULL << 32; /* sanity limit on lengths */
+
+WriteJournal::WriteJournal (string dir, unsigned int batch) :
+  dir (dir),
+  journal_path (dir + "/journal"),
+  batch (batch > 0 ? batch : 1)
+{
+}
+
+WriteJournal::~WriteJournal () {
+  for (auto & p : pending) close (p.fd);
+  if (jfd >= 0) close (jfd);
+}
+
+bool WriteJournal::open () {
+  if (mkdir (dir.c_str (), 0700) != 0 && errno != EEXIST) {
+    LOG_ERROR ("journal: could not create directory: " << dir << ": " << strerror (errno));
+    return false;
+  }
+
+  jfd = ::open (journal_path.c_str (), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (jfd < 0) {
+    LOG_ERROR ("journal: could not open: " << journal_path << ": " << strerror (errno));
+    return false;
+  }
+
+  /* make sure the journal file itself survives a crash */
+  int dfd = ::open (dir.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd >= 0) {
+    fsync (dfd);
+    close (dfd);
+  }
+
+  return true;
+}
+
+bool WriteJournal::pending_recovery () {
+  struct stat st;
+  return (stat (journal_path.c_str (), &st) == 0 && st.st_size > 0);
+}
+
+/* helpers {{{ */
+static uint32_t checksum (const char * d, size_t len) {
+  /* fnv-1a */
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) d[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+template<class T> static void put (string & s, T v) {
+  s.append ((const char *) &v, sizeof (v));
+}
+
+template<class T> static bool get (const string & s, size_t & pos, T & v) {
+  if (s.size () - pos < sizeof (v)) return false;
+  memcpy (&v, s.data () + pos, sizeof (v));
+  pos += sizeof (v);
+  return true;
+}
+
+static bool write_all (int fd, const string & d, off_t offset) {
+  size_t done = 0;
+  while (done < d.size ()) {
+    ssize_t r = pwrite (fd, d.data () + done, d.size () - done, offset + done);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+static bool read_all (int fd, string & d) {
+  d.clear ();
+  char    buf[64 * 1024];
+  off_t   off = 0;
+  ssize_t r;
+
+  while ((r = pread (fd, buf, sizeof (buf), off)) != 0) {
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    d.append (buf, r);
+    off += r;
+  }
+
+  return true;
+}
+/* }}} */
+
+string WriteJournal::serialize (const Record & r) {
+  string s;
+  s.append (journal_magic, sizeof (journal_magic));
+  put<uint32_t> (s, r.type);
+  put<uint32_t> (s, r.path.size ());
+  put<uint64_t> (s, r.size);
+  put<uint64_t> (s, r.offset);
+  put<uint64_t> (s, r.old_data.size ());
+  put<uint64_t> (s, r.new_data.size ());
+  put<uint64_t> (s, r.body.size ());
+  s += r.path;
+  s += r.old_data;
+  s += r.new_data;
+  s += r.body;
+  put<uint32_t> (s, checksum (s.data (), s.size ()));
+
+  return s;
+}
+
+bool WriteJournal::parse (const string & buf, size_t & pos, Record & r) {
+  /* returns false at the end of the journal or at a torn record */
+  size_t   start = pos;
+  uint32_t type, path_len, sum;
+  uint64_t old_len, new_len, body_len;
+
+  if (buf.size () - pos < sizeof (journal_magic) ||
+      memcmp (buf.data () + pos, journal_magic, sizeof (journal_magic)) != 0) return false;
+  pos += sizeof (journal_magic);
+
+  if (!get (buf, pos, type) || !get (buf, pos, path_len) ||
+      !get (buf, pos, r.size) || !get (buf, pos, r.offset) || !get (buf, pos, old_len) ||
+      !get (buf, pos, new_len) || !get (buf, pos, body_len)) return false;
+
+  if (old_len > max_field || new_len > max_field || body_len > max_field) return false;
+  if (type != PATCH && type != REWRITE) return false;
+
+  uint64_t data_len = path_len + old_len + new_len + body_len;
+  if (buf.size () - pos < data_len + sizeof (sum)) return false;
+
+  r.type     = (Type) type;
+  r.path     = buf.substr (pos, path_len); pos += path_len;
+  r.old_data = buf.substr (pos, old_len);  pos += old_len;
+  r.new_data = buf.substr (pos, new_len);  pos += new_len;
+  r.body     = buf.substr (pos, body_len); pos += body_len;
+
+  size_t end = pos;
+  if (!get (buf, pos, sum)) return false;
+
+  return (sum == checksum (buf.data () + start, end - start));
+}
+
+string WriteJournal::resolve (const string & p) {
+  /* the file may have been renamed since by a maildir flag sync, look
+   * for the same unique name in cur/ and new/. */
+  struct stat st;
+  if (stat (p.c_str (), &st) == 0) return p;
+
+  size_t s = p.rfind ('/');
+  if (s == string::npos || s < 4) return "";
+
+  string box  = p.substr (0, s - 4);
+  string name = p.substr (s + 1);
+  string uniq = name.substr (0, name.find (':'));
+
+  for (auto sub : { "/cur", "/new" }) {
+    string d = box + sub;
+    DIR * dh = opendir (d.c_str ());
+    if (dh == NULL) continue;
+
+    struct dirent * e;
+    string found;
+    while ((e = readdir (dh)) != NULL) {
+      string n = e->d_name;
+      if (n == uniq || n.compare (0, uniq.size () + 1, uniq + ":") == 0) {
+        found = d + "/" + n;
+        break;
+      }
+    }
+
+    closedir (dh);
+    if (!found.empty ()) return found;
+  }
+
+  return "";
+}
+
+void WriteJournal::append (Pending & p) {
+  string s = serialize (p.r);
+
+  struct stat st;
+  if (fstat (jfd, &st) != 0 || !write_all (jfd, s, st.st_size)) {
+    close (p.fd);
+    throw SyncError ("journal: could not write: " + journal_path);
+  }
+
+  records++;
+}
+
+void WriteJournal::patch (const string & path, off_t offset, const string & now, function<void()> done) {
+  Pending p;
+  p.r.type   = PATCH;
+  p.r.path   = path;
+  p.r.offset = offset;
+  p.r.new_data = now;
+  p.done = done;
+
+  p.fd = ::open (path.c_str (), O_RDWR | O_CLOEXEC);
+  if (p.fd < 0) {
+    throw SyncError ("could not open file for writing: " + path);
+  }
+
+  struct stat st;
+  if (fstat (p.fd, &st) != 0) {
+    close (p.fd);
+    throw SyncError ("could not stat file for writing: " + path);
+  }
+  p.r.size = st.st_size;
+
+  p.r.old_data.resize (now.size ());
+  ssize_t r = pread (p.fd, &p.r.old_data[0], now.size (), offset);
+  p.r.old_data.resize (r > 0 ? r : 0);
+
+  append (p);
+  pending.push_back (p);
+
+  if (pending.size () >= batch) commit ();
+}
+
+void WriteJournal::rewrite (const string & path, const string & old_header, const string & new_header, const string & body, function<void()> done) {
+  Pending p;
+  p.r.type     = REWRITE;
+  p.r.path     = path;
+  p.r.size     = 0;
+  p.r.offset   = 0;
+  p.r.old_data = old_header;
+  p.r.new_data = new_header;
+  p.r.body     = body;
+  p.done = done;
+
+  /* the file is opened now, a later rename (maildir flags) does not
+   * affect the write. */
+  p.fd = ::open (path.c_str (), O_RDWR | O_CLOEXEC);
+  if (p.fd < 0) {
+    throw SyncError ("could not open file for writing: " + path);
+  }
+
+  append (p);
+  pending.push_back (p);
+
+  if (pending.size () >= batch) commit ();
+}
+
+bool WriteJournal::stale (int fd, const Record & r) {
+  /* true if a record no longer belongs to the file: found again by its
+   * unique name, but with other contents than before or after the write
+   * (or a torn mix of the two). */
+  if (r.type == REWRITE) {
+    string cur;
+    if (!read_all (fd, cur)) return true;
+
+    string before = r.old_data + r.body;
+    string after  = r.new_data + r.body;
+
+    /* the new contents are written over the old from the start, and the
+     * file is truncated last */
+    if (cur.size () < min (before.size (), after.size ()) ||
+        cur.size () > max (before.size (), after.size ())) return true;
+
+    for (size_t i = 0; i < cur.size (); i++) {
+      if (i < after.size () && cur[i] == after[i]) continue;
+      if (i < before.size () && cur[i] == before[i]) continue;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || (uint64_t) st.st_size != r.size) return true;
+
+  string cur (r.new_data.size (), '\0');
+  ssize_t n = pread (fd, &cur[0], cur.size (), r.offset);
+  if (n != (ssize_t) cur.size ()) return true;
+
+  return (cur != r.new_data && cur.compare (0, r.old_data.size (), r.old_data) != 0);
+}
+
+bool WriteJournal::apply (int fd, const Record & r, bool replay) {
+  if (r.type == PATCH) {
+    if (replay) {
+      string cur (r.new_data.size (), '\0');
+      ssize_t n = pread (fd, &cur[0], cur.size (), r.offset);
+      if (n == (ssize_t) cur.size () && cur == r.new_data) return true;
+    }
+
+    return write_all (fd, r.new_data, r.offset);
+  }
+
+  /* rewrite: we have to replace the contents of the message file while
+   * not updating the creation time to prevent offlineimap from treating
+   * the file as a new one (and the previous a deleted one). */
+  string contents = r.new_data + r.body;
+
+  if (replay) {
+    string cur;
+    if (!read_all (fd, cur)) return false;
+    if (cur == contents) return true;
+
+    if (cur != r.old_data + r.body) {
+      LOG_WARN ("journal: file was being rewritten, restoring: " << r.path);
+    }
+  }
+
+  if (!write_all (fd, contents, 0)) return false;
+
+  return (ftruncate (fd, contents.size ()) == 0);
+}
+
+void WriteJournal::sync_files (const vector<int> & fds) {
+  /* one sync per file system instead of one per file */
+  set<dev_t> devs;
+
+  for (int fd : fds) {
+    struct stat st;
+    if (fstat (fd, &st) != 0) continue;
+
+    if (devs.insert (st.st_dev).second) {
+      if (syncfs (fd) != 0) {
+        throw SyncError (string ("journal: could not sync file system: ") + strerror (errno));
+      }
+      fsyncs++;
+    }
+  }
+}
+
+void WriteJournal::clear () {
+  /* durably, a stale journal must not be replayed over later changes */
+  if (ftruncate (jfd, 0) != 0 || fdatasync (jfd) != 0) {
+    throw SyncError ("journal: could not clear: " + journal_path);
+  }
+  fsyncs++;
+}
+
+void WriteJournal::commit () {
+  if (pending.empty ()) return;
+
+  if (fdatasync (jfd) != 0) {
+    throw SyncError ("journal: could not sync: " + journal_path);
+  }
+  fsyncs++;
+
+  vector<int> fds;
+  for (auto & p : pending) {
+    /* left in the journal, replayed on the next start */
+    if (!apply (p.fd, p.r, false)) {
+      throw SyncError ("failed writing file: " + p.r.path);
+    }
+
+    fds.push_back (p.fd);
+  }
+
+  sync_files (fds);
+  clear ();
+
+  for (auto & p : pending) {
+    close (p.fd);
+    if (p.done) p.done ();
+  }
+
+  pending.clear ();
+  commits++;
+}
+
+int WriteJournal::recover () {
+  string buf;
+  if (!read_all (jfd, buf)) return -1;
+  if (buf.empty ()) return 0;
+
+  size_t pos = 0;
+  Record r;
+  vector<int> fds;
+  int n = 0;
+
+  while (parse (buf, pos, r)) {
+    string p = resolve (r.path);
+
+    if (p.empty ()) {
+      LOG_WARN ("journal: file no longer exists, skipping: " << r.path);
+      continue;
+    }
+
+    int fd = ::open (p.c_str (), O_RDWR | O_CLOEXEC);
+
+    if (fd >= 0 && stale (fd, r)) {
+      LOG_WARN ("journal: file has changed since, not replaying write to: " << p);
+      close (fd);
+      continue;
+    }
+
+    if (fd < 0 || !apply (fd, r, true)) {
+      LOG_ERROR ("journal: could not replay write to: " << p);
+      if (fd >= 0) close (fd);
+      for (int f : fds) close (f);
+      return -1;
+    }
+
+    fds.push_back (fd);
+    n++;
+  }
+
+  /* anything after the last complete record was never applied */
+  sync_files (fds);
+  for (int f : fds) close (f);
+
+  clear ();
+
+  return n;
+}
+
+void WriteJournal::print_stats () {
+  cout << "*  journal: " << records << " writes in " << commits << " commits, " << fsyncs << " syncs" << endl;
+}
+
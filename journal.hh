@@ -0,0 +1,103 @@
+# pragma once
+
+/* write journal for message file rewrites
+ *
+ * message files are rewritten in place (the inode must stay the same so
+ * that offlineimap does not see a new message), so a crash half way
+ * through a rewrite would destroy the message. every rewrite is first
+ * recorded in an intent log in a journal directory (which should be on
+ * the same file system as the maildir):
+ *
+ *   patch:   path, file size, offset, old bytes, new bytes
+ *   rewrite: path, old header block, new header block, body
+ *
+ * records are group committed: once `batch` records are queued (or on
+ * commit ()) the journal is fsync'ed once, the files are written, the
+ * file systems of the files are synced once and the journal is cleared.
+ * a journal left behind by a crash is replayed by recover () on the next
+ * start, replaying a record is idempotent. a patch is only replayed if
+ * the file still has its size and the old (or new) bytes at the offset,
+ * a rewrite only if the file still holds the old or the new contents (or
+ * a torn mix of them): the file may have been changed since.
+ */
+
+# include <string>
+# include <vector>
+# include <functional>
+# include <cstdint>
+# include <sys/types.h>
+
+using namespace std;
+
+class WriteJournal {
+  public:
+    WriteJournal (string dir, unsigned int batch);
+    ~WriteJournal ();
+
+    /* create the journal directory, returns false on failure */
+    bool open ();
+
+    /* replay a journal left behind by an earlier run, returns the number
+     * of records replayed or -1 on failure. */
+    int recover ();
+
+    /* true if there is a journal left behind */
+    bool pending_recovery ();
+
+    /* queue writing now over the bytes at offset */
+    void patch (const string & path, off_t offset, const string & now, function<void()> done);
+
+    /* queue replacing the header block of the file (old_header) with
+     * new_header, body is the rest of the file */
+    void rewrite (const string & path, const string & old_header, const string & new_header, const string & body, function<void()> done);
+
+    /* write all queued records */
+    void commit ();
+
+    void print_stats ();
+
+  private:
+    enum Type {
+      PATCH   = 1,
+      REWRITE = 2,
+    };
+
+    struct Record {
+      Type     type;
+      string   path;
+      uint64_t size;    /* of the file, patch only */
+      uint64_t offset;
+      string   old_data;
+      string   new_data;
+      string   body;
+    };
+
+    struct Pending {
+      Record             r;
+      int                fd;
+      function<void()>   done;
+    };
+
+    string dir;
+    string journal_path;
+    unsigned int batch;
+
+    int jfd = -1;
+    vector<Pending> pending;
+
+    /* stats */
+    unsigned long records = 0;
+    unsigned long commits = 0;
+    unsigned long fsyncs  = 0;
+
+    void append (Pending & p);
+    bool apply (int fd, const Record & r, bool replay);
+    bool stale (int fd, const Record & r);
+    void sync_files (const vector<int> & fds);
+    void clear ();
+
+    static string serialize (const Record & r);
+    static bool   parse (const string & buf, size_t & pos, Record & r);
+    static string resolve (const string & path);
+};
+
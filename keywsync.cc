@@ -23,6 +23,17 @@
  *
  *  for usage information.
  *
+ *  several syncs (e.g. one per account) can be run by one process from a
+ *  job file, see jobs.hh:
+ *
+ *    $ ./keywsync --no-replace-chars --jobs ~/.keywsync-jobs
+ *
+ *  a sync can be split into a scan (database opened read-only) writing a
+ *  plan and a short apply step, see plan.hh:
+ *
+ *    $ ./keywsync --no-replace-chars -m ~/.mail -k -q "*" --plan /tmp/plan
+ *    $ ./keywsync --apply /tmp/plan
+ *
  * TODO:
  * - tag-to-keyword -> on many x-keywords headers, merge 'em
  *
@@ -31,54 +42,92 @@
 # include "keywsync.hh"
 
 # include <iostream>
-# include <fstream>
 # include <string>
-# include <sstream>
 # include <vector>
-# include <algorithm>
-# include <chrono>
-
-# include <glibmm.h>
-# include <gmime/gmime.h>
+# include <memory>
+# include <thread>
+# include <atomic>
+# include <functional>
 
 # include <boost/program_options.hpp>
 # include <boost/filesystem.hpp>
 # include <boost/date_time/posix_time/posix_time.hpp>
 
-# include <notmuch.h>
-
-# include "spruce-imap-utils.h"
+# include "engine.hh"
+# include "pipeline.hh"
+# include "jobs.hh"
+# include "logger.hh"
+# include "error.hh"
+# include "handles.hh"
 
 using namespace std;
 using namespace boost::filesystem;
 using namespace boost::posix_time;
 
 int main (int argc, char ** argv) {
+  /* per-message output goes through the logger, anything still queued is
+   * written when exiting (also on errors). */
+  logger.start ();
+  atexit ([] () { logger.stop (); });
+
   cout << "** keyword <-> tag sync" << endl;
 
   /* options {{{ */
   namespace po = boost::program_options;
-  po::options_description desc ("options");
-  desc.add_options ()
+  po::options_description general ("options");
+  general.add_options ()
     ( "help,h", "print this help message")
+    ( "jobs", po::value<string>(), "run the jobs listed in this file, one line of job options per job (see jobs.hh). job options given here apply to every job")
+    ( "apply", po::value<string>(), "apply a plan written by --plan (to its database unless -m is given), messages and files changed since the plan was made are skipped")
+    ( "threads,j", po::value<int>()->default_value (1), "number of threads reading message files (shared by all jobs)")
+    ( "verbose,v", "verbose")
+    ( "more-verbose", "more verbosity")
+    ( "replace-chars", "Replace '/' with '.' and the inverse")
+    ( "no-replace-chars", "Do not replace '/' with '.' and the inverse")
+    ( "rules", po::value<string>(), "load keyword <-> tag rules from file (replaces the built-in rules)");
+
+  po::options_description job ("job options");
+  job.add_options ()
     ( "database,m", po::value<string>(), "notmuch database")
     ( "flags,f", "make notmuch sync maildir flags while passing through" )
     ( "keyword-to-tag,k", "sync keywords to tags")
     ( "mtime", po::value<int>(), "only operate on files with modified after mtime when doing keyword-to-tag sync (unix time)")
     ( "tag-to-keyword,t", "sync tags to keywords")
+    ( "bidirectional,b", "sync both ways, merging changes on either side since the last bidirectional run")
+    ( "base", po::value<string>(), "base state file for bidirectional sync (default: <db>/.notmuch/keywsync.base)")
+    ( "conflict", po::value<string>()->default_value ("union"), "how to merge messages without a base state in bidirectional sync: union, local or remote")
     ( "query,q", po::value<string>(), "restrict which messages to sync with notmuch query")
+    ( "batch-size", po::value<int>()->default_value (100), "commit tag changes of this many messages in one transaction")
+    ( "batch-interval", po::value<int>()->default_value (1000), "commit open transaction after this many ms")
+    ( "file-cache", po::value<string>(), "keep X-Keywords of message files in this cache file, unchanged files are not read")
+    ( "cache-friendly", "drop message file pages read from the page cache again (unless they were cached before) and prefetch upcoming files")
+    ( "io-uring", po::value<int>()->implicit_value (64), "stat and read message headers in batches with io_uring, optionally with this queue depth (default: 64)")
+    ( "incremental,i", "only sync messages changed since the last successful run with the same direction and query")
+    ( "state", po::value<string>(), "state file for incremental sync (default: <db>/.notmuch/keywsync.state)")
+    ( "watch", po::value<string>(), "keep running and sync keywords to tags for files changed in this maildir tree")
+    ( "debounce", po::value<int>()->default_value (200), "wait until no files have changed for this many ms before syncing in watch mode")
+    ( "walk", po::value<string>(), "with --mtime or --incremental: find changed files by walking this maildir tree instead of checking every message of the query")
+    ( "indexed-keywords", po::value<string>(), "keyword-to-tag: find the messages to check with queries on the X-Keywords header indexed by notmuch under this prefix (notmuch config set index.header.PREFIX X-Keywords) instead of reading every file")
+    ( "no-prune", "with --walk: list every cur/ and new/ directory, also those not modified since the threshold")
     ( "dry-run,d", "do not apply any changes.")
-    ( "verbose,v", "verbose")
-    ( "more-verbose", "more verbosity")
+    ( "plan", po::value<string>(), "open the database read-only and write the changes to this plan file instead of applying them, see --apply")
+    ( "plan-batch", po::value<string>(), "with --plan: also write the tag changes to this file as input for notmuch tag --batch")
     ( "paranoid,p", "be paranoid, fail easily.")
     ( "only-add,a", "only add tags")
     ( "only-remove,r", "only remove tags")
-    ( "replace-chars", "Replace '/' with '.' and the inverse")
-    ( "no-replace-chars", "Do not replace '/' with '.' and the inverse")
+    ( "metrics-json", po::value<string>(), "write per-phase timings and byte counts as json to this file at the end of the run")
+    ( "metrics-prom", po::value<string>(), "write per-phase timings and byte counts in the prometheus text format to this file (e.g. for the node_exporter textfile collector)")
+    ( "journal", po::value<string>(), "directory of the write journal, should be on the same file system as the maildir (default: <db>/.notmuch/keywsync-journal)")
+    ( "pad-x-keywords", po::value<int>(), "pad the X-Keywords header with whitespace up to this width when writing, later changes that fit are written in place")
     ( "enable-add-x-keywords-for-path", po::value<string>(), "allow adding an X-Keywords header if non-existent, when message file is contained in specified path (do not add a trailing /)" );
 
+  po::options_description desc;
+  desc.add (general).add (job);
+
+  po::parsed_options cmdline = po::command_line_parser (argc, argv).options(desc).run();
+
   po::variables_map vm;
-  po::store ( po::command_line_parser (argc, argv).options(desc).run(), vm );
+  po::store (cmdline, vm);
 
   if (vm.count ("help")) {
     cout << desc << endl;
@@ -86,918 +135,570 @@ int main (int argc, char ** argv) {
     exit (0);
   }
 
+  more_verbose  = (vm.count("more-verbose") > 0);
+  verbose       = (vm.count("verbose") > 0) || more_verbose;
+
+  logger.set_level (more_verbose ? LEVEL_DEBUG : (verbose ? LEVEL_VERBOSE : LEVEL_INFO));
+
+  if (vm.count ("apply")) {
+    /* the plan has the tags and keywords, no rules are needed */
+    if (vm.count ("jobs")) {
+      cerr << "error: --apply can not be combined with --jobs" << endl;
+      exit (1);
+    }
+
+    return apply (vm);
+  }
+
   if (vm.count ("replace-chars") && !vm.count("no-replace-chars")) {
-    enable_replace_chars = true;
+    shared.rules.enable_replace_chars = true;
     cout << "replace chars: true" << endl;
   } else if (!vm.count("replace-chars") && vm.count("no-replace-chars")) {
-    enable_replace_chars = false;
+    shared.rules.enable_replace_chars = false;
     cout << "replace chars: false" << endl;
   } else {
     cout << "error: specify either --replace-chars or --no-replace-chars" << endl;
     exit (1);
   }
 
+  if (vm.count ("rules")) {
+    string rules_path = vm["rules"].as<string>();
+    if (!shared.rules.load (rules_path)) {
+      exit (1);
+    }
+
+    cout << "=> rules: " << rules_path << endl;
+  }
+
+  threads = vm["threads"].as<int>();
+  if (threads < 1) {
+    cerr << "error: threads must be at least 1" << endl;
+    exit (1);
+  }
+
+  if (threads > 1) {
+    cout << "=> threads: " << threads << endl;
+  }
+
+  vector<SyncConfig> configs;
+
+  if (vm.count ("jobs")) {
+    string jobs_path = vm["jobs"].as<string>();
+
+    vector<JobLine> lines;
+    if (!load_jobs (jobs_path, lines)) {
+      exit (1);
+    }
+
+    if (lines.empty ()) {
+      cerr << "error: no jobs in: " << jobs_path << endl;
+      exit (1);
+    }
+
+    cout << "=> jobs: " << jobs_path << " (" << lines.size () << " jobs)" << endl;
+
+    for (size_t i = 0; i < lines.size (); i++) {
+      SyncConfig c;
+      c.label = "job " + to_string (i + 1);
+
+      cout << "** " << c.label << " (line " << lines[i].line << ")" << endl;
+
+      po::variables_map jvm;
+      try {
+        po::store (po::command_line_parser (lines[i].args).options(job).run(), jvm);
+      } catch (const po::error & e) {
+        cerr << "error: " << jobs_path << ": line " << lines[i].line << ": " << e.what () << endl;
+        exit (1);
+      }
+
+      /* job options on the command line apply to every job, unless the
+       * job sets them itself */
+      po::store (cmdline, jvm);
+
+      if (!parse_job (jvm, c)) {
+        exit (1);
+      }
+
+      if (c.watch) {
+        cerr << "error: watch mode can not be used in a job file" << endl;
+        exit (1);
+      }
+
+      configs.push_back (c);
+    }
+
+  } else {
+    SyncConfig c;
+
+    if (!parse_job (vm, c)) {
+      exit (1);
+    }
+
+    configs.push_back (c);
+  }
+
+  /* }}} */
+
+  shared.init ();
+
+  unique_ptr<WorkerPool> pool;
+  if (threads > 1) {
+    pool.reset (new WorkerPool (threads));
+    shared.pool = pool.get ();
+  }
+
+  int failed = run_jobs (configs);
+
+  logger.flush ();
+
+  if (more_verbose) {
+    shared.utf7.print_stats ();
+  }
+
+  return (failed > 0 ? 1 : 0);
+}
+
+bool parse_job (const boost::program_options::variables_map & vm, SyncConfig & c) { // {{{
+  /* the options of one job, prints an error and returns false if they
+   * are not valid */
+
   /* load config */
   if (vm.count("database")) {
-    db_path = vm["database"].as<string>();
+    c.db_path = vm["database"].as<string>();
   } else {
     cout << "error: specify database path." << endl;
-    exit (1);
+    return false;
   }
 
-  path _db_path (db_path);
-  _db_path = boost::filesystem::canonical (_db_path);
-  db_path = ustring (_db_path.c_str ());
+  c.db_path = boost::filesystem::canonical (path (c.db_path)).string ();
 
-  cout << "=> db: " << db_path << endl;
+  cout << "=> db: " << c.db_path << endl;
 
-  direction = NONE;
+  c.direction = NONE;
 
   if (vm.count("tag-to-keyword")) {
-    direction = TAG_TO_KEYWORD;
+    c.direction = TAG_TO_KEYWORD;
     cout << "=> direction: tag-to-keyword" << endl;
   }
 
   if (vm.count("keyword-to-tag")) {
-    if (direction != NONE) {
+    if (c.direction != NONE) {
       cerr << "error: only specify one direction." << endl;
-      exit (1);
+      return false;
     }
     cout << "=> direction: keyword-to-tag" << endl;
-    direction = KEYWORD_TO_TAG;
+    c.direction = KEYWORD_TO_TAG;
   }
 
-  if (direction == NONE) {
+  if (vm.count("bidirectional")) {
+    if (c.direction != NONE) {
+      cerr << "error: only specify one direction." << endl;
+      return false;
+    }
+    cout << "=> direction: bidirectional" << endl;
+    c.direction = BIDIRECTIONAL;
+  }
+
+  if (c.direction == NONE) {
     cerr << "error: no direction specified" << endl;
-    exit (1);
+    return false;
   }
 
   if (vm.count("query")) {
-    inputquery = vm["query"].as<string>();
+    c.query = vm["query"].as<string>();
   } else {
     cerr << "error: did not specify query, use \"*\" for all messages." << endl;
-    exit (1);
+    return false;
   }
 
-  cout << "=> query: " << inputquery << endl;
+  cout << "=> query: " << c.query << endl;
 
   if (vm.count("enable-add-x-keywords-for-path") > 0) {
 
-    if (direction != TAG_TO_KEYWORD) {
-      cerr << "the enable add-x-keywords-for-path option is only allowed for tag-to-keyword sync" << endl;
-      exit (1);
+    if (c.direction == KEYWORD_TO_TAG) {
+      cerr << "the enable add-x-keywords-for-path option is only allowed for tag-to-keyword or bidirectional sync" << endl;
+      return false;
     }
 
-    enable_add_x_keywords_header = true;
-    add_x_keyw_path = absolute(path (vm["enable-add-x-keywords-for-path"].as<string>()));
+    c.enable_add_x_keywords_header = true;
+    c.add_x_keyw_path = absolute(path (vm["enable-add-x-keywords-for-path"].as<string>())).string ();
 
-    cout << "=> adding x-keywords-header is enabled for: " << add_x_keyw_path << endl;
+    cout << "=> adding x-keywords-header is enabled for: " << c.add_x_keyw_path << endl;
 
-    if (!exists(add_x_keyw_path)) {
+    if (!exists(c.add_x_keyw_path)) {
       cerr << "path does not exist!" << endl;
-      exit (1);
+      return false;
     }
   }
 
   if (vm.count ("dry-run")) {
     cout << "=> note: dryrun!" << endl;
-    dryrun = true;
+    c.dryrun = true;
   } else {
     // TODO: remove when more confident
     cout << "=> note: real-mode, not dry-run!" << endl;
   }
 
-  more_verbose  = (vm.count("more-verbose") > 0);
-  verbose       = (vm.count("verbose") > 0) || more_verbose;
-  paranoid      = (vm.count("paranoid") > 0);
-  remove_double_x_keywords_header &= !paranoid;
-  only_add      = (vm.count("only-add") > 0);
-  only_remove   = (vm.count("only-remove") > 0);
-  maildir_flags = (vm.count("flags") > 0);
+  c.paranoid      = (vm.count("paranoid") > 0);
+  c.remove_double_x_keywords_header &= !c.paranoid;
+  c.only_add      = (vm.count("only-add") > 0);
+  c.only_remove   = (vm.count("only-remove") > 0);
+  c.maildir_flags = (vm.count("flags") > 0);
 
-  cout << "=> remove double x-keywords header: " << remove_double_x_keywords_header << endl;
+  cout << "=> remove double x-keywords header: " << c.remove_double_x_keywords_header << endl;
 
   if (vm.count("mtime") > 0) {
-    if (direction != KEYWORD_TO_TAG) {
+    if (c.direction != KEYWORD_TO_TAG) {
       cerr << "error: the mtime argument only makes sense for keyword-to-tag sync direction" << endl;
-      exit (1);
+      return false;
     }
 
-    mtime_set = true;
+    c.mtime_set = true;
     int mtime = vm["mtime"].as<int>();
     time_t mtime_t = mtime;
 
-    only_after_mtime = from_time_t (mtime_t);
-
-    cout << "mtime: only working on messages with mtime newer than: " << to_simple_string(only_after_mtime) << endl;
-  }
+    c.only_after_mtime = from_time_t (mtime_t);
 
-  if (only_add && only_remove) {
-    cerr << "only one of -a or -r can be specified at the same time" << endl;
-    exit (1);
+    cout << "mtime: only working on messages with mtime newer than: " << to_simple_string(c.only_after_mtime) << endl;
   }
 
-  /* }}} */
+  if (vm.count("incremental") > 0) {
+    if (c.mtime_set) {
+      cerr << "error: only one of --mtime or --incremental can be specified" << endl;
+      return false;
+    }
 
-  /* open db */
-  nm_db = setup_db (db_path.c_str());
+    if (c.direction == BIDIRECTIONAL) {
+      cerr << "error: incremental sync is not supported for bidirectional sync" << endl;
+      return false;
+    }
 
-# ifdef HAVE_NOTMUCH_GET_REV
-  const char * uuid;
-  unsigned long revision = notmuch_database_get_revision (nm_db, &uuid);
-  cout << "* db: current revision: " << revision  << endl;
+# ifndef HAVE_NOTMUCH_GET_REV
+    if (c.direction == TAG_TO_KEYWORD) {
+      cerr << "error: incremental tag-to-keyword sync requires notmuch with lastmod support" << endl;
+      return false;
+    }
 # endif
 
+    c.incremental = true;
 
-  time_t gt0 = clock ();
-  chrono::time_point<chrono::steady_clock> t0_c = chrono::steady_clock::now ();
-
-  notmuch_query_t * query;
-  query = notmuch_query_create (nm_db,
-      inputquery.c_str());
-
-  notmuch_status_t st;
-  unsigned int total_messages;
-  st = notmuch_query_count_messages_st (query, &total_messages);
-
-  if (st != NOTMUCH_STATUS_SUCCESS) {
-    cerr << "db: failed to get message count." << endl;
-    exit (1);
-  }
-
-  cout << "*  messages to check: " << total_messages << endl;
+    if (vm.count("state") > 0) {
+      c.state_path = vm["state"].as<string>();
+    } else {
+      c.state_path = c.db_path + "/.notmuch/keywsync.state";
+    }
 
-  notmuch_messages_t * messages;
-  st = notmuch_query_search_messages_st (query, &messages);
+    cout << "=> incremental, state: " << c.state_path << endl;
 
-  if (st != NOTMUCH_STATUS_SUCCESS) {
-    cerr << "db: failed to search messages." << endl;
-    exit (1);
+  } else if (vm.count("state") > 0) {
+    cerr << "error: the state option only makes sense with --incremental" << endl;
+    return false;
   }
 
-  cout << "*  query time: " << ((clock() - gt0) * 1000.0 / CLOCKS_PER_SEC) << " ms." << endl;
-
-  notmuch_message_t * message;
-
-  int count = 0;
-  int count_changed = 0;
-
-  for (;
-       notmuch_messages_valid (messages);
-       notmuch_messages_move_to_next (messages)) {
-
-    message = notmuch_messages_get (messages);
-
-    if (more_verbose)
-      cout << "==> working on message (" << count << " of " << total_messages << "): " << notmuch_message_get_message_id (message) << endl;
-
-    vector<ustring> file_tags;
-    vector<ustring> paths;
-
-    bool mtime_changed = false;
-
-    // get source files {{{
-    notmuch_filenames_t * nm_fnms = notmuch_message_get_filenames (message);
-    for (;
-         notmuch_filenames_valid (nm_fnms);
-         notmuch_filenames_move_to_next (nm_fnms)) {
-
-      const char * fnm = notmuch_filenames_get (nm_fnms);
-
-      /* only add file if mtime is newer than specified */
-      if (mtime_set) {
-        path p (fnm);
-        time_t last_write_t = last_write_time (p);
-
-        ptime last_write = from_time_t (last_write_t);
-
-        if (last_write >= only_after_mtime) {
-          mtime_changed = true;
-        }
-      }
-
-      if ((mtime_set && mtime_changed) || !mtime_set) {
-        /* check if we have xkeyw header on this file */
-        GMimeStream * f = g_mime_stream_file_new_for_path (fnm, "r");
-        if (f == NULL) {
-          cerr << "gmime: could not open file: " << fnm << endl;
-          exit (1);
-        }
-        GMimeParser * parser = g_mime_parser_new_with_stream (f);
-        GMimeMessage * msg = g_mime_parser_construct_message (parser);
-        g_mime_stream_file_set_owner (GMIME_STREAM_FILE(f), true);
-
-        const char * x_keywords = g_mime_object_get_header (GMIME_OBJECT(msg),
-            "X-Keywords");
-        if (x_keywords == NULL) {
-          /* no such field */
-          if (enable_add_x_keywords_header) {
-            cerr << "warning: no X-Keywords header for file, will be added for file: " << fnm << endl;
-          } else {
-            cerr << "warning: no X-Keywords header for file, skipping: " << fnm << endl;
-            skipped_messages++;
-            g_object_unref (parser);
-            g_object_unref (f);
-            g_mime_stream_close (f);
-            continue;
-          }
-        }
-
-        g_object_unref (parser);
-        g_object_unref (f);
-        g_mime_stream_close (f);
-      }
-
-      paths.push_back (fnm);
-      if (more_verbose)
-        cout << "* message file: " << fnm << endl;
+  if (vm.count("watch") > 0) {
+    if (c.direction != KEYWORD_TO_TAG) {
+      cerr << "error: watch mode only works for keyword-to-tag sync direction" << endl;
+      return false;
     }
 
-    notmuch_filenames_destroy (nm_fnms); // }}}
-
-    if (paths.size() == 0) {
-      cout << "no files with x-keywords header, skipping message." << endl;
-      skipped_messages++;
-      count++;
-      continue;
+    if (c.mtime_set || c.incremental) {
+      cerr << "error: watch mode can not be combined with --mtime or --incremental" << endl;
+      return false;
     }
 
-    if (mtime_set) {
-      if (mtime_changed) {
-        if (verbose) {
-          cout << "=> " << notmuch_message_get_message_id (message) << " changed, checking.." << endl;
-        }
+    c.watch = true;
+    c.watch_path = absolute (path (vm["watch"].as<string>())).string ();
+    c.watch_debounce = vm["debounce"].as<int>();
 
-      } else {
-        if (more_verbose) {
-          cout << "=> message _not_ changed, skipping.." << endl;
-        }
-
-        skipped_messages++;
-        count++;
-        notmuch_message_destroy (message);
-        continue;
-
-      }
+    if (c.watch_debounce < 0) {
+      cerr << "error: debounce must be positive" << endl;
+      return false;
     }
 
-    /* get and test if keywords are consistent between all paths */
-    bool consistent = keywords_consistency_check (paths, file_tags);
-    if (!consistent) {
-      cerr << "=> error: inconsistent tags for files!" << endl;
-      if (paranoid) {
-        exit (1);
-      } else {
-        /* possibly keep going? */
-        cerr << "=> skipping message." << endl;
-        count++;
-        skipped_messages++;
-        notmuch_message_destroy (message);
-        continue;
-      }
+    if (!is_directory (c.watch_path)) {
+      cerr << "error: watch path is not a directory: " << c.watch_path << endl;
+      return false;
     }
 
-    /* get tags from db */
-    vector<ustring> db_tags;
-    notmuch_tags_t * nm_tags = notmuch_message_get_tags (message);
-    for (;
-         notmuch_tags_valid (nm_tags);
-         notmuch_tags_move_to_next (nm_tags)) {
+    cout << "=> watch: " << c.watch_path << ", debounce: " << c.watch_debounce << " ms" << endl;
+  }
 
-      const char * tag = notmuch_tags_get (nm_tags);
-      db_tags.push_back (tag);
+  if (vm.count("walk") > 0) {
+    if (c.direction != KEYWORD_TO_TAG || c.watch) {
+      cerr << "error: the walk option only makes sense for keyword-to-tag sync direction" << endl;
+      return false;
     }
 
-    notmuch_tags_destroy (nm_tags);
-
-    /* sort tags (file_tags are already sorted) */
-    sort (db_tags.begin (), db_tags.end());
-
-    /* remove ignored tags */
-    vector<ustring> diff;
-    set_difference (db_tags.begin (),
-                    db_tags.end (),
-                    ignore_tags.begin (),
-                    ignore_tags.end (),
-                    back_inserter (diff));
-
-    db_tags = diff;
-
-
-    bool changed = false;
-
-    if (direction == KEYWORD_TO_TAG) { // {{{
-      /* keyword to tag mode */
-
-      /* check maildir flags */
-      if (maildir_flags) {
-        /* may change path of file */
-        if (more_verbose) {
-          cout << "checking maildir flags.." << endl;
-        }
-        notmuch_message_maildir_flags_to_tags (message);
-      }
-
-
-      /* tags to add */
-      vector<ustring> add;
-      set_difference (file_tags.begin (),
-                      file_tags.end (),
-                      db_tags.begin (),
-                      db_tags.end (),
-                      back_inserter (add));
-
-
-      /* tags to remove */
-      vector<ustring> rem;
-      set_difference (db_tags.begin (),
-                      db_tags.end (),
-                      file_tags.begin (),
-                      file_tags.end (),
-                      back_inserter (rem));
-
-      if (!only_remove) {
-        if (add.size () > 0) {
-          changed = true;
-          if (more_verbose) {
-            cout << "=> adding tags: ";
-            for (auto t : add) cout << t.raw() << " ";
-
-            if (dryrun) cout << "[dryrun]";
-            cout << endl;
-          }
-
-          if (!dryrun) {
-            for (auto t : add) {
-              notmuch_status_t s = notmuch_message_add_tag (
-                  message,
-                  t.c_str());
-
-              if (s != NOTMUCH_STATUS_SUCCESS) {
-                cerr << "error: could not add tag " << t.raw() << " to message." << endl;
-                exit (1);
-              }
-
-            }
-          }
-        }
-      }
-
-      if (!only_add) {
-        if (rem.size () > 0) {
-          changed = true;
-
-          if (more_verbose) {
-            cout << "=> removing tags: ";
-            for (auto t : rem) cout << t.raw() << " ";
-
-            if (dryrun) cout << "[dryrun]";
-            cout << endl;
-          }
-
-          if (!dryrun) {
-            for (auto t : rem) {
-              notmuch_status_t s = notmuch_message_remove_tag (
-                  message,
-                  t.c_str());
-
-              if (s != NOTMUCH_STATUS_SUCCESS) {
-                cerr << "error: could not add tag " << t.raw() << " to message." << endl;
-                exit (1);
-              }
-
-            }
-
-          }
-        }
-      }
-
-      if (changed) count_changed++;
-
-      // }}}
-    } else { /* tag to keyword mode {{{ */
-
-      /* tags to add */
-      vector<ustring> add;
-      set_difference (db_tags.begin (),
-                      db_tags.end (),
-                      file_tags.begin (),
-                      file_tags.end (),
-                      back_inserter (add));
-
-
-      /* tags to remove */
-      vector<ustring> rem;
-      set_difference (file_tags.begin (),
-                      file_tags.end (),
-                      db_tags.begin (),
-                      db_tags.end (),
-                      back_inserter (rem));
-
-      vector<ustring> new_file_tags = file_tags;
-
-      if (!only_remove) {
-        if (add.size () > 0) {
-          if (more_verbose) {
-            cout << "=> adding tags: ";
-            for (auto t : add) cout << t.raw() << " ";
-
-            if (dryrun) cout << "[dryrun]";
-            cout << endl;
-          }
-
-          for (auto t : add)
-            new_file_tags.push_back (t);
-
-          changed = true;
-        }
-      }
-
-      sort (new_file_tags.begin (), new_file_tags.end());
-
-      if (!only_add) {
-        if (rem.size () > 0) {
-          if (more_verbose) {
-            cout << "=> removing tags: ";
-            for (auto t : rem) cout << t.raw() << " ";
-
-            if (dryrun) cout << "[dryrun]";
-            cout << endl;
-          }
-
-          vector<ustring> diff;
-          set_difference (new_file_tags.begin(),
-                          new_file_tags.end (),
-                          rem.begin (),
-                          rem.end (),
-                          back_inserter (diff));
-          new_file_tags = diff;
-          changed = true;
-        }
-      }
-
-      /* get file tags with normally ignored kws */
-      auto file_tags_all = get_keywords (paths[0], true);
-      vector<ustring> diff;
-      set_difference (file_tags_all.begin(),
-                      file_tags_all.end (),
-                      file_tags.begin (),
-                      file_tags.end (),
-                      back_inserter (diff));
-      for (auto t : diff)
-        new_file_tags.push_back (t);
-
-      if (changed) {
-        for (ustring p : paths) {
-          if (more_verbose) {
-            cout << "old tags: ";
-            for (auto t : file_tags) cout << t.raw() << " ";
-            cout << endl;
-            cout << "new tags: ";
-            for (auto t : new_file_tags) cout << t.raw() << " ";
-            cout << endl;
-          }
-
-          if (more_verbose) {
-            cout << "file: " << p << endl;
-          }
-          write_tags (p, new_file_tags);
-        }
-
-
-        count_changed++;
-      }
-
-      /* check maildir flags */
-      if (maildir_flags) {
-        if (more_verbose) {
-          cout << "checking maildir flags.." << endl;
-        }
-        notmuch_message_tags_to_maildir_flags (message);
-      }
-    } // }}}
-
-    if ((verbose && changed) || more_verbose) {
-      cout << "* message (" << count << "), file tags (" << file_tags.size()
-           << "): ";
-      for (auto t : file_tags) cout << t.raw() << " ";
-      cout << ", db tags (" << db_tags.size() << "): ";
-      for (auto t : db_tags) cout << t.raw() << " ";
-      cout << endl;
+    if (!c.mtime_set && !c.incremental) {
+      cerr << "error: the walk option needs --mtime or --incremental" << endl;
+      return false;
     }
 
-    notmuch_message_destroy (message);
+    c.walk_path  = absolute (path (vm["walk"].as<string>())).string ();
+    c.walk_prune = (vm.count("no-prune") == 0);
 
-    if (more_verbose)
-      cout << "==> message (" << count << ") done." << endl;
+    if (!is_directory (c.walk_path)) {
+      cerr << "error: walk path is not a directory: " << c.walk_path << endl;
+      return false;
+    }
 
-    count++;
+    cout << "=> walk: " << c.walk_path << (c.walk_prune ? "" : " (not pruning)") << endl;
   }
 
-  notmuch_database_close (nm_db);
-
-  chrono::duration<double> elapsed = chrono::steady_clock::now() - t0_c;
+  if (vm.count("indexed-keywords") > 0) {
+    if (c.direction != KEYWORD_TO_TAG || c.watch) {
+      cerr << "error: the indexed-keywords option only makes sense for keyword-to-tag sync direction" << endl;
+      return false;
+    }
 
-  cout << "=> done, checked: " << count << " messages and changed: " << count_changed << " messages (skipped: " << skipped_messages << ") in " << ((clock() - gt0) * 1000.0 / CLOCKS_PER_SEC) << " ms [cpu], " << elapsed.count() << " s [real time]." << endl;
+    c.index_prefix = vm["indexed-keywords"].as<string>();
 
-  return 0;
-}
+    cout << "=> indexed keywords: " << c.index_prefix << endl;
+  }
 
-bool keywords_consistency_check (vector<ustring> &paths, vector<ustring> &file_tags) { // {{{
-  /* check if all source files for one message have the same tags, outputs
-   * all discovered tags to file_tags */
+  c.batch_size     = vm["batch-size"].as<int>();
+  c.batch_interval = vm["batch-interval"].as<int>();
+  if (c.batch_size < 1 || c.batch_interval < 0) {
+    cerr << "error: batch-size must be at least 1 and batch-interval positive" << endl;
+    return false;
+  }
 
-  bool first = true;
-  bool valid = true;
+  if (c.only_add && c.only_remove) {
+    cerr << "only one of -a or -r can be specified at the same time" << endl;
+    return false;
+  }
 
-  for (ustring & p : paths) {
-    path pp (p);
-    if (!exists (pp)) {
-      cerr << "file does not exist: db out of sync: " << p << endl;
-      exit (1);
+  if (c.direction == BIDIRECTIONAL) {
+    if (c.only_add || c.only_remove) {
+      cerr << "error: -a and -r can not be used with bidirectional sync" << endl;
+      return false;
     }
 
-    auto t = get_keywords (p, false);
-
-    if (first) {
-      first = false;
-      file_tags = t;
+    string cp = vm["conflict"].as<string>();
+    if (cp == "union") {
+      c.conflict_policy = CONFLICT_UNION;
+    } else if (cp == "local") {
+      c.conflict_policy = CONFLICT_LOCAL;
+    } else if (cp == "remote") {
+      c.conflict_policy = CONFLICT_REMOTE;
     } else {
+      cerr << "error: conflict must be one of: union, local or remote" << endl;
+      return false;
+    }
 
-      vector<ustring> diff;
-      set_difference (t.begin (),
-                      t.end (),
-                      file_tags.begin (),
-                      file_tags.end (),
-                      back_inserter (diff));
+    if (vm.count("base") > 0) {
+      c.base_path = vm["base"].as<string>();
+    } else {
+      c.base_path = c.db_path + "/.notmuch/keywsync.base";
+    }
 
+    cout << "=> conflicts: " << cp << endl;
 
-      if (diff.size () > 0) {
-        valid = false;
-        for (auto &tt : diff) {
-          file_tags.push_back (tt);
-        }
+  } else if (vm.count("base") > 0) {
+    cerr << "error: the base option only makes sense for bidirectional sync" << endl;
+    return false;
+  }
 
-        sort (file_tags.begin (), file_tags.end ());
-      }
+  if (vm.count("pad-x-keywords") > 0) {
+    if (c.direction == KEYWORD_TO_TAG) {
+      cerr << "error: the pad-x-keywords option only makes sense for tag-to-keyword or bidirectional sync" << endl;
+      return false;
     }
-  }
 
-  return valid;
-} // }}}
+    c.x_keywords_padding = vm["pad-x-keywords"].as<int>();
 
-vector<ustring> get_keywords (ustring p, bool dont_ignore) { // {{{
-  /* get the X-Keywords header from a message and return
-   * a _sorted_ vector of strings with the keywords. */
+    if (c.x_keywords_padding < 0) {
+      cerr << "error: pad-x-keywords must be positive" << endl;
+      return false;
+    }
 
-  vector<ustring> file_tags;
+    cout << "=> x-keywords padding: " << c.x_keywords_padding << endl;
+  }
 
-  /* read X-Keywords header */
-  notmuch_message_t * message;
-  notmuch_status_t s = notmuch_database_find_message_by_filename (
-      nm_db,
-      p.c_str(),
-      &message);
+  c.cache_friendly = (vm.count("cache-friendly") > 0);
 
-  if (s != NOTMUCH_STATUS_SUCCESS) {
-    cerr << "error: opening message file: " << p << endl;
-    exit (1);
+  if (c.cache_friendly) {
+    cout << "=> cache friendly reads" << endl;
   }
 
-  const char * x_keywords = notmuch_message_get_header (message, "X-Keywords");
-  if (x_keywords == NULL) {
-    /* no such field */
-    cout << "warning: no X-Keywords header for file: " << p << endl;
-    if (paranoid) {
-      exit (1);
-    } else {
-      return file_tags;
+  if (vm.count("io-uring") > 0) {
+    c.io_uring_depth = vm["io-uring"].as<int>();
+    if (c.io_uring_depth < 1) {
+      cerr << "error: io-uring queue depth must be at least 1" << endl;
+      return false;
     }
   }
 
-  if (more_verbose) {
-    cout << "parsing keywords: " << x_keywords << endl;
+  if (vm.count("metrics-json") > 0) {
+    c.metrics_json_path = vm["metrics-json"].as<string>();
+    cout << "=> metrics: json: " << c.metrics_json_path << endl;
   }
 
-  split_string (file_tags, ustring(x_keywords), ",");
-
-  for (ustring &t : file_tags) {
-    char * tag_c = spruce_imap_utf7_utf8(t.c_str());
-    t = tag_c;
-
-    if (!t.validate ()) {
-      cout << "error: invalid utf8 in keywords" << endl;
-    }
+  if (vm.count("metrics-prom") > 0) {
+    c.metrics_prom_path = vm["metrics-prom"].as<string>();
+    cout << "=> metrics: prometheus: " << c.metrics_prom_path << endl;
   }
 
-  sort (file_tags.begin (), file_tags.end());
-  auto it = unique (file_tags.begin(), file_tags.end());
-  file_tags.resize (distance (file_tags.begin(), it));
-
-  notmuch_message_destroy (message);
-
-  if (more_verbose) {
-    cout << "tags: ";
-    for (auto t : file_tags) {
-      cout << t.raw() << " ";
-    }
-    cout << endl;
+  if (vm.count("file-cache") > 0) {
+    c.file_cache_path = vm["file-cache"].as<string>();
   }
 
-  /* do map */
-  for (ustring &t : file_tags) {
-    if (enable_replace_chars) {
-      for (auto rep : replace_chars) {
-        ustring::size_type f;
-        while (f = t.find (rep.first), f != ustring::npos) {
-          t.replace (f, 1, 1, rep.second);
-        }
-      }
-    }
-
-    auto fnd = find_if (map_tags.begin(), map_tags.end (),
-        [&](pair<ustring,ustring> p) {
-          return (t == p.first);
-        });
-
-    if (fnd != map_tags.end ()) {
-      t = (*fnd).second;
-    }
+  if (vm.count("journal") > 0) {
+    c.journal_dir = vm["journal"].as<string>();
+  } else {
+    c.journal_dir = c.db_path + "/.notmuch/keywsync-journal";
   }
 
-  sort (file_tags.begin (), file_tags.end());
-
-  if (more_verbose) {
-    cout << "tags after map: ";
-    for (auto t : file_tags) {
-      cout << "'" <<  t.raw() << "' ";
+  if (vm.count("plan") > 0) {
+    if (c.direction == BIDIRECTIONAL || c.maildir_flags || c.incremental || c.watch) {
+      cerr << "error: a plan can only be made for tag-to-keyword or keyword-to-tag sync without --flags, --incremental or --watch" << endl;
+      return false;
     }
-    cout << endl;
-  }
 
-  if (!dont_ignore) {
-    /* remove ignored */
-    vector<ustring> diff;
-    set_difference (file_tags.begin (),
-                    file_tags.end (),
-                    ignore_tags.begin (),
-                    ignore_tags.end (),
-                    back_inserter (diff));
+    c.plan_path = absolute (path (vm["plan"].as<string>())).string ();
 
+    if (vm.count("plan-batch") > 0) {
+      c.plan_batch_path = vm["plan-batch"].as<string>();
+    }
 
-    file_tags = diff;
+    cout << "=> plan: " << c.plan_path << (c.plan_batch_path.empty () ? "" : ", notmuch batch: " + c.plan_batch_path) << endl;
 
-    if (more_verbose) {
-      cout << "tags after ignore: ";
-      for (auto t : file_tags) {
-        cout << t.raw() << " ";
-      }
-      cout << endl;
-    }
+  } else if (vm.count("plan-batch") > 0) {
+    cerr << "error: the plan-batch option only makes sense with --plan" << endl;
+    return false;
   }
 
-  return file_tags;
+  return true;
 } // }}}
 
-void write_tags (ustring msg_path, vector<ustring> tags) { // {{{
-  /* write tags back to the X-Keywords header */
+int apply (const boost::program_options::variables_map & vm) { // {{{
+  /* apply a plan, the database is only opened read-write for as long as
+   * that takes. returns the exit status. */
+  string plan_path = vm["apply"].as<string>();
 
-  /* reverse map */
-  for (auto &t : tags) {
-    if (enable_replace_chars) {
-      for (auto rep : replace_chars) {
-        ustring::size_type f;
-        while (f = t.find (rep.second), f != ustring::npos) {
-          t.replace (f, 1, 1, rep.first);
-        }
-      }
-    }
+  Plan p;
+  if (!p.load (plan_path)) {
+    return 1;
+  }
 
-    auto fnd = find_if (map_tags.begin(), map_tags.end (),
-        [&](pair<ustring,ustring> p) {
-          return (t == p.second);
-        });
+  SyncConfig c;
+  c.label   = "apply";
+  c.db_path = p.db_path;
 
-    if (fnd != map_tags.end ()) {
-      t = (*fnd).first;
-    }
+  if (vm.count("database")) {
+    c.db_path = boost::filesystem::canonical (path (vm["database"].as<string>())).string ();
   }
 
-  sort (tags.begin (), tags.end());
+  cout << "=> apply: " << plan_path << " (" << p.messages.size () << " messages to tag, " << p.files.size () << " files to rewrite)" << endl;
+  cout << "=> db: " << c.db_path << endl;
 
-  ustring newh;
-  bool first = true;
-  for (auto t : tags) {
-    if (!first) newh = newh + ",";
-    first = false;
-    newh = newh + t;
+  if (vm.count ("dry-run")) {
+    cout << "=> note: dryrun!" << endl;
+    c.dryrun = true;
   }
 
-  char * newh_utf7 = spruce_imap_utf8_utf7 (newh.c_str());
-
-  if (more_verbose) {
-    cout << "=> writing new x-keywords: " << newh_utf7 << endl;
+  c.batch_size     = vm["batch-size"].as<int>();
+  c.batch_interval = vm["batch-interval"].as<int>();
+  if (c.batch_size < 1 || c.batch_interval < 0) {
+    cerr << "error: batch-size must be at least 1 and batch-interval positive" << endl;
+    return 1;
   }
 
-  GMimeStream * f = g_mime_stream_file_new_for_path (msg_path.c_str(),
-      "r");
-  if (f == NULL) {
-    cerr << "gmime: could not open file: " << msg_path << endl;
-    exit (1);
+  if (vm.count("file-cache") > 0) {
+    c.file_cache_path = vm["file-cache"].as<string>();
   }
-  GMimeParser * parser = g_mime_parser_new_with_stream (f);
-  GMimeObject * prt = g_mime_parser_construct_part (parser);
 
-  const char * headers_raw = g_mime_object_get_headers (prt);
+  if (vm.count("metrics-json") > 0) c.metrics_json_path = vm["metrics-json"].as<string>();
+  if (vm.count("metrics-prom") > 0) c.metrics_prom_path = vm["metrics-prom"].as<string>();
 
-  gint64 header_end = strlen (headers_raw);
+  SyncReport r;
 
-  /* find header end */
-  /*
-  gint64 header_end = g_mime_parser_get_headers_end (parser);
-  if (header_end == -1) {
-    cerr << "could not find end of header!" << endl;
-    exit (1);
-  }
-  */
+  try {
+    NmDatabase db = setup_db (c.db_path.c_str ());
 
-  g_object_unref (prt);
-  g_object_unref (parser);
-  g_mime_stream_close (f);
+    SyncEngine engine (shared, c, db.get ());
+    r = engine.apply (p);
 
-  stringstream headers_s;
-  stringstream contents_s;
+  } catch (const SyncError & e) {
+    r.ok    = false;
+    r.error = e.what ();
+  }
 
-  /* read in headers */
-  std::ifstream orig (msg_path.c_str());
-  std::filebuf * fbuf = orig.rdbuf ();
-  char headers_c[header_end+1];
-  int read = fbuf->sgetn (headers_c, header_end);
-  if (read != header_end) {
-    cerr << "could not read until end of header!";
-    exit (1);
+  if (!r.ok) {
+    LOG_ERROR (c.label << ": " << r.error);
+    return 1;
   }
-  headers_c[header_end] = 0;
-  headers_s << headers_c;
 
-  /* get rest of contents */
-  contents_s << fbuf;
-  orig.close ();
+  return 0;
+} // }}}
 
+int run_jobs (const vector<SyncConfig> & configs) { // {{{
+  /* jobs on the same database run in order on one database handle, the
+   * jobs of different databases run at the same time on a thread each.
+   * returns the number of failed jobs. */
+  vector<string> dbs;
+  for (auto & c : configs) dbs.push_back (c.db_path);
 
-  /* scan for X-Keywords header */
-  ustring headers (headers_s.str());
-  stringstream headers_new;
+  vector<vector<size_t>> groups = group_jobs (dbs);
 
-  bool found_xkeyw = false;
+  atomic<int> failed { 0 };
 
-  while (!headers_s.eof ()) {
-    string inbuf;
-    getline ( headers_s, inbuf );
+  auto run_group = [&] (const vector<size_t> & g) {
+    NmDatabase db;
+    bool read_only = false;
 
-    int xks = inbuf.find ("X-Keywords");
-    if (xks == 0) {
-      if (found_xkeyw) {
-        if (paranoid) {
-          cerr << "found more than one X-Keywords header, failing: "
-            << msg_path << endl;
-          exit (1);
-        } else {
-          if (remove_double_x_keywords_header) {
-            cerr << "found more than one X-Keywords header, skipping redundant lines.." << endl;
-            continue;
-          } else {
-            cerr << "found more than one X-Keywords header, both are being updated." << endl;
-          }
-        }
-      }
+    for (size_t n = 0; n < g.size (); n++) {
+      const SyncConfig & c = configs[g[n]];
+      SyncReport r;
 
-      found_xkeyw = true;
+      try {
+        /* a plan only reads the database, it is reopened when the next
+         * job needs the other mode */
+        bool ro = !c.plan_path.empty ();
 
-      /* replace */
-      if (more_verbose) {
-        cout << "=> current xkeywords header: " << inbuf << endl;
+        if (!c.watch && (!db || ro != read_only)) {
+          db.reset ();
+          db = setup_db (c.db_path.c_str (), (ro ? NOTMUCH_DATABASE_MODE_READ_ONLY : NOTMUCH_DATABASE_MODE_READ_WRITE));
+          read_only = ro;
+        }
+      } catch (const SyncError & e) {
+        r.ok    = false;
+        r.error = e.what ();
       }
 
-      headers_new << "X-Keywords: " << newh_utf7 << endl;
+      if (r.ok) {
+        SyncEngine engine (shared, c, db.get ());
 
+        if (c.watch) {
+          r = engine.watch ([&] () { return setup_db (c.db_path.c_str ()); });
+        } else {
+          r = engine.run ();
+        }
+      }
 
-    } else {
-      if (inbuf.size() > 0)
-        headers_new << inbuf << endl;
-    }
-  }
-
-  if (!found_xkeyw) {
-    cerr << "could not find exisiting X-Keywords header." << endl;
-    if (enable_add_x_keywords_header) {
-      path m_p = absolute(path(msg_path.c_str()));
+      if (!r.ok) {
+        LOG_ERROR ((c.label.empty () ? "" : c.label + ": ") << r.error);
+        failed++;
 
-      /* test if path is in allowed path */
-      bool allowed = false;
-      while (m_p != path("/")) {
-        if (m_p == add_x_keyw_path) {
-          allowed = true;
-          break;
+        /* later jobs on the database may depend on this one */
+        if (n + 1 < g.size ()) {
+          LOG_ERROR ("error: skipping the " << (g.size () - n - 1) << " remaining jobs on: " << c.db_path);
+          failed += (g.size () - n - 1);
         }
-        m_p = m_p.parent_path();
-      }
 
-      if (allowed) {
-        cerr << "adding new X-Keywords header for " << msg_path << endl;
-        headers_new << "X-Keywords: " << newh_utf7 << endl;
-      } else {
-        cerr << "not allowed to add X-Keywords header for: " << msg_path << endl;
+        return;
       }
-
-    } else {
-      exit (1);
     }
-  }
-
-
-  char fname[1024] = "/tmp/keywsync-XXXXXX";
-  int tmpfd = mkstemp (fname);
-
-  string headers_new_str = headers_new.str();
-  string contents = contents_s.str();
-
-  ssize_t r;
-  /* write header */
-  r = write (tmpfd, headers_new_str.c_str(), headers_new_str.size());
-
-  if (r == -1) {
-    cerr << "failed writing file!" << endl;
-    exit (1);
-  }
-
-  /* write contents */
-  r = write (tmpfd, contents.c_str(), contents.size());
-
-  if (r == -1) {
-    cerr << "failed writing file!" << endl;
-    exit (1);
-  }
-
-  close (tmpfd);
-
-  if (verbose) {
-    cout << "new file written to: " << fname << endl;
-  }
-
-  /* replace contents */
-  if (verbose) {
-    cout << "replacing contents from file " << fname << " into " << msg_path << endl;
-  }
-
-
-  if (!dryrun) {
-    /* we have to replace the contents of the message file while
-     * not updating the creation time to prevent offlineimap from
-     * treating the file as a new one (and the previous a deleted one).
-     */
-
-    std::ifstream i (fname, ios::binary);
-    std::ofstream o (msg_path.c_str(), ios::binary | std::ofstream::trunc);
-
-    o << i.rdbuf ();
-    i.close ();
-    o.close ();
-
-    unlink (fname);
+  };
 
+  if (groups.size () == 1) {
+    run_group (groups[0]);
   } else {
-    cout << "dryrun: new file located in: " << fname << endl;
+    vector<thread> ts;
+    for (auto & g : groups) ts.push_back (thread (run_group, cref (g)));
+    for (auto & t : ts) t.join ();
   }
 
+  return failed;
 } // }}}
 
-/* utils {{{ */
-
-template<class T> bool has (vector<T> v, T e) {
-  return (find(v.begin (), v.end (), e) != v.end ());
-}
-
-void split_string (vector<ustring> & tokens, ustring str, ustring delim) {
-
-  tokens = Glib::Regex::split_simple(delim, str);
-
-}
-
-notmuch_database_t * setup_db (const char * db_path) {
-
-  notmuch_database_t * db;
-  auto s = notmuch_database_open (db_path,
-      NOTMUCH_DATABASE_MODE_READ_WRITE,
-      &db);
-
-  if (s != NOTMUCH_STATUS_SUCCESS) {
-    cerr << "db: could not open database." << endl;
-    exit (1);
-  }
-
-  return db;
-}
-
-/* }}} */
-
@@ -2,93 +2,29 @@
 
 # include <vector>
 # include <string>
-# include <glibmm.h>
 
-# include <boost/filesystem.hpp>
-# include <boost/date_time/posix_time/posix_time.hpp>
+# include <boost/program_options.hpp>
 
 using namespace std;
-using namespace boost::filesystem;
-using namespace boost::posix_time;
 
-# include <notmuch.h>
+# include "engine.hh"
+# include "logger.hh"
 
-# define ustring Glib::ustring
+/* keyword <-> tag tables and worker threads, shared by all jobs */
+SyncShared shared;
 
-notmuch_database_t * setup_db (const char *);
+/* parse the options of a job into a config, prints an error and returns
+ * false if they are invalid. */
+bool parse_job (const boost::program_options::variables_map &, SyncConfig &);
 
-/* tags to ignore from syncing (_must_ be sorted!)
- *
- * these are either internal notmuch tags or tags handled
- * by maildirflags.
- *
- */
-const vector<ustring> ignore_tags = {
-  "attachment",
-  "draft",
-  "encrypted",
-  "flagged",
-  "important",
-  "new",
-  "passed",
-  "replied",
-  "signed",
-  "unread",
-};
+/* run the jobs, returns the number of jobs that failed */
+int run_jobs (const vector<SyncConfig> &);
 
-/* map keyword to tag, done before ignore_tags */
-const list<pair<ustring,ustring>> map_tags {
-  { "\\Draft", "draft" },
-  { "\\Important", "important" },
-  { "\\Inbox", "inbox" },
-  { "\\Junk", "spam" },
-  { "\\Muted", "muted" },
-  { "\\Sent", "sent" },
-  { "\\Starred", "flagged" },
-  { "\\Trash", "deleted" },
-};
-
-/* replace chars, done before map keyword to tag */
-bool enable_replace_chars = false;
-const list<pair<char,char>> replace_chars {
-  { '/', '.' },
-};
-
-bool keywords_consistency_check (vector<ustring> &, vector<ustring> &);
-vector<ustring> get_keywords (ustring p, bool);
-void split_string (vector<ustring> &, ustring, ustring);
-
-void write_tags (ustring p, vector<ustring> tags);
-
-template<class T> bool has (vector<T>, T);
-
-enum Direction {
-  NONE,
-  TAG_TO_KEYWORD,
-  KEYWORD_TO_TAG,
-};
-
-Direction direction;
-ustring    inputquery;
-
-bool  mtime_set = false;
-ptime only_after_mtime;
+/* apply the plan of --apply, returns the exit status */
+int apply (const boost::program_options::variables_map &);
 
 bool verbose = false;
 bool more_verbose = false;
-bool dryrun  = false;
-bool paranoid = false;
-bool only_add = false;
-bool only_remove = false;
-bool maildir_flags = false;
-bool enable_add_x_keywords_header = false;
-path add_x_keyw_path;
-
-bool remove_double_x_keywords_header = true;
-
-int skipped_messages = 0;
-
-ustring db_path;
-notmuch_database_t * nm_db;
 
+int threads = 1;
 
@@ -0,0 +1,211 @@
+# include "logger.hh"
+
+# include <string>
+# include <chrono>
+# include <thread>
+# include <unistd.h>
+
+using namespace std;
+
+/* the writer flushes when it has been idle this long */
+static const chrono::milliseconds idle_flush (100);
+
+/* stdout keeps using its buffer until the very end of exit (), after
+ * the logger is gone */
+static char out_buf[1 << 20];
+
+static size_t pow2 (size_t n) {
+  size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+/* per-message output. until it is started lines are written directly. */
+Logger logger;
+
+Logger::Logger (size_t capacity) :
+  level (LEVEL_INFO),
+  ring (pow2 (capacity)),
+  mask (ring.size () - 1)
+{
+  for (size_t i = 0; i < ring.size (); i++) ring[i].seq.store (i, memory_order_relaxed);
+}
+
+Logger::~Logger () {
+  stop ();
+}
+
+void Logger::start (FILE * o, FILE * e) {
+  if (running) return;
+
+  out = o;
+  err = e;
+
+  /* fully buffered, the writer decides when to flush */
+  if (out == stdout && !isatty (fileno (out))) {
+    setvbuf (out, out_buf, _IOFBF, sizeof (out_buf));
+  }
+
+  running = true;
+  writer  = thread (&Logger::run, this);
+}
+
+void Logger::stop () {
+  if (!running) return;
+
+  {
+    lock_guard<mutex> lk (m);
+    running = false;
+  }
+  cv_work.notify_one ();
+
+  writer.join ();
+
+  fflush (out);
+  fflush (err);
+}
+
+void Logger::write (LogLevel l, string && line) {
+  if (!running) {
+    /* not started or stopped: write directly */
+    lock_guard<mutex> lk (m);
+    emit (l, line);
+    if (l <= LEVEL_WARN) fflush (err);
+    return;
+  }
+
+  uint64_t pos = head.load (memory_order_relaxed);
+  Slot * s;
+
+  while (true) {
+    s = &ring[pos & mask];
+    uint64_t seq = s->seq.load (memory_order_acquire);
+    int64_t  d   = (int64_t) seq - (int64_t) pos;
+
+    if (d == 0) {
+      if (head.compare_exchange_weak (pos, pos + 1, memory_order_relaxed)) break;
+
+    } else if (d < 0) {
+      /* full: let the writer catch up, lines are never dropped */
+      wake ();
+      this_thread::yield ();
+      pos = head.load (memory_order_relaxed);
+
+    } else {
+      pos = head.load (memory_order_relaxed);
+    }
+  }
+
+  s->level = l;
+  s->line  = move (line);
+  s->seq.store (pos + 1, memory_order_release);
+
+  /* errors and warnings are written right away */
+  if (l <= LEVEL_WARN) {
+    lock_guard<mutex> lk (m);
+    cv_work.notify_one ();
+  } else {
+    wake ();
+  }
+}
+
+void Logger::wake () {
+  atomic_thread_fence (memory_order_seq_cst);
+
+  if (sleeping.load (memory_order_relaxed)) {
+    lock_guard<mutex> lk (m);
+    cv_work.notify_one ();
+  }
+}
+
+bool Logger::pop (LogLevel & l, string & line) {
+  Slot & s = ring[tail & mask];
+
+  if (s.seq.load (memory_order_acquire) != tail + 1) return false;
+
+  l    = s.level;
+  line = move (s.line);
+  s.line.clear ();
+
+  s.seq.store (tail + mask + 1, memory_order_release);
+  tail++;
+
+  return true;
+}
+
+void Logger::flush () {
+  if (!running) {
+    fflush (out);
+    fflush (err);
+    return;
+  }
+
+  uint64_t target = head.load ();
+
+  unique_lock<mutex> lk (m);
+  while (written.load () < target) {
+    cv_work.notify_one ();
+    cv_written.wait_for (lk, chrono::milliseconds (10));
+  }
+
+  fflush (out);
+}
+
+void Logger::emit (LogLevel l, const string & line) {
+  if (l <= LEVEL_WARN) {
+    /* keep the order with what was logged before */
+    fflush (out);
+    fwrite (line.data (), 1, line.size (), err);
+    fputc ('\n', err);
+  } else {
+    fwrite (line.data (), 1, line.size (), out);
+    fputc ('\n', out);
+  }
+}
+
+void Logger::run () {
+  LogLevel l;
+  string   line;
+  bool     dirty = false;
+
+  while (true) {
+    unsigned long n = 0;
+
+    while (pop (l, line)) {
+      emit (l, line);
+      if (l <= LEVEL_WARN) fflush (err);
+      n++;
+    }
+
+    if (n > 0) {
+      dirty = true;
+
+      lock_guard<mutex> lk (m);
+      written.fetch_add (n);
+      cv_written.notify_all ();
+      continue;
+    }
+
+    unique_lock<mutex> lk (m);
+    if (!running) break;
+
+    sleeping.store (true);
+    atomic_thread_fence (memory_order_seq_cst);
+
+    bool woken = cv_work.wait_for (lk, idle_flush, [&] {
+        return !running || ring[tail & mask].seq.load (memory_order_acquire) == tail + 1;
+      });
+
+    sleeping.store (false);
+
+    if (!woken && dirty) {
+      /* idle: make what has been written so far visible */
+      fflush (out);
+      dirty = false;
+    }
+  }
+
+  /* lines pushed before stop () */
+  while (pop (l, line)) emit (l, line);
+}
+
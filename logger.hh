@@ -0,0 +1,114 @@
+# pragma once
+
+/* asynchronous leveled logger
+ *
+ * the hot path only formats a line (after checking the level) and pushes
+ * it onto a bounded lock-free ring. a background thread drains the ring
+ * into a large stdio buffer and only flushes it when it fills up, when it
+ * has been idle for a while or on flush (). errors and warnings go to
+ * stderr after everything logged before them has been written to stdout.
+ *
+ * a full ring blocks the producer instead of dropping lines, and stop ()
+ * (called at exit) writes out everything queued, so that no warnings are
+ * lost when the program exits with an error.
+ *
+ * use the LOG_* macros, they do not evaluate their arguments when the
+ * level is disabled:
+ *
+ *   LOG_VERBOSE ("file: " << path);
+ */
+
+# include <atomic>
+# include <string>
+# include <sstream>
+# include <vector>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <cstdio>
+# include <cstdint>
+
+using namespace std;
+
+enum LogLevel {
+  LEVEL_ERROR,
+  LEVEL_WARN,
+  LEVEL_INFO,
+  LEVEL_VERBOSE,
+  LEVEL_DEBUG,
+};
+
+class Logger {
+  public:
+    Logger (size_t capacity = 4096);
+    ~Logger ();
+
+    void set_level (LogLevel l) { level.store (l, memory_order_relaxed); }
+    bool enabled (LogLevel l) const { return l <= level.load (memory_order_relaxed); }
+
+    /* start the writer thread, until then lines are written directly.
+     * call before anything is written to out, stdout gets a large buffer
+     * if it is not a terminal. */
+    void start (FILE * out = stdout, FILE * err = stderr);
+
+    /* queue a line, a line break is added */
+    void write (LogLevel, string && line);
+
+    /* wait until everything queued has been written and flushed, call
+     * before writing to stdout directly. */
+    void flush ();
+
+    /* write everything queued and stop the writer thread */
+    void stop ();
+
+  private:
+    struct Slot {
+      atomic<uint64_t> seq;
+      LogLevel         level;
+      string           line;
+    };
+
+    atomic<int> level;
+
+    /* bounded multi-producer ring (Vyukov), single consumer */
+    vector<Slot>     ring;
+    uint64_t         mask;
+    atomic<uint64_t> head { 0 }; /* next slot to push */
+    uint64_t         tail = 0;   /* next slot to pop, writer thread only */
+
+    bool pop (LogLevel &, string &);
+
+    /* writer thread */
+    thread           writer;
+    atomic<bool>     running { false };
+    atomic<bool>     sleeping { false };
+    atomic<uint64_t> written { 0 };
+    mutex              m;
+    condition_variable cv_work;
+    condition_variable cv_written;
+
+    FILE * out = stdout;
+    FILE * err = stderr;
+
+    void run ();
+    void emit (LogLevel, const string &);
+    void wake ();
+};
+
+# define LOG_AT(l, expr) do { \
+  if (logger.enabled (l)) { \
+    ostringstream _log_s; \
+    _log_s << expr; \
+    logger.write (l, _log_s.str ()); \
+  } \
+} while (0)
+
+# define LOG_ERROR(expr)   LOG_AT (LEVEL_ERROR, expr)
+# define LOG_WARN(expr)    LOG_AT (LEVEL_WARN, expr)
+# define LOG_INFO(expr)    LOG_AT (LEVEL_INFO, expr)
+# define LOG_VERBOSE(expr) LOG_AT (LEVEL_VERBOSE, expr)
+# define LOG_DEBUG(expr)   LOG_AT (LEVEL_DEBUG, expr)
+
+/* defined in logger.cc */
+extern Logger logger;
+
@@ -0,0 +1,123 @@
+# include "maildirwalk.hh"
+
+# include <string>
+# include <vector>
+# include <cstring>
+# include <cerrno>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+
+using namespace std;
+
+/* as returned by getdents64 */
+struct linux_dirent64 {
+  ino64_t        d_ino;
+  off64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+
+/* mtime of name relative to dirfd, only the mtime is requested */
+static bool mtime_at (int dirfd, const char * name, time_t & mtime, bool & is_dir) {
+# ifdef HAVE_STATX
+  struct statx sx;
+  if (statx (dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+             STATX_TYPE | STATX_MTIME, &sx) != 0) return false;
+
+  mtime  = sx.stx_mtime.tv_sec;
+  is_dir = S_ISDIR (sx.stx_mode);
+# else
+  struct stat st;
+  if (fstatat (dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return false;
+
+  mtime  = st.st_mtime;
+  is_dir = S_ISDIR (st.st_mode);
+# endif
+
+  return true;
+}
+
+static bool skip_dir (const char * name) {
+  /* hidden directories (e.g. .notmuch) and the maildir tmp/ */
+  return (name[0] == '.' || strcmp (name, "tmp") == 0);
+}
+
+static bool is_message_dir (const char * name) {
+  return (strcmp (name, "cur") == 0 || strcmp (name, "new") == 0);
+}
+
+static void walk (int fd, const string & dir, bool message_dir, time_t threshold, bool prune, vector<string> & paths, MaildirWalkStats & stats) {
+  stats.dirs++;
+
+  char buf[32 * 1024];
+
+  while (true) {
+    long n = syscall (SYS_getdents64, fd, buf, sizeof (buf));
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+
+    for (long off = 0; off < n; ) {
+      struct linux_dirent64 * d = (struct linux_dirent64 *) (buf + off);
+      off += d->d_reclen;
+
+      const char * name = d->d_name;
+      if (strcmp (name, ".") == 0 || strcmp (name, "..") == 0) continue;
+
+      if (message_dir) {
+        if (d->d_type != DT_REG && d->d_type != DT_UNKNOWN) continue;
+
+        time_t mtime;
+        bool   is_dir;
+        if (!mtime_at (fd, name, mtime, is_dir) || is_dir) continue;
+
+        stats.files++;
+
+        if (mtime >= threshold) {
+          stats.changed++;
+          paths.push_back (dir + "/" + name);
+        }
+
+        continue;
+      }
+
+      if (d->d_type != DT_DIR && d->d_type != DT_UNKNOWN) continue;
+      if (skip_dir (name)) continue;
+
+      time_t mtime;
+      bool   is_dir;
+      if (!mtime_at (fd, name, mtime, is_dir) || !is_dir) continue;
+
+      bool sub_message_dir = is_message_dir (name);
+
+      /* no files added or renamed in this directory since threshold */
+      if (prune && sub_message_dir && mtime < threshold) {
+        stats.pruned++;
+        continue;
+      }
+
+      int sub = openat (fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+      if (sub < 0) continue;
+
+      walk (sub, dir + "/" + name, sub_message_dir, threshold, prune, paths, stats);
+
+      close (sub);
+    }
+  }
+}
+
+bool maildir_walk (const string & root, time_t threshold, bool prune, vector<string> & paths, MaildirWalkStats & stats) {
+  int fd = open (root.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  walk (fd, root, false, threshold, prune, paths, stats);
+
+  close (fd);
+  return true;
+}
+
@@ -0,0 +1,33 @@
+# pragma once
+
+/* change detection by walking a maildir tree
+ *
+ * finds message files in cur/ and new/ modified at or after a threshold
+ * without going through the notmuch database. directories are read with
+ * getdents64 relative to an open directory fd and files are stat'ed with
+ * statx (only asking for the mtime) relative to the same fd, no paths are
+ * resolved from the root.
+ *
+ * a cur/ or new/ directory whose own mtime is older than the threshold has
+ * had no files added, removed or renamed since then and is skipped without
+ * being listed. this relies on files being replaced by rename (as maildir
+ * clients do), a file rewritten in place will not be seen.
+ */
+
+# include <string>
+# include <vector>
+# include <ctime>
+
+using namespace std;
+
+struct MaildirWalkStats {
+  unsigned long dirs    = 0; /* directories listed */
+  unsigned long pruned  = 0; /* cur/new directories skipped */
+  unsigned long files   = 0; /* files stat'ed */
+  unsigned long changed = 0; /* files modified after the threshold */
+};
+
+/* walk root and add all message files with mtime >= threshold to paths,
+ * returns false if root could not be opened. */
+bool maildir_walk (const string & root, time_t threshold, bool prune, vector<string> & paths, MaildirWalkStats & stats);
+
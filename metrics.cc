@@ -0,0 +1,175 @@
+# include "metrics.hh"
+
+# include <iostream>
+# include <fstream>
+# include <sstream>
+# include <string>
+# include <cstdio>
+# include <ctime>
+
+# include "logger.hh"
+
+using namespace std;
+
+static const char * phase_names[PHASE_COUNT] = {
+  "query",
+  "filenames",
+  "stat",
+  "read",
+  "parse",
+  "decode",
+  "diff",
+  "db_write",
+  "flags",
+  "rewrite",
+};
+
+Metrics::Metrics () {
+  for (auto & p : phases) {
+    for (auto & b : p.buckets) b.store (0, memory_order_relaxed);
+  }
+}
+
+const char * Metrics::name (Phase p) {
+  return phase_names[p];
+}
+
+uint64_t Metrics::bucket_bound (int b) {
+  return (1ull << (b + 10));
+}
+
+int Metrics::bucket_of (uint64_t ns) {
+  if (ns <= bucket_bound (0)) return 0;
+
+  /* ceil (log2 (ns)) */
+  int l = 64 - __builtin_clzll (ns - 1);
+  int b = l - 10;
+
+  return (b < BUCKETS ? b : BUCKETS - 1);
+}
+
+void Metrics::record (Phase p, uint64_t ns) {
+  PhaseStats & s = phases[p];
+
+  s.count.fetch_add (1, memory_order_relaxed);
+  s.total_ns.fetch_add (ns, memory_order_relaxed);
+  s.buckets[bucket_of (ns)].fetch_add (1, memory_order_relaxed);
+
+  uint64_t m = s.max_ns.load (memory_order_relaxed);
+  while (ns > m && !s.max_ns.compare_exchange_weak (m, ns, memory_order_relaxed));
+}
+
+void Metrics::write_json (ostream & o) const {
+  o << "{\n  \"bytes_read\": " << read () << ",\n"
+    << "  \"bytes_written\": " << written () << ",\n"
+    << "  \"bucket_bounds_ns\": [";
+
+  for (int b = 0; b < BUCKETS - 1; b++) {
+    if (b > 0) o << ", ";
+    o << bucket_bound (b);
+  }
+
+  o << "],\n  \"phases\": {\n";
+
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats & s = phases[i];
+
+    o << "    \"" << phase_names[i] << "\": { \"count\": " << s.count.load ()
+      << ", \"total_ns\": " << s.total_ns.load ()
+      << ", \"max_ns\": " << s.max_ns.load ()
+      << ", \"buckets\": [";
+
+    for (int b = 0; b < BUCKETS; b++) {
+      if (b > 0) o << ", ";
+      o << s.buckets[b].load ();
+    }
+
+    o << "] }" << (i < PHASE_COUNT - 1 ? "," : "") << "\n";
+  }
+
+  o << "  }\n}\n";
+}
+
+void Metrics::write_prometheus (ostream & o) const {
+  o.precision (9);
+
+  o << "# HELP keywsync_phase_seconds Time spent in each phase of the sync.\n"
+    << "# TYPE keywsync_phase_seconds histogram\n";
+
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats & s = phases[i];
+    string l = string ("phase=\"") + phase_names[i] + "\"";
+
+    /* prometheus buckets are cumulative */
+    uint64_t c = 0;
+    for (int b = 0; b < BUCKETS - 1; b++) {
+      c += s.buckets[b].load ();
+      o << "keywsync_phase_seconds_bucket{" << l << ",le=\"" << (bucket_bound (b) / 1e9) << "\"} " << c << "\n";
+    }
+
+    o << "keywsync_phase_seconds_bucket{" << l << ",le=\"+Inf\"} " << s.count.load () << "\n"
+      << "keywsync_phase_seconds_sum{" << l << "} " << (s.total_ns.load () / 1e9) << "\n"
+      << "keywsync_phase_seconds_count{" << l << "} " << s.count.load () << "\n";
+  }
+
+  o << "# HELP keywsync_read_bytes_total Bytes read from message files.\n"
+    << "# TYPE keywsync_read_bytes_total counter\n"
+    << "keywsync_read_bytes_total " << read () << "\n"
+    << "# HELP keywsync_written_bytes_total Bytes written to message files.\n"
+    << "# TYPE keywsync_written_bytes_total counter\n"
+    << "keywsync_written_bytes_total " << written () << "\n"
+    << "# HELP keywsync_last_run_timestamp_seconds Time the metrics were written.\n"
+    << "# TYPE keywsync_last_run_timestamp_seconds gauge\n"
+    << "keywsync_last_run_timestamp_seconds " << time (NULL) << "\n";
+}
+
+bool Metrics::save (const string & path, const string & contents) {
+  string tmp = path + ".tmp";
+
+  {
+    ofstream f (tmp, ios::trunc);
+    f << contents;
+    f.close ();
+
+    if (!f.good ()) {
+      LOG_ERROR ("metrics: could not write: " << tmp);
+      return false;
+    }
+  }
+
+  if (rename (tmp.c_str (), path.c_str ()) != 0) {
+    LOG_ERROR ("metrics: could not rename " << tmp << " to " << path);
+    return false;
+  }
+
+  return true;
+}
+
+bool Metrics::save_json (const string & path) const {
+  ostringstream o;
+  write_json (o);
+  return save (path, o.str ());
+}
+
+bool Metrics::save_prometheus (const string & path) const {
+  ostringstream o;
+  write_prometheus (o);
+  return save (path, o.str ());
+}
+
+void Metrics::print () const {
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats & s = phases[i];
+
+    uint64_t n = s.count.load ();
+    if (n == 0) continue;
+
+    cout << "*  phase: " << phase_names[i] << ": " << n << " samples, "
+         << (s.total_ns.load () / 1e6) << " ms total, "
+         << (s.total_ns.load () / n / 1e3) << " us mean, "
+         << (s.max_ns.load () / 1e3) << " us max" << endl;
+  }
+
+  cout << "*  bytes: " << read () << " read, " << written () << " written" << endl;
+}
+
@@ -0,0 +1,113 @@
+# pragma once
+
+/* per-phase counters and latency histograms
+ *
+ * each phase of the hot path (query, reading file names, stat, reading
+ * the header, parsing it, decoding keywords, ...) is timed with a
+ * PhaseTimer on the stack. a sample is a couple of steady_clock reads and
+ * a few relaxed atomic increments, cheap enough to always be enabled. the
+ * histograms have power of two buckets from 1 us to ~4.3 s.
+ *
+ * the metrics can be written as json or in the prometheus text format
+ * (e.g. for the node_exporter textfile collector) at the end of a run.
+ */
+
+# include <atomic>
+# include <chrono>
+# include <string>
+# include <ostream>
+# include <cstdint>
+
+using namespace std;
+
+enum Phase {
+  PHASE_QUERY,      /* notmuch query count and search */
+  PHASE_FILENAMES,  /* file names and tags of a message from the db */
+  PHASE_STAT,       /* stat of message files */
+  PHASE_READ,       /* open and read of the header block */
+  PHASE_PARSE,      /* scanning the header block for X-Keywords */
+  PHASE_DECODE,     /* splitting, decoding and mapping keywords */
+  PHASE_DIFF,       /* comparing file and db tags */
+  PHASE_DB_WRITE,   /* adding and removing tags in the db */
+  PHASE_FLAGS,      /* syncing maildir flags */
+  PHASE_REWRITE,    /* updating X-Keywords in message files */
+
+  PHASE_COUNT,
+};
+
+class Metrics {
+  public:
+    static const int BUCKETS = 24;
+
+    Metrics ();
+
+    void record (Phase, uint64_t ns);
+
+    void add_read (uint64_t bytes)    { bytes_read.fetch_add (bytes, memory_order_relaxed); }
+    void add_written (uint64_t bytes) { bytes_written.fetch_add (bytes, memory_order_relaxed); }
+
+    uint64_t count (Phase p) const    { return phases[p].count.load (memory_order_relaxed); }
+    uint64_t total_ns (Phase p) const { return phases[p].total_ns.load (memory_order_relaxed); }
+    uint64_t bucket (Phase p, int b) const { return phases[p].buckets[b].load (memory_order_relaxed); }
+
+    uint64_t read () const    { return bytes_read.load (memory_order_relaxed); }
+    uint64_t written () const { return bytes_written.load (memory_order_relaxed); }
+
+    /* upper bound of bucket b in ns, the last bucket is unbounded */
+    static uint64_t bucket_bound (int b);
+    static int      bucket_of (uint64_t ns);
+
+    static const char * name (Phase);
+
+    void write_json (ostream &) const;
+    void write_prometheus (ostream &) const;
+
+    /* write to path through a temporary file, so that a collector never
+     * sees a partial file. returns false on failure. */
+    bool save_json (const string & path) const;
+    bool save_prometheus (const string & path) const;
+
+    void print () const;
+
+  private:
+    struct PhaseStats {
+      atomic<uint64_t> count    { 0 };
+      atomic<uint64_t> total_ns { 0 };
+      atomic<uint64_t> max_ns   { 0 };
+      atomic<uint64_t> buckets[BUCKETS];
+    };
+
+    PhaseStats       phases[PHASE_COUNT];
+    atomic<uint64_t> bytes_read    { 0 };
+    atomic<uint64_t> bytes_written { 0 };
+
+    static bool save (const string & path, const string & contents);
+};
+
+/* times the enclosing scope as a sample of phase */
+class PhaseTimer {
+  public:
+    PhaseTimer (Metrics & m, Phase p) :
+      m (m), p (p), t0 (chrono::steady_clock::now ()) { }
+
+    ~PhaseTimer () {
+      stop ();
+    }
+
+    /* record the sample now instead of at the end of the scope */
+    void stop () {
+      if (!done) m.record (p, chrono::duration_cast<chrono::nanoseconds> (
+            chrono::steady_clock::now () - t0).count ());
+      done = true;
+    }
+
+    /* do not record this sample */
+    void cancel () { done = true; }
+
+  private:
+    Metrics & m;
+    Phase     p;
+    bool      done = false;
+    chrono::steady_clock::time_point t0;
+};
+
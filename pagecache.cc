@@ -0,0 +1,92 @@
+# include "pagecache.hh"
+
+# include <iostream>
+# include <vector>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+
+using namespace std;
+
+unsigned long PageCacheStats::footprint () const {
+  unsigned long d = dropped + cached;
+  return (bytes > d ? bytes - d : 0);
+}
+
+void PageCacheStats::print () const {
+  if (measured == 0) {
+    cout << "*  read: " << files << " files, " << (bytes / 1024) << " KiB" << endl;
+    return;
+  }
+
+  cout << "*  read: " << files << " files, " << (bytes / 1024) << " KiB ("
+       << (cached / 1024) << " KiB already cached, " << (dropped / 1024)
+       << " KiB dropped), page cache footprint: ~" << (footprint () / 1024)
+       << " KiB" << endl;
+}
+
+static size_t page_size () {
+  static size_t ps = sysconf (_SC_PAGESIZE);
+  return ps;
+}
+
+size_t cached_bytes (int fd, size_t len) {
+  if (len == 0) return 0;
+
+  size_t ps = page_size ();
+  size_t pages = (len + ps - 1) / ps;
+
+  /* mapping the file does not read it, mincore reports which pages are
+   * resident. */
+  void * m = mmap (NULL, pages * ps, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) return 0;
+
+  vector<unsigned char> v (pages);
+  size_t c = 0;
+
+  if (mincore (m, pages * ps, v.data ()) == 0) {
+    for (size_t i = 0; i < pages; i++) {
+      if (v[i] & 1) c += ps;
+    }
+  }
+
+  munmap (m, pages * ps);
+
+  return (c > len ? len : c);
+}
+
+void prefetch_pages (int fd, size_t len) {
+  posix_fadvise (fd, 0, len, POSIX_FADV_WILLNEED);
+}
+
+void drop_pages (int fd, size_t len) {
+  posix_fadvise (fd, 0, len, POSIX_FADV_DONTNEED);
+}
+
+long cached_before (int fd, size_t len, const PageCachePolicy & policy) {
+  /* mmap, mincore and munmap per file: only when dropping */
+  if (!policy.drop) return -1;
+  if (policy.was_cached >= 0) return policy.was_cached;
+
+  return cached_bytes (fd, len);
+}
+
+void finish_read (int fd, size_t len, long cached, PageCachePolicy & policy) {
+  bool drop = policy.drop && cached == 0 && len > 0;
+
+  if (drop) drop_pages (fd, len);
+
+  if (policy.stats) {
+    policy.stats->files++;
+    policy.stats->bytes  += len;
+
+    if (cached >= 0) {
+      policy.stats->measured++;
+      policy.stats->cached += ((size_t) cached > len ? len : cached);
+    }
+
+    if (drop) policy.stats->dropped += len;
+  }
+}
+
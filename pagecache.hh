@@ -0,0 +1,56 @@
+# pragma once
+
+/* page cache friendly reads
+ *
+ * a full scan reads the header of every message file once and would
+ * otherwise push the working set of other programs (the xapian database,
+ * mail clients) out of the page cache. with dropping enabled the pages
+ * read are dropped again afterwards (POSIX_FADV_DONTNEED), unless they were
+ * already cached before the scan touched them. headers of upcoming files
+ * can be prefetched (POSIX_FADV_WILLNEED) so that reads do not wait on the
+ * disk.
+ */
+
+# include <atomic>
+# include <cstddef>
+
+struct PageCacheStats {
+  std::atomic<unsigned long> files   { 0 }; /* files read */
+  std::atomic<unsigned long> bytes   { 0 }; /* bytes read */
+  std::atomic<unsigned long> measured { 0 }; /* files checked for cached pages */
+  std::atomic<unsigned long> cached  { 0 }; /* of which already cached */
+  std::atomic<unsigned long> dropped { 0 }; /* dropped after reading */
+
+  /* bytes read into the page cache and left there */
+  unsigned long footprint () const;
+
+  void print () const;
+};
+
+/* how a file should be read with regards to the page cache */
+struct PageCachePolicy {
+  bool drop = false;       /* drop the pages read unless they were cached,
+                              only then are the cached pages checked */
+  long was_cached = -1;   /* bytes cached, known from prefetch, -1: check */
+
+  PageCacheStats * stats = NULL;
+};
+
+/* number of bytes of the first len bytes of fd in the page cache */
+size_t cached_bytes (int fd, size_t len);
+
+/* start reading the first len bytes of fd into the page cache */
+void prefetch_pages (int fd, size_t len);
+
+/* drop the first len bytes of fd from the page cache */
+void drop_pages (int fd, size_t len);
+
+/* the bytes of the first len bytes of fd cached before reading it, if
+ * the policy needs it (drop), -1 otherwise */
+long cached_before (int fd, size_t len, const PageCachePolicy & policy);
+
+/* account a read of len bytes from fd and drop the pages according to
+ * policy, cached is the number of bytes that were cached before (-1: not
+ * checked). */
+void finish_read (int fd, size_t len, long cached, PageCachePolicy & policy);
+
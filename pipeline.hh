@@ -0,0 +1,239 @@
+# pragma once
+
+/* in-order work pipeline
+ *
+ * jobs are submitted from a single thread (the one owning the notmuch
+ * database), handed to a pool of workers for the work stage and then
+ * committed in submission order on the submitting thread. notmuch is not
+ * thread safe, so only the work stage may run concurrently.
+ *
+ * the pool is either owned by the pipeline or a WorkerPool shared by the
+ * pipelines of several submitting threads (e.g. one per database).
+ *
+ * at most `depth` jobs are in flight at any time: submit () blocks and
+ * commits the oldest job when the pipeline is full, keeping memory flat.
+ *
+ * with threads <= 1 (or no pool) jobs are worked and committed inline.
+ *
+ * an exception thrown by the work stage on a worker is passed on to the
+ * submitting thread when the job is committed. when the pipeline is
+ * destroyed because of an exception, jobs still in flight are dropped
+ * without being committed.
+ */
+
+# include <deque>
+# include <vector>
+# include <memory>
+# include <functional>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <exception>
+
+# include <atomic>
+
+using namespace std;
+
+/* threads running tasks in the order they were posted */
+class WorkerPool {
+  public:
+    WorkerPool (int threads) {
+      for (int i = 0; i < threads; i++) {
+        workers.push_back (thread (&WorkerPool::worker, this));
+      }
+    }
+
+    /* runs the tasks still queued */
+    ~WorkerPool () {
+      {
+        unique_lock<mutex> lk (m);
+        closed = true;
+      }
+      cv.notify_all ();
+
+      for (auto & t : workers) t.join ();
+    }
+
+    size_t size () const { return workers.size (); }
+
+    void post (function<void()> task) {
+      {
+        unique_lock<mutex> lk (m);
+        tasks.push_back (move (task));
+      }
+      cv.notify_one ();
+    }
+
+  private:
+    vector<thread> workers;
+
+    mutex              m;
+    condition_variable cv;
+    bool               closed = false;
+
+    deque<function<void()>> tasks;
+
+    void worker () {
+      while (true) {
+        function<void()> task;
+        {
+          unique_lock<mutex> lk (m);
+          cv.wait (lk, [&] { return closed || !tasks.empty (); });
+
+          if (tasks.empty ()) return;
+
+          task = move (tasks.front ());
+          tasks.pop_front ();
+        }
+
+        task ();
+      }
+    }
+};
+
+template<class Job> class Pipeline {
+  public:
+    typedef function<void(Job &)> Stage;
+
+    /* with a pool of its own */
+    Pipeline (int threads, size_t depth, Stage work, Stage commit) :
+      owned_pool (threads > 1 ? new WorkerPool (threads) : NULL),
+      pool (owned_pool.get ()),
+      depth (depth > 0 ? depth : 1),
+      work (work),
+      commit (commit)
+    { }
+
+    /* with a shared pool, NULL works inline */
+    Pipeline (WorkerPool * pool, size_t depth, Stage work, Stage commit) :
+      pool (pool),
+      depth (depth > 0 ? depth : 1),
+      work (work),
+      commit (commit)
+    { }
+
+    ~Pipeline () {
+      if (failed || uncaught_exception ()) {
+        abandon ();
+      } else {
+        finish ();
+      }
+    }
+
+    void submit (Job * job) {
+      unique_ptr<Job> j (job);
+
+      if (!pool) {
+        work (*j);
+        commit (*j);
+        return;
+      }
+
+      Entry * e = new Entry (j.release ());
+
+      {
+        unique_lock<mutex> lk (m);
+        inflight.push_back (e);
+      }
+
+      pool->post ([this, e] () { run (e); });
+
+      /* commit any finished jobs at the head, block when full */
+      commit_ready (false);
+    }
+
+    /* wait for all in flight jobs and commit them */
+    void finish () {
+      if (!pool) return;
+
+      commit_ready (true);
+    }
+
+  private:
+    struct Entry {
+      Entry (Job * j) : job (j) { }
+      unique_ptr<Job> job;
+      bool done = false;
+      exception_ptr error;
+    };
+
+    unique_ptr<WorkerPool> owned_pool;
+    WorkerPool *           pool;
+
+    size_t depth;
+    Stage  work;
+    Stage  commit;
+
+    mutex              m;
+    condition_variable cv_done;
+    bool               failed = false;
+    atomic<bool>       abandoned { false };
+
+    deque<Entry *> inflight;  /* submitted, not yet committed (in order) */
+
+    /* on a worker */
+    void run (Entry * e) {
+      if (!abandoned) {
+        try {
+          work (*e->job);
+        } catch (...) {
+          e->error = current_exception ();
+        }
+      }
+
+      /* notified under the lock, the pipeline may be gone right after */
+      unique_lock<mutex> lk (m);
+      e->done = true;
+      cv_done.notify_all ();
+    }
+
+    void commit_ready (bool all) {
+      while (true) {
+        Entry * e;
+        {
+          unique_lock<mutex> lk (m);
+          if (inflight.empty ()) return;
+
+          if (all || inflight.size () >= depth) {
+            cv_done.wait (lk, [&] { return inflight.front ()->done; });
+          } else if (!inflight.front ()->done) {
+            return;
+          }
+
+          e = inflight.front ();
+          inflight.pop_front ();
+        }
+
+        unique_ptr<Entry> owned (e);
+
+        if (e->error) {
+          failed = true;
+          rethrow_exception (e->error);
+        }
+
+        try {
+          commit (*e->job);
+        } catch (...) {
+          failed = true;
+          throw;
+        }
+      }
+    }
+
+    /* drop the jobs in flight, those not yet started are not worked */
+    void abandon () {
+      abandoned = true;
+
+      {
+        unique_lock<mutex> lk (m);
+        cv_done.wait (lk, [&] {
+            for (Entry * e : inflight) if (!e->done) return false;
+            return true;
+          });
+      }
+
+      for (Entry * e : inflight) delete e;
+      inflight.clear ();
+    }
+};
+
@@ -0,0 +1,308 @@
+# include "plan.hh"
+
+# include <iostream>
+# include <fstream>
+# include <string>
+# include <vector>
+# include <cstring>
+# include <cstdio>
+
+# include <unistd.h>
+
+# include "logger.hh"
+
+using namespace std;
+
+static const char plan_magic[8] = { 'K', 'W', 'S', 'P', 'L', 'A', 'N', '2' };
+
+/* characters notmuch leaves unencoded in batch tag lines */
+static const char * batch_charset =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+-_@=.,";
+
+bool Plan::FileChange::unchanged (const struct stat & st) const {
+  return (dev == (uint64_t) st.st_dev &&
+          ino == (uint64_t) st.st_ino &&
+          size == (uint64_t) st.st_size &&
+          mtime_ns == (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+}
+
+uint32_t Plan::tag_id (const string & t) {
+  if (tag_ids.size () != tags.size ()) {
+    /* loaded plan */
+    tag_ids.clear ();
+    for (uint32_t i = 0; i < tags.size (); i++) tag_ids[tags[i]] = i;
+  }
+
+  auto f = tag_ids.find (t);
+  if (f != tag_ids.end ()) return f->second;
+
+  uint32_t id = tags.size ();
+  tags.push_back (t);
+  tag_ids[t] = id;
+
+  return id;
+}
+
+void Plan::add_message (const string & id, const vector<string> & add, const vector<string> & rem) {
+  TagChange m;
+  m.id = id;
+
+  for (auto & t : add) m.add.push_back (tag_id (t));
+  for (auto & t : rem) m.rem.push_back (tag_id (t));
+
+  messages.push_back (move (m));
+}
+
+void Plan::add_file (const string & path, const string & id, const struct stat & st, const string & keywords) {
+  FileChange f;
+  f.path     = path;
+  f.id       = id;
+  f.dev      = st.st_dev;
+  f.ino      = st.st_ino;
+  f.size     = st.st_size;
+  f.mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  f.keywords = keywords;
+
+  files.push_back (move (f));
+}
+
+/* reading and writing {{{ */
+
+template<class T> static void put (string & o, T v) {
+  o.append ((const char *) &v, sizeof (v));
+}
+
+static void put_str (string & o, const string & s) {
+  put<uint32_t> (o, s.size ());
+  o.append (s);
+}
+
+namespace {
+  /* bounds checked reader over the plan file */
+  struct Reader {
+    const string & b;
+    size_t pos = 0;
+    bool   ok  = true;
+
+    Reader (const string & buf) : b (buf) { }
+
+    template<class T> T get () {
+      T v = T ();
+      if (!ok || b.size () - pos < sizeof (v)) {
+        ok = false;
+        return v;
+      }
+
+      memcpy (&v, b.data () + pos, sizeof (v));
+      pos += sizeof (v);
+      return v;
+    }
+
+    string get_str () {
+      uint32_t n = get<uint32_t> ();
+      if (!ok || b.size () - pos < n) {
+        ok = false;
+        return string ();
+      }
+
+      string s (b, pos, n);
+      pos += n;
+      return s;
+    }
+
+    /* a count of items of at least min bytes each, guards against
+     * allocating for a corrupt count */
+    uint32_t get_count (size_t min) {
+      uint32_t n = get<uint32_t> ();
+      if (ok && (b.size () - pos) / min < n) ok = false;
+      return (ok ? n : 0);
+    }
+  };
+}
+
+bool Plan::save (const string & path) const {
+  string o (plan_magic, sizeof (plan_magic));
+
+  put_str (o, db_path);
+  put_str (o, uuid);
+  put<uint64_t> (o, revision);
+  put<uint8_t>  (o, direction);
+  put<int32_t>  (o, x_keywords_padding);
+  put<uint8_t>  (o, flags);
+  put_str (o, add_x_keyw_path);
+  put_str (o, journal_dir);
+
+  put<uint32_t> (o, tags.size ());
+  for (auto & t : tags) put_str (o, t);
+
+  put<uint32_t> (o, messages.size ());
+  for (auto & m : messages) {
+    put_str (o, m.id);
+    put<uint32_t> (o, m.add.size ());
+    for (uint32_t i : m.add) put (o, i);
+    put<uint32_t> (o, m.rem.size ());
+    for (uint32_t i : m.rem) put (o, i);
+  }
+
+  put<uint32_t> (o, files.size ());
+  for (auto & f : files) {
+    put_str (o, f.path);
+    put_str (o, f.id);
+    put (o, f.dev);
+    put (o, f.ino);
+    put (o, f.size);
+    put (o, f.mtime_ns);
+    put_str (o, f.keywords);
+  }
+
+  string tmp = path + ".tmp";
+
+  {
+    ofstream f (tmp, ios::binary | ios::trunc);
+    f.write (o.data (), o.size ());
+    f.close ();
+
+    if (!f.good ()) {
+      LOG_ERROR ("plan: could not write: " << tmp);
+      unlink (tmp.c_str ());
+      return false;
+    }
+  }
+
+  if (rename (tmp.c_str (), path.c_str ()) != 0) {
+    LOG_ERROR ("plan: could not write: " << path);
+    unlink (tmp.c_str ());
+    return false;
+  }
+
+  return true;
+}
+
+bool Plan::load (const string & path) {
+  ifstream f (path, ios::binary);
+  if (!f.good ()) {
+    LOG_ERROR ("plan: could not open: " << path);
+    return false;
+  }
+
+  string buf ((istreambuf_iterator<char> (f)), istreambuf_iterator<char> ());
+
+  if (buf.size () < sizeof (plan_magic) ||
+      memcmp (buf.data (), plan_magic, sizeof (plan_magic)) != 0) {
+    LOG_ERROR ("plan: not a plan file: " << path);
+    return false;
+  }
+
+  Reader r (buf);
+  r.pos = sizeof (plan_magic);
+
+  db_path            = r.get_str ();
+  uuid               = r.get_str ();
+  revision           = r.get<uint64_t> ();
+  direction          = r.get<uint8_t> ();
+  x_keywords_padding = r.get<int32_t> ();
+  flags              = r.get<uint8_t> ();
+  add_x_keyw_path    = r.get_str ();
+  journal_dir        = r.get_str ();
+
+  tags.clear ();
+  tag_ids.clear ();
+  messages.clear ();
+  files.clear ();
+
+  uint32_t n = r.get_count (4);
+  for (uint32_t i = 0; i < n && r.ok; i++) tags.push_back (r.get_str ());
+
+  n = r.get_count (12);
+  for (uint32_t i = 0; i < n && r.ok; i++) {
+    TagChange m;
+    m.id = r.get_str ();
+
+    uint32_t k = r.get_count (4);
+    for (uint32_t j = 0; j < k; j++) m.add.push_back (r.get<uint32_t> ());
+    k = r.get_count (4);
+    for (uint32_t j = 0; j < k; j++) m.rem.push_back (r.get<uint32_t> ());
+
+    for (uint32_t t : m.add) if (t >= tags.size ()) r.ok = false;
+    for (uint32_t t : m.rem) if (t >= tags.size ()) r.ok = false;
+
+    messages.push_back (move (m));
+  }
+
+  n = r.get_count (44);
+  for (uint32_t i = 0; i < n && r.ok; i++) {
+    FileChange fc;
+    fc.path     = r.get_str ();
+    fc.id       = r.get_str ();
+    fc.dev      = r.get<uint64_t> ();
+    fc.ino      = r.get<uint64_t> ();
+    fc.size     = r.get<uint64_t> ();
+    fc.mtime_ns = r.get<int64_t> ();
+    fc.keywords = r.get_str ();
+
+    files.push_back (move (fc));
+  }
+
+  if (!r.ok || r.pos != buf.size ()) {
+    LOG_ERROR ("plan: invalid plan file: " << path);
+    tags.clear ();
+    messages.clear ();
+    files.clear ();
+    return false;
+  }
+
+  return true;
+}
+
+/* }}} */
+
+/* notmuch tag --batch {{{ */
+
+static string batch_encode (const string & s) {
+  string o;
+  char hex[4];
+
+  for (unsigned char ch : s) {
+    if (ch != 0 && strchr (batch_charset, ch)) {
+      o += ch;
+    } else {
+      snprintf (hex, sizeof (hex), "%%%02x", ch);
+      o += hex;
+    }
+  }
+
+  return o;
+}
+
+void Plan::write_batch (ostream & o) const {
+  /* one line per message: +tag -tag -- id:<message id>, the file rewrites
+   * are only in the binary plan. */
+  o << "# keywsync plan: " << messages.size () << " messages";
+  if (!files.empty ()) o << ", " << files.size () << " file rewrites not included";
+  o << "\n";
+
+  for (auto & m : messages) {
+    if (m.add.empty () && m.rem.empty ()) continue;
+
+    for (uint32_t t : m.add) o << "+" << batch_encode (tags[t]) << " ";
+    for (uint32_t t : m.rem) o << "-" << batch_encode (tags[t]) << " ";
+
+    o << "-- id:" << batch_encode (m.id) << "\n";
+  }
+}
+
+bool Plan::save_batch (const string & path) const {
+  ofstream f (path, ios::trunc);
+  write_batch (f);
+  f.close ();
+
+  if (!f.good ()) {
+    LOG_ERROR ("plan: could not write: " << path);
+    return false;
+  }
+
+  return true;
+}
+
+/* }}} */
+
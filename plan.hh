@@ -0,0 +1,95 @@
+# pragma once
+
+/* sync plan: the changes of a sync, made without writing anything
+ *
+ * a scan with --plan opens the database read-only and records what it
+ * would change instead of changing it: the tags to add and remove per
+ * message (as ids into the tag table of the plan) and the new X-Keywords
+ * value per message file. --apply later opens the database read-write
+ * only for as long as it takes to apply the plan.
+ *
+ * the plan keeps the database revision at the start of the scan and the
+ * stat and message id of every file to rewrite, entries for messages or
+ * files that have changed since are skipped when applying (a file also
+ * when its message has been retagged since).
+ *
+ * binary format (host byte order), strings are a uint32 length followed
+ * by the bytes:
+ *
+ *   magic "KWSPLAN2"
+ *   db_path, uuid, revision (uint64), direction (uint8)
+ *   x_keywords_padding (int32), flags (uint8), add_x_keyw_path, journal_dir
+ *   tags:     count, names
+ *   messages: count, { id, add count, add ids (uint32), rem count, rem ids }
+ *   files:    count, { path, id, dev, ino, size (uint64), mtime_ns (int64), keywords }
+ *
+ * the tag changes can also be written as input for notmuch tag --batch.
+ */
+
+# include <string>
+# include <vector>
+# include <unordered_map>
+# include <ostream>
+# include <cstdint>
+# include <sys/stat.h>
+
+using namespace std;
+
+class Plan {
+  public:
+    /* flags */
+    enum {
+      REMOVE_DOUBLE_X_KEYWORDS_HEADER = 1,
+      PARANOID                        = 2,
+    };
+
+    struct TagChange {
+      string           id;      /* message id */
+      vector<uint32_t> add;
+      vector<uint32_t> rem;
+    };
+
+    struct FileChange {
+      string   path;
+      string   id;              /* of the message of the file */
+      uint64_t dev = 0, ino = 0, size = 0;
+      int64_t  mtime_ns = 0;
+      string   keywords;        /* new X-Keywords value */
+
+      /* true if the file is unchanged since the scan */
+      bool unchanged (const struct stat &) const;
+    };
+
+    /* the database and the options the plan was made with */
+    string        db_path;
+    string        uuid;
+    unsigned long revision = 0;
+    int           direction = 0;
+
+    int    x_keywords_padding = 0;
+    int    flags = REMOVE_DOUBLE_X_KEYWORDS_HEADER;
+    string add_x_keyw_path;   /* empty: no headers are added */
+    string journal_dir;
+
+    vector<string>     tags;
+    vector<TagChange>  messages;
+    vector<FileChange> files;
+
+    void add_message (const string & id, const vector<string> & add, const vector<string> & rem);
+    void add_file (const string & path, const string & id, const struct stat & st, const string & keywords);
+
+    /* write plan file (atomically replacing an old one) */
+    bool save (const string & path) const;
+
+    /* read plan file, false if it is missing or invalid */
+    bool load (const string & path);
+
+    /* the tag changes as notmuch tag --batch input */
+    void write_batch (ostream &) const;
+    bool save_batch (const string & path) const;
+
+  private:
+    unordered_map<string, uint32_t> tag_ids;
+    uint32_t tag_id (const string &);
+};
+
@@ -0,0 +1,207 @@
+# include "rules.hh"
+
+# include <iostream>
+# include <fstream>
+# include <string>
+# include <vector>
+# include <algorithm>
+
+# include "tokenizer.hh"
+# include "logger.hh"
+
+using namespace std;
+
+Rules::Rules () {
+  clear ();
+
+  /* built-in rules {{{
+   *
+   * tags to ignore from syncing, these are either internal notmuch tags
+   * or tags handled by maildirflags. */
+  ignore_tags = {
+    "attachment",
+    "draft",
+    "encrypted",
+    "flagged",
+    "important",
+    "new",
+    "passed",
+    "replied",
+    "signed",
+    "unread",
+  };
+
+  /* map keyword to tag */
+  add_map ("\\Draft", "draft");
+  add_map ("\\Important", "important");
+  add_map ("\\Inbox", "inbox");
+  add_map ("\\Junk", "spam");
+  add_map ("\\Muted", "muted");
+  add_map ("\\Sent", "sent");
+  add_map ("\\Starred", "flagged");
+  add_map ("\\Trash", "deleted");
+
+  /* replace chars (only if enable_replace_chars) */
+  add_replace ('/', '.');
+  /* }}} */
+}
+
+void Rules::clear () {
+  ignore_tags.clear ();
+  prefixes.clear ();
+  map_to_tag.clear ();
+  map_to_keyword.clear ();
+
+  for (int i = 0; i < 256; i++) {
+    replace_to_tag[i] = replace_to_keyword[i] = i;
+  }
+
+  memo_tag.clear ();
+  memo_keyword.clear ();
+}
+
+void Rules::add_map (const string & keyword, const string & tag) {
+  map_to_tag[keyword] = tag;
+  map_to_keyword[tag] = keyword;
+}
+
+void Rules::add_replace (unsigned char keyword_c, unsigned char tag_c) {
+  replace_to_tag[keyword_c] = tag_c;
+  replace_to_keyword[tag_c] = keyword_c;
+}
+
+bool Rules::load (const string & path) {
+  ifstream f (path);
+  if (!f.good ()) {
+    LOG_ERROR ("rules: could not open: " << path);
+    return false;
+  }
+
+  clear ();
+
+  string line;
+  int    lineno = 0;
+
+  while (getline (f, line)) {
+    lineno++;
+
+    /* quoted like a job line, for keywords with spaces */
+    vector<string> w;
+    if (!split_args (line, w, false, true)) {
+      LOG_ERROR ("rules: " << path << ":" << lineno << ": unterminated quote: " << line);
+      return false;
+    }
+
+    if (w.empty ()) continue;
+
+    bool ok = false;
+
+    if (w[0] == "ignore" && w.size () == 2) {
+      ignore_tags.push_back (w[1]);
+      ok = true;
+
+    } else if (w[0] == "map" && w.size () == 3) {
+      add_map (w[1], w[2]);
+      ok = true;
+
+    } else if (w[0] == "replace" && w.size () == 3 &&
+               w[1].size () == 1 && w[2].size () == 1 &&
+               (unsigned char) w[1][0] < 0x80 && (unsigned char) w[2][0] < 0x80) {
+      add_replace (w[1][0], w[2][0]);
+      ok = true;
+
+    } else if (w[0] == "prefix" && (w.size () == 2 || w.size () == 3)) {
+      prefixes.push_back (make_pair (w[1], (w.size () == 3 ? w[2] : string ())));
+      ok = true;
+    }
+
+    if (!ok) {
+      LOG_ERROR ("rules: " << path << ":" << lineno << ": invalid rule: " << line);
+      return false;
+    }
+  }
+
+  sort (ignore_tags.begin (), ignore_tags.end ());
+
+  return true;
+}
+
+string Rules::to_tag (const string & keyword) {
+  {
+    unique_lock<mutex> lk (m);
+    auto f = memo_tag.find (keyword);
+    if (f != memo_tag.end ()) return f->second;
+  }
+
+  string t = translate_to_tag (keyword);
+
+  unique_lock<mutex> lk (m);
+  memo_tag[keyword] = t;
+
+  return t;
+}
+
+string Rules::to_keyword (const string & tag) {
+  {
+    unique_lock<mutex> lk (m);
+    auto f = memo_keyword.find (tag);
+    if (f != memo_keyword.end ()) return f->second;
+  }
+
+  string k = translate_to_keyword (tag);
+
+  unique_lock<mutex> lk (m);
+  memo_keyword[tag] = k;
+
+  return k;
+}
+
+string Rules::translate_to_tag (const string & keyword) {
+  /* the replacements only apply to the part after a rewritten prefix */
+  string head;
+  string rest = keyword;
+
+  for (auto & p : prefixes) {
+    if (rest.compare (0, p.first.size (), p.first) == 0) {
+      head = p.second;
+      rest = rest.substr (p.first.size ());
+      break;
+    }
+  }
+
+  if (enable_replace_chars) {
+    for (char & c : rest) c = replace_to_tag[(unsigned char) c];
+  }
+
+  string t = head + rest;
+
+  auto f = map_to_tag.find (t);
+  if (f != map_to_tag.end ()) t = f->second;
+
+  return t;
+}
+
+string Rules::translate_to_keyword (const string & tag) {
+  string k = tag;
+
+  auto f = map_to_keyword.find (k);
+  if (f != map_to_keyword.end ()) k = f->second;
+
+  string head;
+  string rest = k;
+
+  for (auto & p : prefixes) {
+    if (!p.second.empty () && rest.compare (0, p.second.size (), p.second) == 0) {
+      head = p.first;
+      rest = rest.substr (p.second.size ());
+      break;
+    }
+  }
+
+  if (enable_replace_chars) {
+    for (char & c : rest) c = replace_to_keyword[(unsigned char) c];
+  }
+
+  return head + rest;
+}
+
@@ -0,0 +1,73 @@
+# pragma once
+
+/* keyword <-> tag rules
+ *
+ * rules translate a (decoded) keyword from the X-Keywords header to a
+ * notmuch tag and back. a keyword is translated to a tag by:
+ *
+ *   1. rewriting a matching keyword prefix (e.g. '[Gmail]/'),
+ *   2. replacing characters after the prefix (if enabled, e.g. '/' -> '.'),
+ *   3. mapping the whole keyword (e.g. '\Inbox' -> 'inbox').
+ *
+ * and a tag back to a keyword by the inverse steps in the inverse order.
+ * tags in the ignore list are not synced.
+ *
+ * the rules are compiled once, and the result for every distinct keyword
+ * and tag is memoized.
+ *
+ * rule file format, one rule per line, '#' outside of quotes starts a
+ * comment:
+ *
+ *   ignore  <tag>
+ *   map     <keyword> <tag>
+ *   replace <keyword char> <tag char>
+ *   prefix  <keyword prefix> [<tag prefix>]
+ *
+ * keywords and tags with spaces or '#' are quoted with "" or '' (split_args
+ * in tokenizer.hh), a backslash outside of quotes is kept.
+ */
+
+# include <string>
+# include <vector>
+# include <unordered_map>
+# include <mutex>
+
+using namespace std;
+
+class Rules {
+  public:
+    Rules ();
+
+    /* load rules from file, replacing the built-in rules */
+    bool load (const string & path);
+
+    bool enable_replace_chars = false;
+
+    string to_tag     (const string & keyword);
+    string to_keyword (const string & tag);
+
+    const vector<string> & ignored () const { return ignore_tags; }
+
+  private:
+    vector<string> ignore_tags;
+    vector<pair<string, string>> prefixes; /* keyword prefix, tag prefix */
+
+    unordered_map<string, string> map_to_tag;
+    unordered_map<string, string> map_to_keyword;
+
+    /* per byte replacement tables */
+    unsigned char replace_to_tag[256];
+    unsigned char replace_to_keyword[256];
+
+    mutex m;
+    unordered_map<string, string> memo_tag;
+    unordered_map<string, string> memo_keyword;
+
+    void clear ();
+    void add_map (const string & keyword, const string & tag);
+    void add_replace (unsigned char keyword_c, unsigned char tag_c);
+
+    string translate_to_tag     (const string & keyword);
+    string translate_to_keyword (const string & tag);
+};
+
@@ -0,0 +1,43 @@
+# pragma once
+
+/* snapshot of the message files of one message
+ *
+ * every file of a message is read once per run into a FileSnapshot, and
+ * all later stages (consistency check, diff, writing) use the snapshot
+ * instead of opening the file again.
+ */
+
+# include <string>
+# include <vector>
+# include <sys/stat.h>
+
+# include "xkeywords.hh"
+# include "tagset.hh"
+
+using namespace std;
+
+struct FileSnapshot {
+  string      path;
+  struct stat st;
+
+  bool read    = false; /* header has been read */
+  bool scanned = false; /* header was scanned from the file (not from the
+                           file cache), offsets are valid */
+
+  XKeywordsHeader header;
+
+  TagSet all;   /* tags of all keywords */
+  TagSet tags;  /* ignored tags removed */
+
+  /* true if the file is unchanged since the snapshot was taken */
+  bool unchanged (const struct stat & now) const {
+    return (now.st_dev == st.st_dev &&
+            now.st_ino == st.st_ino &&
+            now.st_size == st.st_size &&
+            now.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+            now.st_mtim.tv_nsec == st.st_mtim.tv_nsec);
+  }
+};
+
+typedef vector<FileSnapshot> MessageSnapshot;
+
@@ -90,6 +90,48 @@ spruce_utf8_putc (unsigned char **outbuf, gunichar u)
 	*outbuf = outptr;
 }
 
+/* true if no byte in x is below 0x20, at or above 0x7f, or '&' */
+static inline gboolean
+utf7_plain_word (guint64 x)
+{
+	const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+	const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+	guint64 amp = x ^ (ones * 0x26);
+	guint64 del = x ^ (ones * 0x7f);
+
+	return ((x & high) |
+		((x - ones * 0x20) & ~x & high) |
+		((amp - ones) & ~amp & high) |
+		((del - ones) & ~del & high)) == 0;
+}
+
+gboolean
+spruce_imap_utf7_is_plain (const char *in, size_t len)
+{
+	const unsigned char *inptr = (const unsigned char *) in;
+	guint64 x;
+
+	/* 8 bytes at a time */
+	while (len >= 8) {
+		memcpy (&x, inptr, 8);
+		if (!utf7_plain_word (x))
+			return FALSE;
+
+		inptr += 8;
+		len -= 8;
+	}
+
+	while (len > 0) {
+		if (*inptr < 0x20 || *inptr >= 0x7f || *inptr == '&')
+			return FALSE;
+
+		inptr++;
+		len--;
+	}
+
+	return TRUE;
+}
+
 char *
 spruce_imap_utf7_utf8 (const char *in)
 {
@@ -32,6 +32,10 @@ G_BEGIN_DECLS
 char *spruce_imap_utf7_utf8 (const char *in);
 char *spruce_imap_utf8_utf7 (const char *in);
 
+/* true if in is printable US-ASCII without '&', i.e. it is encoded and
+ * decoded to itself. */
+gboolean spruce_imap_utf7_is_plain (const char *in, size_t len);
+
 G_END_DECLS
 
 #endif /* __SPRUCE_IMAP_UTILS_H__ */
@@ -0,0 +1,93 @@
+# include "state.hh"
+
+# include <iostream>
+# include <fstream>
+# include <sstream>
+# include <string>
+# include <cstdio>
+
+# include <unistd.h>
+
+# include "logger.hh"
+
+using namespace std;
+
+SyncState::SyncState (string path) : state_path (path) {
+}
+
+bool SyncState::load () {
+  entries.clear ();
+
+  ifstream f (state_path);
+  if (!f.good ()) return true;
+
+  string line;
+  while (getline (f, line)) {
+    if (line.empty ()) continue;
+
+    istringstream ls (line);
+    Entry  e;
+    string rev, t, key;
+
+    if (!getline (ls, e.uuid, '\t') ||
+        !getline (ls, rev, '\t') ||
+        !getline (ls, t, '\t') ||
+        !getline (ls, key)) {
+      LOG_ERROR ("state: invalid line in " << state_path << ": " << line);
+      return false;
+    }
+
+    try {
+      e.revision = stoul (rev);
+      e.time     = stol (t);
+    } catch (...) {
+      LOG_ERROR ("state: invalid line in " << state_path << ": " << line);
+      return false;
+    }
+
+    entries[key] = e;
+  }
+
+  return true;
+}
+
+bool SyncState::save () {
+  string tmp = state_path + ".tmp";
+
+  {
+    ofstream f (tmp, ios::trunc);
+    for (auto & e : entries) {
+      f << e.second.uuid << '\t' << e.second.revision << '\t'
+        << e.second.time << '\t' << e.first << '\n';
+    }
+
+    f.close ();
+
+    if (!f.good ()) {
+      LOG_ERROR ("state: could not write: " << tmp);
+      unlink (tmp.c_str ());
+      return false;
+    }
+  }
+
+  if (rename (tmp.c_str (), state_path.c_str ()) != 0) {
+    LOG_ERROR ("state: could not write: " << state_path);
+    unlink (tmp.c_str ());
+    return false;
+  }
+
+  return true;
+}
+
+bool SyncState::get (const string & key, Entry & e) {
+  auto f = entries.find (key);
+  if (f == entries.end ()) return false;
+
+  e = f->second;
+  return true;
+}
+
+void SyncState::set (const string & key, const Entry & e) {
+  entries[key] = e;
+}
+
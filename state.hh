@@ -0,0 +1,42 @@
+# pragma once
+
+/* persisted sync state for incremental runs
+ *
+ * for every sync (direction and query) the database uuid, the database
+ * revision and the time at the start of the last successful run are
+ * stored, one line per sync:
+ *
+ *   <uuid> \t <revision> \t <unix time> \t <direction>:<query>
+ *
+ */
+
+# include <string>
+# include <map>
+# include <ctime>
+
+using namespace std;
+
+class SyncState {
+  public:
+    struct Entry {
+      string        uuid;
+      unsigned long revision = 0;
+      time_t        time = 0;
+    };
+
+    SyncState (string path);
+
+    /* load state file, a missing file is an empty state */
+    bool load ();
+
+    /* write state file (atomically replacing the old one) */
+    bool save ();
+
+    bool get (const string & key, Entry & e);
+    void set (const string & key, const Entry & e);
+
+  private:
+    string state_path;
+    map<string, Entry> entries;
+};
+
@@ -0,0 +1,139 @@
+# include "tagset.hh"
+
+# include <string>
+# include <vector>
+# include <algorithm>
+
+using namespace std;
+
+/* TagSet {{{ */
+void TagSet::add (unsigned int id) {
+  size_t w = id / 64;
+  if (w >= words.size ()) words.resize (w + 1, 0);
+  words[w] |= (uint64_t (1) << (id % 64));
+}
+
+void TagSet::remove (unsigned int id) {
+  size_t w = id / 64;
+  if (w >= words.size ()) return;
+  words[w] &= ~(uint64_t (1) << (id % 64));
+  trim ();
+}
+
+bool TagSet::has (unsigned int id) const {
+  size_t w = id / 64;
+  if (w >= words.size ()) return false;
+  return (words[w] >> (id % 64)) & 1;
+}
+
+bool TagSet::empty () const {
+  return words.empty ();
+}
+
+size_t TagSet::size () const {
+  size_t n = 0;
+  for (uint64_t w : words) n += __builtin_popcountll (w);
+  return n;
+}
+
+vector<unsigned int> TagSet::ids () const {
+  vector<unsigned int> r;
+  for (size_t i = 0; i < words.size (); i++) {
+    uint64_t w = words[i];
+    while (w) {
+      r.push_back (i * 64 + __builtin_ctzll (w));
+      w &= w - 1;
+    }
+  }
+
+  return r;
+}
+
+void TagSet::trim () {
+  /* no trailing empty words, so that equal sets have equal words */
+  while (!words.empty () && words.back () == 0) words.pop_back ();
+}
+
+TagSet TagSet::operator| (const TagSet & o) const {
+  TagSet r = *this;
+  r |= o;
+  return r;
+}
+
+TagSet TagSet::operator& (const TagSet & o) const {
+  TagSet r;
+  r.words.resize (min (words.size (), o.words.size ()));
+  for (size_t i = 0; i < r.words.size (); i++)
+    r.words[i] = words[i] & o.words[i];
+
+  r.trim ();
+  return r;
+}
+
+TagSet TagSet::operator- (const TagSet & o) const {
+  TagSet r = *this;
+  r -= o;
+  return r;
+}
+
+TagSet & TagSet::operator|= (const TagSet & o) {
+  if (o.words.size () > words.size ()) words.resize (o.words.size (), 0);
+  for (size_t i = 0; i < o.words.size (); i++)
+    words[i] |= o.words[i];
+
+  return *this;
+}
+
+TagSet & TagSet::operator-= (const TagSet & o) {
+  size_t n = min (words.size (), o.words.size ());
+  for (size_t i = 0; i < n; i++)
+    words[i] &= ~o.words[i];
+
+  trim ();
+  return *this;
+}
+
+bool TagSet::operator== (const TagSet & o) const {
+  return words == o.words;
+}
+/* }}} */
+
+/* TagDict {{{ */
+unsigned int TagDict::intern (const string & t) {
+  unique_lock<mutex> lk (m);
+
+  auto f = ids.find (t);
+  if (f != ids.end ()) return f->second;
+
+  unsigned int id = tags.size ();
+  tags.push_back (t);
+  ids[t] = id;
+
+  return id;
+}
+
+const string & TagDict::name (unsigned int id) {
+  unique_lock<mutex> lk (m);
+  return tags[id];
+}
+
+TagSet TagDict::set (const vector<string> & ts) {
+  TagSet s;
+  for (auto & t : ts) s.add (intern (t));
+  return s;
+}
+
+vector<string> TagDict::names (const TagSet & s) {
+  vector<string> r;
+  for (unsigned int id : s.ids ()) r.push_back (name (id));
+
+  sort (r.begin (), r.end ());
+  return r;
+}
+
+size_t TagDict::size () {
+  unique_lock<mutex> lk (m);
+  return tags.size ();
+}
+/* }}} */
+
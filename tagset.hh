@@ -0,0 +1,64 @@
+# pragma once
+
+/* interned tags and tag sets
+ *
+ * every distinct tag seen during a run is given a small integer id by the
+ * TagDict, sets of tags are bitsets over these ids. set operations are
+ * word-wise and strings are only used at the notmuch and file boundaries.
+ */
+
+# include <string>
+# include <vector>
+# include <deque>
+# include <unordered_map>
+# include <mutex>
+# include <cstdint>
+
+using namespace std;
+
+class TagSet {
+  public:
+    void add    (unsigned int id);
+    void remove (unsigned int id);
+    bool has    (unsigned int id) const;
+
+    bool   empty () const;
+    size_t size  () const;
+
+    /* ids in the set, in increasing order */
+    vector<unsigned int> ids () const;
+
+    TagSet operator| (const TagSet &) const; /* union */
+    TagSet operator& (const TagSet &) const; /* intersection */
+    TagSet operator- (const TagSet &) const; /* difference (and-not) */
+
+    TagSet & operator|= (const TagSet &);
+    TagSet & operator-= (const TagSet &);
+
+    bool operator== (const TagSet &) const;
+    bool operator!= (const TagSet & o) const { return !(*this == o); }
+
+  private:
+    vector<uint64_t> words;
+
+    void trim ();
+};
+
+class TagDict {
+  public:
+    /* get the id of a tag, adding it if it is new. thread safe. */
+    unsigned int intern (const string &);
+
+    const string & name (unsigned int id);
+
+    TagSet         set   (const vector<string> &);
+    vector<string> names (const TagSet &);
+
+    size_t size ();
+
+  private:
+    mutex m;
+    deque<string> tags;
+    unordered_map<string, unsigned int> ids;
+};
+
@@ -0,0 +1,195 @@
+#! /usr/bin/env python
+#
+# generate a synthetic gmail-style maildir for benchmarking keywsync.
+#
+# messages are made from the messages in test/mail/test_mail with a new
+# message-id, a set of labels in the X-Keywords header and a body of random
+# size. like gmail over imap every message has a file in 'All Mail' and,
+# for some of its labels, a copy in the folder of the label.
+#
+# usage: gen_maildir.py --out DIR [options], see --help.
+#
+
+from __future__ import print_function
+
+import argparse
+import math
+import os
+import random
+import shutil
+import subprocess
+import sys
+
+def read_templates (d):
+  templates = []
+  for f in sorted (os.listdir (d)):
+    p = os.path.join (d, f)
+    if not os.path.isfile (p):
+      continue
+
+    with open (p, 'rb') as fd:
+      c = fd.read ()
+
+    c = c.replace (b'\r\n', b'\n')
+    h, sep, b = c.partition (b'\n\n')
+
+    # drop headers we generate ourselves (including continuation lines)
+    lines = []
+    skip = False
+    for l in h.split (b'\n'):
+      if l[:1] in (b' ', b'\t'):
+        if not skip:
+          lines.append (l)
+        continue
+
+      name = l.split (b':', 1)[0].strip ().lower ()
+      skip = name in (b'message-id', b'x-keywords')
+      if not skip:
+        lines.append (l)
+
+    templates.append ((lines, b))
+
+  if not templates:
+    sys.exit ("no template messages in: " + d)
+
+  return templates
+
+def label_names (n):
+  # a mix of plain labels, nested labels and labels needing quoting
+  names = []
+  for i in range (n):
+    if i % 7 == 3:
+      names.append ('Projects/p%d' % i)
+    elif i % 11 == 5:
+      names.append ('label with space %d' % i)
+    else:
+      names.append ('label%d' % i)
+
+  return names
+
+def pick_labels (rnd, names, weights, mean):
+  # geometric number of labels, labels picked with zipf-like weights
+  k = 0
+  p = 1.0 / (mean + 1.0)
+  while rnd.random () > p:
+    k += 1
+
+  k = min (k, len (names))
+  chosen = set ()
+  while len (chosen) < k:
+    chosen.add (weighted (rnd, weights))
+
+  return [names[i] for i in sorted (chosen)]
+
+def weighted (rnd, weights):
+  r = rnd.random () * weights[-1]
+  lo, hi = 0, len (weights) - 1
+  while lo < hi:
+    m = (lo + hi) // 2
+    if weights[m] < r:
+      lo = m + 1
+    else:
+      hi = m
+  return lo
+
+def quote (k):
+  if ' ' in k or ',' in k or '"' in k:
+    return '"' + k.replace ('\\', '\\\\').replace ('"', '\\"') + '"'
+  return k
+
+def body (rnd, template_body, size):
+  words = [b'lorem', b'ipsum', b'dolor', b'sit', b'amet', b'keyword', b'tag', b'sync']
+  out = [template_body]
+  n = len (template_body)
+  while n < size:
+    l = b' '.join (rnd.choice (words) for _ in range (12)) + b'\n'
+    out.append (l)
+    n += len (l)
+  return b''.join (out)
+
+def main ():
+  ap = argparse.ArgumentParser (description = 'generate a synthetic gmail-style maildir')
+  ap.add_argument ('--out', required = True, help = 'output directory (replaced)')
+  ap.add_argument ('--messages', type = int, default = 5000, help = 'number of messages')
+  ap.add_argument ('--labels', type = int, default = 50, help = 'number of distinct labels')
+  ap.add_argument ('--mean-labels', type = float, default = 2.0, help = 'mean number of labels per message')
+  ap.add_argument ('--zipf', type = float, default = 1.1, help = 'skew of the label popularity')
+  ap.add_argument ('--label-copies', type = float, default = 0.3, help = 'probability that a label has its own copy of the message file')
+  ap.add_argument ('--body-median', type = int, default = 4096, help = 'median body size (bytes)')
+  ap.add_argument ('--body-sigma', type = float, default = 1.0, help = 'sigma of the log-normal body size')
+  ap.add_argument ('--missing', type = float, default = 0.01, help = 'fraction of messages without X-Keywords')
+  ap.add_argument ('--duplicate', type = float, default = 0.005, help = 'fraction of messages with two X-Keywords headers')
+  ap.add_argument ('--seed', type = int, default = 1)
+  ap.add_argument ('--template', default = 'test/mail/test_mail', help = 'directory with template messages')
+  ap.add_argument ('--no-index', action = 'store_true', help = 'do not run notmuch new')
+  args = ap.parse_args ()
+
+  rnd = random.Random (args.seed)
+  templates = read_templates (args.template)
+
+  names = label_names (args.labels)
+  weights = []
+  acc = 0.0
+  for i in range (len (names)):
+    acc += 1.0 / math.pow (i + 1, args.zipf)
+    weights.append (acc)
+
+  out = os.path.abspath (args.out)
+  mail = os.path.join (out, 'mail')
+  shutil.rmtree (out, ignore_errors = True)
+
+  def folder (name):
+    d = os.path.join (mail, 'gmail', name.replace ('/', '.'))
+    for s in ('cur', 'new', 'tmp'):
+      p = os.path.join (d, s)
+      if not os.path.isdir (p):
+        os.makedirs (p)
+    return os.path.join (d, 'cur')
+
+  all_mail = folder ('[Gmail].All Mail')
+
+  files = 0
+  for n in range (args.messages):
+    lines, tbody = rnd.choice (templates)
+    labels = pick_labels (rnd, names, weights, args.mean_labels)
+
+    header = list (lines)
+    header.append (('Message-ID: <bench-%d@keywsync.invalid>' % n).encode ('ascii'))
+
+    r = rnd.random ()
+    if r >= args.missing:
+      kw = ('X-Keywords: ' + ','.join (quote (l) for l in labels)).encode ('utf-8')
+      header.append (kw)
+      if r < args.missing + args.duplicate:
+        header.append (kw)
+
+    size = int (rnd.lognormvariate (math.log (max (args.body_median, 1)), args.body_sigma))
+    content = b'\n'.join (header) + b'\n\n' + body (rnd, tbody, size)
+
+    dirs = [all_mail]
+    for l in labels:
+      if rnd.random () < args.label_copies:
+        dirs.append (folder (l))
+
+    for i, d in enumerate (dirs):
+      fn = os.path.join (d, 'bench.%d.%d:2,S' % (n, i))
+      with open (fn, 'wb') as fd:
+        fd.write (content)
+      files += 1
+
+  config = os.path.join (out, 'notmuch-config')
+  with open (config, 'w') as fd:
+    fd.write ('[database]\npath=%s\n\n[new]\ntags=inbox;\nignore=\n\n[maildir]\nsynchronize_flags=true\n' % mail)
+
+  print ('=> generated %d messages in %d files in: %s' % (args.messages, files, mail))
+
+  if not args.no_index:
+    env = dict (os.environ)
+    env['NOTMUCH_CONFIG'] = config
+    r = subprocess.call (['notmuch', 'new', '--quiet'], env = env)
+    if r != 0:
+      sys.exit ('notmuch new failed')
+
+if __name__ == '__main__':
+  main ()
+
@@ -0,0 +1,69 @@
+#! /usr/bin/env python
+#
+# long run memory test: peak rss of a full keyword-to-tag run must not grow
+# with the number of messages.
+#
+# generates maildirs of increasing size with gen_maildir.py, runs a full
+# dry-run keyword-to-tag sync on each and fails if the peak rss of the
+# largest run exceeds that of the smallest by more than --slack-kb (the
+# file cache and the base state are not used, they grow by design).
+#
+# usage: rss_scaling.py --keywsync ./keywsync --out DIR [--sizes 10000,100000,1000000]
+#
+
+from __future__ import print_function
+
+import argparse
+import os
+import subprocess
+import sys
+
+sys.path.insert (0, os.path.dirname (os.path.abspath (__file__)))
+from run_bench import run
+
+def main ():
+  ap = argparse.ArgumentParser (description = 'check that keywsync runs in constant memory')
+  ap.add_argument ('--keywsync', default = './keywsync')
+  ap.add_argument ('--out', required = True, help = 'directory for the generated maildirs')
+  ap.add_argument ('--sizes', default = '10000,100000,1000000', help = 'comma separated message counts')
+  ap.add_argument ('--threads', type = int, default = 4)
+  ap.add_argument ('--slack-kb', type = int, default = 16384, help = 'allowed growth of peak rss')
+  ap.add_argument ('--template', default = 'test/mail/test_mail')
+  args = ap.parse_args ()
+
+  gen = os.path.join (os.path.dirname (os.path.abspath (__file__)), 'gen_maildir.py')
+  sizes = [int (s) for s in args.sizes.split (',')]
+  rss = []
+
+  for n in sizes:
+    root = os.path.abspath (os.path.join (args.out, str (n)))
+
+    if not os.path.exists (os.path.join (root, 'notmuch-config')):
+      subprocess.check_call ([sys.executable, gen, '--out', root, '--messages', str (n),
+                              '--template', args.template])
+
+    env = dict (os.environ)
+    env['NOTMUCH_CONFIG'] = os.path.join (root, 'notmuch-config')
+
+    cmd = [os.path.abspath (args.keywsync), '-m', os.path.join (root, 'mail'),
+           '-q', 'path:gmail/**', '-k', '-d', '-j', str (args.threads), '--no-replace-chars']
+
+    code, out, wall, ru = run (cmd, env)
+    if code != 0:
+      print (out)
+      print ('=> %d messages: keywsync failed (exit %d)' % (n, code))
+      return 1
+
+    rss.append (ru.ru_maxrss)
+    print ('=> %8d messages: %8.2f s, peak rss: %d KiB' % (n, wall, ru.ru_maxrss))
+
+  growth = rss[-1] - rss[0]
+  if growth > args.slack_kb:
+    print ('=> failed: peak rss grew by %d KiB from %d to %d messages' % (growth, sizes[0], sizes[-1]))
+    return 1
+
+  print ('=> ok: peak rss grew by %d KiB from %d to %d messages' % (growth, sizes[0], sizes[-1]))
+  return 0
+
+if __name__ == '__main__':
+  sys.exit (main ())
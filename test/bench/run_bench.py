@@ -0,0 +1,210 @@
+#! /usr/bin/env python
+#
+# run keywsync benchmark scenarios on a maildir made by gen_maildir.py and
+# append the results as json lines to a results file.
+#
+# every line holds the commit, the scenario and wall time, cpu time, peak
+# rss and bytes read / written for one run of keywsync, so that results
+# can be compared across commits.
+#
+# usage: run_bench.py --keywsync ./keywsync --root DIR [options]
+#
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import random
+import re
+import subprocess
+import sys
+import time
+
+def git_commit ():
+  try:
+    return subprocess.check_output (['git', 'rev-parse', '--short', 'HEAD']).decode ('ascii').strip ()
+  except Exception:
+    return 'unknown'
+
+def message_files (mail):
+  # all message files, in a stable order
+  files = []
+  for d, _, fs in os.walk (mail):
+    if os.path.basename (d) == 'cur':
+      files.extend (os.path.join (d, f) for f in fs)
+  return sorted (files)
+
+def run (cmd, env):
+  # run cmd and return (exit code, output, wall time, rusage)
+  t0 = time.time ()
+  p = subprocess.Popen (cmd, env = env, stdout = subprocess.PIPE, stderr = subprocess.STDOUT)
+  out = p.stdout.read ().decode ('utf-8', 'replace')
+  _, status, ru = os.wait4 (p.pid, 0)
+  p.returncode = os.WEXITSTATUS (status) if os.WIFEXITED (status) else -1
+  return p.returncode, out, time.time () - t0, ru
+
+def parse_output (out):
+  r = {}
+
+  m = re.search (r'checked: (\d+) messages and changed: (\d+) messages', out)
+  if m:
+    r['checked'] = int (m.group (1))
+    r['changed'] = int (m.group (2))
+
+  m = re.search (r'\*  read: (\d+) files, (\d+) KiB', out)
+  if m:
+    r['files_read'] = int (m.group (1))
+    r['header_bytes_read'] = int (m.group (2)) * 1024
+
+  m = re.search (r'\*  journal: (\d+) writes in (\d+) commits, (\d+) syncs', out)
+  if m:
+    r['files_written'] = int (m.group (1))
+    r['syncs'] = int (m.group (3))
+
+  return r
+
+def change_keywords (files, rnd, fraction, keyword):
+  # add a keyword to the X-Keywords header of a fraction of the files,
+  # all files of the same message are changed. returns the number of files.
+  ids = {}
+  for f in files:
+    n = os.path.basename (f).split ('.')[1]
+    ids.setdefault (n, []).append (f)
+
+  chosen = [k for k in sorted (ids) if rnd.random () < fraction]
+  changed = 0
+
+  for k in chosen:
+    for f in ids[k]:
+      with open (f, 'rb') as fd:
+        c = fd.read ()
+
+      new = c.replace (b'\nX-Keywords: ', ('\nX-Keywords: %s,' % keyword).encode ('ascii'), 1)
+      if new == c:
+        continue
+
+      # same inode, like offlineimap
+      with open (f, 'r+b') as fd:
+        fd.write (new)
+        fd.truncate ()
+
+      changed += 1
+
+  return changed
+
+def main ():
+  ap = argparse.ArgumentParser (description = 'run keywsync benchmarks')
+  ap.add_argument ('--keywsync', default = './keywsync')
+  ap.add_argument ('--root', required = True, help = 'directory made by gen_maildir.py')
+  ap.add_argument ('--results', default = 'test/bench/results.jsonl', help = 'json lines file the results are appended to')
+  ap.add_argument ('--changed', type = float, default = 1.0, help = 'percent of messages changed in the k%% changed scenarios')
+  ap.add_argument ('--threads', type = int, default = 1)
+  ap.add_argument ('--seed', type = int, default = 1)
+  ap.add_argument ('--extra', default = '', help = 'extra arguments to keywsync for all scenarios')
+  args = ap.parse_args ()
+
+  root = os.path.abspath (args.root)
+  mail = os.path.join (root, 'mail')
+  env = dict (os.environ)
+  env['NOTMUCH_CONFIG'] = os.path.join (root, 'notmuch-config')
+
+  rnd = random.Random (args.seed)
+  files = message_files (mail)
+  messages = sorted (set (os.path.basename (f).split ('.')[1] for f in files))
+  fraction = args.changed / 100.0
+  commit = git_commit ()
+
+  base = [os.path.abspath (args.keywsync), '-m', mail, '-q', 'path:gmail/**', '-j', str (args.threads), '--no-replace-chars'] + args.extra.split ()
+
+  def scenario (name, extra, prepare = None, check = False):
+    info = {}
+    if prepare:
+      info = prepare () or {}
+
+    metrics = os.path.join (root, 'metrics.json')
+    if os.path.exists (metrics):
+      os.remove (metrics)
+
+    code, out, wall, ru = run (base + extra + ['--metrics-json', metrics], env)
+
+    r = {
+      'commit':      commit,
+      'time':        int (time.time ()),
+      'scenario':    name,
+      'args':        ' '.join (extra),
+      'messages':    len (messages),
+      'files':       len (files),
+      'exit':        code,
+      'wall_s':      round (wall, 4),
+      'user_s':      round (ru.ru_utime, 4),
+      'sys_s':       round (ru.ru_stime, 4),
+      'max_rss_kb':  ru.ru_maxrss,
+      'read_bytes':  ru.ru_inblock * 512,
+      'write_bytes': ru.ru_oublock * 512,
+    }
+    r.update (info)
+    r.update (parse_output (out))
+
+    # per-phase totals reported by keywsync
+    if os.path.exists (metrics):
+      with open (metrics) as fd:
+        m = json.load (fd)
+
+      r['phases'] = dict ((k, { 'count': v['count'], 'total_ms': round (v['total_ns'] / 1e6, 3) })
+          for k, v in m['phases'].items () if v['count'] > 0)
+      r['file_read_bytes']    = m['bytes_read']
+      r['file_written_bytes'] = m['bytes_written']
+
+    print ('=> %-12s %8.3f s wall, %8.3f s cpu, %7d KiB rss, exit %d' %
+        (name, r['wall_s'], r['user_s'] + r['sys_s'], r['max_rss_kb'], code))
+
+    if code != 0:
+      print (out)
+
+      # a broken command line fails every scenario, do not record any
+      if check:
+        print ('error: %s failed, no results recorded.' % name)
+        sys.exit (1)
+
+    with open (args.results, 'a') as fd:
+      fd.write (json.dumps (r, sort_keys = True) + '\n')
+
+    return code
+
+  failed = 0
+
+  # initial full sync, then the same with nothing to change
+  failed += scenario ('k-initial', ['-k'], check = True) != 0
+  failed += scenario ('k-full', ['-k']) != 0
+  failed += scenario ('k-dryrun', ['-k', '-d']) != 0
+  failed += scenario ('t-full', ['-t']) != 0
+
+  # k% of the files changed remotely, found with --mtime
+  time.sleep (1)
+  since = int (time.time ())
+
+  failed += scenario ('k-mtime', ['-k', '--mtime', str (since)],
+      lambda: { 'files_changed': change_keywords (files, rnd, fraction, 'bench-mtime') }) != 0
+
+  # k% of the files changed remotely, full keyword-to-tag
+  failed += scenario ('k-changed', ['-k'],
+      lambda: { 'files_changed': change_keywords (files, rnd, fraction, 'bench-full') }) != 0
+
+  # k% of the messages tagged locally, full tag-to-keyword
+  def change_local ():
+    ids = ['id:bench-%s@keywsync.invalid' % n for n in messages if rnd.random () < fraction]
+    p = subprocess.Popen (['notmuch', 'tag', '--batch'], env = env, stdin = subprocess.PIPE)
+    p.communicate (''.join ('+bench-local -- %s\n' % i for i in ids).encode ('ascii'))
+    return { 'messages_changed': len (ids) }
+
+  failed += scenario ('t-changed', ['-t'], change_local) != 0
+
+  print ('=> results appended to: %s' % args.results)
+
+  if failed:
+    sys.exit ('%d scenarios failed' % failed)
+
+if __name__ == '__main__':
+  main ()
+
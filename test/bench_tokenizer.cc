@@ -0,0 +1,110 @@
+/* microbenchmark: X-Keywords tokenizer
+ *
+ * compares splitting X-Keywords headers with Glib::Regex::split_simple
+ * followed by sort and unique (the previous path) to split_keywords into a
+ * TagSet. the headers are the header block of msg1.eml with a set of
+ * GMail-style X-Keywords fields added.
+ *
+ * run from the repository root:
+ *
+ *   $ scons bench_tokenizer && ./test/bench_tokenizer
+ */
+
+# include <iostream>
+# include <fstream>
+# include <sstream>
+# include <string>
+# include <vector>
+# include <algorithm>
+# include <chrono>
+# include <unordered_map>
+
+# include <glibmm.h>
+
+# include "xkeywords.hh"
+# include "tokenizer.hh"
+# include "tagset.hh"
+
+using namespace std;
+
+static const vector<string> keywords = {
+  "\\Inbox,\\Important",
+  "\\Inbox,\\Important,\\Starred,work",
+  "\\Sent,lists/notmuch,lists/sup-talk",
+  "\\Inbox,lists/sup-talk,todo,work/project-a,work/project-b",
+  "\\Important,\\Inbox,\\Sent,\\Starred,family,friends,receipts,travel/2009,lists/sup-talk,\\Inbox",
+  "",
+};
+
+int main (int argc, char ** argv) {
+  Glib::init ();
+
+  int iterations = (argc > 1 ? atoi (argv[1]) : 200000);
+
+  ifstream f ("test/mail/test_mail/msg1.eml");
+  if (!f.good ()) {
+    cerr << "run from repository root: could not open test/mail/test_mail/msg1.eml" << endl;
+    return 1;
+  }
+
+  stringstream ss;
+  ss << f.rdbuf ();
+  string msg = ss.str ();
+
+  /* build messages and extract X-Keywords values the way keywsync does */
+  vector<string> headers;
+  for (auto & k : keywords) {
+    string m = "X-Keywords: " + k + "\n" + msg;
+
+    XKeywordsHeader h;
+    scan_x_keywords (m.data (), m.size (), h);
+    headers.push_back (h.joined ());
+  }
+
+  size_t total = 0;
+
+  /* glib regex */
+  auto t0 = chrono::steady_clock::now ();
+  for (int i = 0; i < iterations; i++) {
+    const string & h = headers[i % headers.size ()];
+
+    vector<Glib::ustring> tokens = Glib::Regex::split_simple (",", h);
+    sort (tokens.begin (), tokens.end ());
+    auto it = unique (tokens.begin (), tokens.end ());
+    tokens.resize (distance (tokens.begin (), it));
+
+    total += tokens.size ();
+  }
+  chrono::duration<double> regex_t = chrono::steady_clock::now () - t0;
+
+  /* split_keywords into tag set */
+  TagDict dict;
+  unordered_map<string, unsigned int> ids;
+  string scratch;
+
+  t0 = chrono::steady_clock::now ();
+  for (int i = 0; i < iterations; i++) {
+    const string & h = headers[i % headers.size ()];
+
+    TagSet tags;
+    split_keywords (h, scratch, [&] (boost::string_view k) {
+        string s (k.data (), k.size ());
+        auto fnd = ids.find (s);
+        if (fnd == ids.end ()) {
+          fnd = ids.insert (make_pair (s, dict.intern (s))).first;
+        }
+        tags.add (fnd->second);
+      });
+
+    total += tags.size ();
+  }
+  chrono::duration<double> split_t = chrono::steady_clock::now () - t0;
+
+  cout << "headers: " << iterations << " (" << total << " keywords)" << endl;
+  cout << "Glib::Regex::split_simple: " << (regex_t.count () * 1e9 / iterations) << " ns/header" << endl;
+  cout << "split_keywords:            " << (split_t.count () * 1e9 / iterations) << " ns/header" << endl;
+  cout << "speedup: " << (regex_t.count () / split_t.count ()) << "x" << endl;
+
+  return 0;
+}
+
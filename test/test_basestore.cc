@@ -0,0 +1,87 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "basestore.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(BaseStoreTest)
+
+  BOOST_AUTO_TEST_CASE(merge)
+  {
+    TagDict d;
+
+    TagSet base   = d.set ({ "inbox", "unread", "work" });
+    TagSet local  = d.set ({ "inbox", "work", "todo" });      /* -unread +todo */
+    TagSet remote = d.set ({ "inbox", "unread", "starred" }); /* -work +starred */
+
+    TagSet m = merge_tags (local, remote, &base, CONFLICT_UNION);
+    BOOST_CHECK (m == d.set ({ "inbox", "todo", "starred" }));
+
+    /* unchanged on both sides */
+    BOOST_CHECK (merge_tags (base, base, &base, CONFLICT_LOCAL) == base);
+
+    /* changed on one side only */
+    BOOST_CHECK (merge_tags (local, base, &base, CONFLICT_REMOTE) == local);
+    BOOST_CHECK (merge_tags (base, remote, &base, CONFLICT_LOCAL) == remote);
+
+    /* no base */
+    BOOST_CHECK (merge_tags (local, remote, NULL, CONFLICT_UNION) == (local | remote));
+    BOOST_CHECK (merge_tags (local, remote, NULL, CONFLICT_LOCAL) == local);
+    BOOST_CHECK (merge_tags (local, remote, NULL, CONFLICT_REMOTE) == remote);
+  }
+
+  BOOST_AUTO_TEST_CASE(roundtrip_and_prune)
+  {
+    char fname[] = "/tmp/test_basestore-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+    unlink (fname);
+
+    TagDict d;
+    TagSet  t;
+
+    {
+      BaseStore b (fname, d);
+      BOOST_CHECK (b.load ());
+      BOOST_CHECK (!b.get ("a@example.com", t));
+
+      b.set ("a@example.com", d.set ({ "inbox", "gmail.Sent Mail" }));
+      b.set ("b@example.com", TagSet ());
+      BOOST_CHECK (b.save ([] (const string &) { return false; }));
+    }
+
+    {
+      BaseStore b (fname, d);
+      BOOST_CHECK (b.load ());
+      BOOST_CHECK_EQUAL (b.size (), 2u);
+
+      BOOST_REQUIRE (b.get ("a@example.com", t));
+      BOOST_CHECK (t == d.set ({ "inbox", "gmail.Sent Mail" }));
+
+      BOOST_REQUIRE (b.get ("b@example.com", t));
+      BOOST_CHECK (t.empty ());
+
+      /* only b is set this run, a is pruned */
+      b.set ("b@example.com", d.set ({ "unread" }));
+      BOOST_CHECK (b.save ([] (const string &) { return false; }));
+    }
+
+    {
+      BaseStore b (fname, d);
+      BOOST_CHECK (b.load ());
+      BOOST_CHECK_EQUAL (b.size (), 1u);
+      BOOST_CHECK (!b.get ("a@example.com", t));
+    }
+
+    unlink (fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
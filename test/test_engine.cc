@@ -0,0 +1,235 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <fstream>
+# include <unistd.h>
+
+# include <boost/filesystem.hpp>
+
+# include "engine.hh"
+# include "plan.hh"
+# include "handles.hh"
+# include "logger.hh"
+
+using namespace std;
+
+/* set up by the test_db target, the tests run from the top directory */
+static string test_db () {
+  return boost::filesystem::canonical ("test/mail/test_mail").string ();
+}
+
+BOOST_AUTO_TEST_SUITE(EngineTest)
+
+  BOOST_AUTO_TEST_CASE(report)
+  {
+    /* most test messages have no X-Keywords header */
+    logger.set_level (LEVEL_ERROR);
+
+    SyncShared shared;
+    shared.init ();
+
+    NmDatabase db = setup_db (test_db ().c_str ());
+
+    SyncConfig c;
+    c.direction   = KEYWORD_TO_TAG;
+    c.dryrun      = true;
+    c.journal_dir = test_db () + "/.notmuch/keywsync-journal";
+
+    SyncEngine e (shared, c, db.get ());
+
+    SyncReport r = e.sync_messages ("*");
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK (r.checked > 0);
+    BOOST_CHECK (r.error.empty ());
+
+    /* files not in the database are skipped */
+    r = e.sync_files ({ test_db () + "/no-such-message.eml" });
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, 0);
+
+    /* a message through its file, counted per sync */
+    r = e.sync_files ({ test_db () + "/msg1.eml", test_db () + "/msg1.eml" });
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, 1);
+
+    BOOST_CHECK (e.get_metrics ().count (PHASE_FILENAMES) > 1);
+  }
+
+  BOOST_AUTO_TEST_CASE(files_in_query)
+  {
+    /* files of messages outside the query are skipped, as by the query
+     * itself (--walk, --watch) */
+    logger.set_level (LEVEL_ERROR);
+
+    SyncShared shared;
+    shared.init ();
+
+    NmDatabase db = setup_db (test_db ().c_str ());
+
+    notmuch_message_t * m = NULL;
+    BOOST_REQUIRE (notmuch_database_find_message_by_filename (db.get (), (test_db () + "/msg1.eml").c_str (), &m) == NOTMUCH_STATUS_SUCCESS && m);
+    NmMessage msg1 (m);
+
+    SyncConfig c;
+    c.direction   = KEYWORD_TO_TAG;
+    c.dryrun      = true;
+    c.journal_dir = test_db () + "/.notmuch/keywsync-journal";
+    c.query       = string ("id:\"") + notmuch_message_get_message_id (msg1.get ()) + "\"";
+
+    SyncEngine e (shared, c, db.get ());
+
+    SyncReport r = e.sync_files ({ test_db () + "/msg1.eml", test_db () + "/msg2.eml" });
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, 1);
+
+    r = e.sync_files ({ test_db () + "/msg2.eml" });
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(error)
+  {
+    logger.set_level (LEVEL_ERROR);
+
+    SyncShared shared;
+    shared.init ();
+
+    NmDatabase db = setup_db (test_db ().c_str ());
+
+    /* the journal can not be created: reported, not exited */
+    SyncConfig c;
+    c.direction   = TAG_TO_KEYWORD;
+    c.journal_dir = "/nonexistent/keywsync-journal";
+
+    SyncEngine e (shared, c, db.get ());
+    SyncReport r = e.sync_messages ("*");
+
+    BOOST_CHECK (!r.ok);
+    BOOST_CHECK (r.error.find ("journal") != string::npos);
+    BOOST_CHECK_EQUAL (r.checked, 0);
+
+    /* the database can still be used */
+    c.direction   = KEYWORD_TO_TAG;
+    c.dryrun      = true;
+
+    SyncEngine e2 (shared, c, db.get ());
+    r = e2.sync_messages ("*");
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK (r.checked > 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(plan)
+  {
+    logger.set_level (LEVEL_ERROR);
+
+    SyncShared shared;
+    shared.init ();
+
+    string plan_path = "/tmp/test_engine-plan";
+
+    /* the scan only needs a read-only database */
+    SyncConfig c;
+    c.db_path     = test_db ();
+    c.direction   = KEYWORD_TO_TAG;
+    c.journal_dir = test_db () + "/.notmuch/keywsync-journal";
+    c.plan_path   = plan_path;
+
+    {
+      NmDatabase db = setup_db (test_db ().c_str (), NOTMUCH_DATABASE_MODE_READ_ONLY);
+
+      SyncEngine e (shared, c, db.get ());
+      SyncReport r = e.sync_messages ("*");
+      BOOST_CHECK (r.ok);
+      BOOST_CHECK (r.checked > 0);
+    }
+
+    Plan p;
+    BOOST_REQUIRE (p.load (plan_path));
+    BOOST_CHECK_EQUAL (p.db_path, test_db ());
+    BOOST_CHECK_EQUAL (p.direction, KEYWORD_TO_TAG);
+    BOOST_CHECK (p.files.empty ());
+
+    /* a planned message that is gone is skipped */
+    p.add_message ("no-such-message@example.com", { "inbox" }, { });
+
+    NmDatabase db = setup_db (test_db ().c_str ());
+
+    SyncConfig ac;
+    ac.dryrun = true;
+
+    SyncEngine e (shared, ac, db.get ());
+    SyncReport r = e.apply (p);
+
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, (int) p.messages.size ());
+    BOOST_CHECK (r.skipped >= 1);
+
+    /* bidirectional sync can not be planned */
+    c.direction = BIDIRECTIONAL;
+    SyncEngine e2 (shared, c, db.get ());
+    BOOST_CHECK (!e2.sync_messages ("*").ok);
+
+    unlink (plan_path.c_str ());
+  }
+
+  BOOST_AUTO_TEST_CASE(indexed)
+  {
+    logger.set_level (LEVEL_ERROR);
+
+    /* the test messages all have the inbox and unread tags from notmuch
+     * new, only msg1 gets a tag that no X-Keywords header has */
+    string rules_path = "/tmp/test_engine-rules";
+    {
+      ofstream f (rules_path);
+      for (auto t : { "attachment", "draft", "encrypted", "flagged", "important",
+                      "inbox", "new", "passed", "replied", "signed", "unread" }) {
+        f << "ignore " << t << endl;
+      }
+    }
+
+    SyncShared shared;
+    BOOST_REQUIRE (shared.rules.load (rules_path));
+    shared.init ();
+    unlink (rules_path.c_str ());
+
+    NmDatabase db = setup_db (test_db ().c_str ());
+
+    notmuch_message_t * m = NULL;
+    BOOST_REQUIRE (notmuch_database_find_message_by_filename (db.get (), (test_db () + "/msg1.eml").c_str (), &m) == NOTMUCH_STATUS_SUCCESS && m);
+    NmMessage msg1 (m);
+    BOOST_REQUIRE (notmuch_message_add_tag (msg1.get (), "todo") == NOTMUCH_STATUS_SUCCESS);
+
+    SyncConfig c;
+    c.direction    = KEYWORD_TO_TAG;
+    c.dryrun       = true;
+    c.journal_dir  = test_db () + "/.notmuch/keywsync-journal";
+    c.query        = "*";
+    c.index_prefix = "xkw";
+
+    /* not configured: every message is read */
+    SyncEngine e (shared, c, db.get ());
+    SyncReport full = e.run ();
+    BOOST_CHECK (full.ok);
+    BOOST_CHECK (full.checked > 1);
+
+# ifdef HAVE_NOTMUCH_GET_CONFIG
+    /* configured (the test messages were indexed before): only msg1 is a
+     * candidate of the tag queries, and only its file is read */
+    BOOST_REQUIRE (notmuch_database_set_config (db.get (), "index.header.xkw", "X-Keywords") == NOTMUCH_STATUS_SUCCESS);
+
+    SyncEngine e2 (shared, c, db.get ());
+    SyncReport r = e2.run ();
+    BOOST_CHECK (r.ok);
+    BOOST_CHECK_EQUAL (r.checked, 1);
+    BOOST_CHECK (e2.get_metrics ().count (PHASE_READ) < e.get_metrics ().count (PHASE_READ));
+
+    notmuch_database_set_config (db.get (), "index.header.xkw", "");
+# endif
+
+    notmuch_message_remove_tag (msg1.get (), "todo");
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,136 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <cstdlib>
+# include <cstdio>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "filecache.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(FileCacheTest)
+
+  BOOST_AUTO_TEST_CASE(roundtrip_and_prune)
+  {
+    char cache_fname[] = "/tmp/test_filecache-XXXXXX";
+    int fd = mkstemp (cache_fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+    unlink (cache_fname);
+
+    char a_fname[] = "/tmp/test_filecache-a-XXXXXX";
+    char b_fname[] = "/tmp/test_filecache-b-XXXXXX";
+    close (mkstemp (a_fname));
+    close (mkstemp (b_fname));
+
+    struct stat a, b;
+    BOOST_REQUIRE (stat (a_fname, &a) == 0);
+    BOOST_REQUIRE (stat (b_fname, &b) == 0);
+
+    string value;
+    bool   found;
+
+    {
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      BOOST_CHECK (!c.lookup (a, value, found));
+
+      c.put (a, a_fname, "inbox,\\Important", true);
+      c.put (b, b_fname, "", false);
+
+      BOOST_CHECK (c.lookup (a, value, found));
+      BOOST_CHECK_EQUAL (value, "inbox,\\Important");
+
+      BOOST_CHECK (c.save ([] (const string &) { return true; }));
+    }
+
+    {
+      /* b is not looked up and not kept */
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      BOOST_CHECK (c.lookup (a, value, found));
+      BOOST_CHECK (found);
+      BOOST_CHECK_EQUAL (value, "inbox,\\Important");
+
+      /* changed size invalidates entry */
+      struct stat a2 = a;
+      a2.st_size += 1;
+      BOOST_CHECK (!c.lookup (a2, value, found));
+
+      BOOST_CHECK (c.save ([] (const string &) { return false; }));
+    }
+
+    {
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      BOOST_CHECK (c.lookup (a, value, found));
+      BOOST_CHECK (!c.lookup (b, value, found));
+    }
+
+    {
+      /* without keep nothing is pruned, and nothing written without
+       * changes */
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      c.put (b, b_fname, "", false);
+      BOOST_CHECK (c.save (NULL));
+    }
+
+    {
+      struct stat before;
+      BOOST_REQUIRE (stat (cache_fname, &before) == 0);
+
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      BOOST_CHECK (c.save (NULL));
+
+      struct stat after;
+      BOOST_REQUIRE (stat (cache_fname, &after) == 0);
+      BOOST_CHECK_EQUAL (before.st_ino, after.st_ino);
+    }
+
+    {
+      FileCache c (cache_fname);
+      BOOST_CHECK (c.load ());
+      BOOST_CHECK (c.lookup (a, value, found));
+      BOOST_CHECK (c.lookup (b, value, found));
+    }
+
+    /* a record pointing out of the string pool */
+    {
+      FILE * f = fopen (cache_fname, "r+b");
+      BOOST_REQUIRE (f != NULL);
+
+      uint32_t off = 0xfffffff0;
+      fseek (f, 8 + 16 + 32, SEEK_SET); /* header, first record: path_off */
+      fwrite (&off, sizeof (off), 1, f);
+      fclose (f);
+
+      FileCache c (cache_fname);
+      BOOST_CHECK (!c.load ());
+    }
+
+    /* a count that overflows the record array */
+    {
+      FILE * f = fopen (cache_fname, "r+b");
+      BOOST_REQUIRE (f != NULL);
+
+      uint64_t count = (1ull << 63) + 1;
+      fseek (f, 8, SEEK_SET);
+      fwrite (&count, sizeof (count), 1, f);
+      fclose (f);
+
+      FileCache c (cache_fname);
+      BOOST_CHECK (!c.load ());
+    }
+
+    unlink (cache_fname);
+    unlink (a_fname);
+    unlink (b_fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
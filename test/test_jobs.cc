@@ -0,0 +1,91 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <fstream>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "jobs.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(JobsTest)
+
+  BOOST_AUTO_TEST_CASE(split)
+  {
+    vector<string> a;
+
+    BOOST_REQUIRE (split_args ("  -m /mail -q \"path:gmail/** and tag:x\" -k  ", a));
+    BOOST_REQUIRE_EQUAL (a.size (), 5);
+    BOOST_CHECK_EQUAL (a[0], "-m");
+    BOOST_CHECK_EQUAL (a[1], "/mail");
+    BOOST_CHECK_EQUAL (a[3], "path:gmail/** and tag:x");
+    BOOST_CHECK_EQUAL (a[4], "-k");
+
+    BOOST_REQUIRE (split_args ("'it''s \"here\"' a\\ b \"\\\"q\\\" \\n\" ''", a));
+    BOOST_REQUIRE_EQUAL (a.size (), 4);
+    BOOST_CHECK_EQUAL (a[0], "its \"here\"");
+    BOOST_CHECK_EQUAL (a[1], "a b");
+    BOOST_CHECK_EQUAL (a[2], "\"q\" \\n");
+    BOOST_CHECK_EQUAL (a[3], "");
+
+    BOOST_CHECK (!split_args ("-q \"unterminated", a));
+    BOOST_CHECK (!split_args ("-q 'unterminated", a));
+    BOOST_CHECK (!split_args ("-q trailing\\", a));
+  }
+
+  BOOST_AUTO_TEST_CASE(load)
+  {
+    char fname[] = "/tmp/test_jobs-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+
+    {
+      ofstream f (fname);
+      f << "# accounts\n"
+        << "\n"
+        << "-m /a -q '*' -k\n"
+        << "   # indented comment\n"
+        << "-m /b -q \"tag:x\" -t -d\n";
+    }
+
+    vector<JobLine> jobs;
+    BOOST_REQUIRE (load_jobs (fname, jobs));
+    BOOST_REQUIRE_EQUAL (jobs.size (), 2);
+    BOOST_CHECK_EQUAL (jobs[0].line, 3);
+    BOOST_CHECK_EQUAL (jobs[0].args.size (), 5);
+    BOOST_CHECK_EQUAL (jobs[0].args[3], "*");
+    BOOST_CHECK_EQUAL (jobs[1].line, 5);
+    BOOST_CHECK_EQUAL (jobs[1].args[3], "tag:x");
+
+    {
+      ofstream f (fname, ios::app);
+      f << "-m /c -q \"broken\n";
+    }
+
+    jobs.clear ();
+    BOOST_CHECK (!load_jobs (fname, jobs));
+
+    unlink (fname);
+
+    jobs.clear ();
+    BOOST_CHECK (!load_jobs (fname, jobs));
+  }
+
+  BOOST_AUTO_TEST_CASE(groups)
+  {
+    vector<vector<size_t>> g = group_jobs ({ "/a", "/b", "/a", "/c", "/b", "/a" });
+
+    BOOST_REQUIRE_EQUAL (g.size (), 3);
+    BOOST_CHECK ((g[0] == vector<size_t> { 0, 2, 5 }));
+    BOOST_CHECK ((g[1] == vector<size_t> { 1, 4 }));
+    BOOST_CHECK ((g[2] == vector<size_t> { 3 }));
+
+    BOOST_CHECK (group_jobs ({}).empty ());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
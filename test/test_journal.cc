@@ -0,0 +1,187 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <fstream>
+# include <sstream>
+# include <cstdlib>
+# include <cstdio>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "journal.hh"
+
+using namespace std;
+
+static string slurp (const string & p) {
+  ifstream f (p, ios::binary);
+  stringstream s;
+  s << f.rdbuf ();
+  return s.str ();
+}
+
+static void spit (const string & p, const string & c) {
+  ofstream f (p, ios::binary | ios::trunc);
+  f << c;
+}
+
+BOOST_AUTO_TEST_SUITE(JournalTest)
+
+  BOOST_AUTO_TEST_CASE(commit_and_recover)
+  {
+    char root_fname[] = "/tmp/test_journal-XXXXXX";
+    BOOST_REQUIRE (mkdtemp (root_fname) != NULL);
+    string root = root_fname;
+    string jdir = root + "/journal";
+
+    BOOST_REQUIRE (mkdir ((root + "/cur").c_str (), 0700) == 0);
+    BOOST_REQUIRE (mkdir ((root + "/new").c_str (), 0700) == 0);
+
+    string a = root + "/cur/a:2,S";
+    string b = root + "/cur/b:2,";
+
+    string old_h = "Subject: a\nX-Keywords: inbox\n\n";
+    string new_h = "Subject: a\nX-Keywords: inbox,work\n\n";
+    string body  = string (10000, 'b');
+
+    spit (a, old_h + body);
+    spit (b, "X-Keywords: one  \n\nbody\n");
+
+    /* group commit */
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      BOOST_CHECK_EQUAL (j.recover (), 0);
+
+      int done = 0;
+      j.rewrite (a, old_h, new_h, body, [&] () { done++; });
+      j.patch (b, 11, " two  ", [&] () { done++; });
+
+      /* nothing written before commit */
+      BOOST_CHECK (slurp (a) == old_h + body);
+      BOOST_CHECK_EQUAL (done, 0);
+
+      j.commit ();
+
+      BOOST_CHECK_EQUAL (done, 2);
+      BOOST_CHECK (slurp (a) == new_h + body);
+      BOOST_CHECK (slurp (b) == "X-Keywords: two  \n\nbody\n");
+      BOOST_CHECK (!j.pending_recovery ());
+    }
+
+    /* crash after the journal was written, with a torn write and a
+     * maildir flag rename in between */
+    spit (a, old_h + body);
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      j.rewrite (a, old_h, new_h, body, NULL);
+      BOOST_CHECK (j.pending_recovery ());
+      /* no commit */
+    }
+
+    spit (a, new_h.substr (0, 30) + (old_h + body).substr (30));
+    string a2 = root + "/cur/a:2,RS";
+    BOOST_REQUIRE (rename (a.c_str (), a2.c_str ()) == 0);
+
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      BOOST_CHECK_EQUAL (j.recover (), 1);
+      BOOST_CHECK (!j.pending_recovery ());
+    }
+
+    BOOST_CHECK (slurp (a2) == new_h + body);
+
+    /* the keywords of the file are changed (e.g. by offlineimap) between
+     * the crash and the recovery: the rewrite is not replayed over them */
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      j.rewrite (a2, new_h, old_h, body, NULL);
+      /* no commit */
+    }
+
+    string remote = "Subject: a\nX-Keywords: three\n\n" + body;
+    spit (a2, remote);
+
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      BOOST_CHECK_EQUAL (j.recover (), 0);
+      BOOST_CHECK (!j.pending_recovery ());
+    }
+
+    BOOST_CHECK (slurp (a2) == remote);
+    spit (a2, new_h + body);
+
+    /* a torn journal record is not replayed */
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      j.patch (b, 11, " three", NULL);
+    }
+
+    string jpath = jdir + "/journal";
+    struct stat st;
+    BOOST_REQUIRE (stat (jpath.c_str (), &st) == 0);
+    BOOST_REQUIRE (truncate (jpath.c_str (), st.st_size - 2) == 0);
+
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      BOOST_CHECK_EQUAL (j.recover (), 0);
+    }
+
+    BOOST_CHECK (slurp (b) == "X-Keywords: two  \n\nbody\n");
+
+    /* the file is replaced by another message between the crash and the
+     * recovery: the patch is not stamped into it */
+    for (string other : { string ("X-Keywords: one  \n\nbody\n") + "longer\n",
+                          string ("Subject: other\n\nbody ab\n") }) {
+      {
+        WriteJournal j (jdir, 10);
+        BOOST_REQUIRE (j.open ());
+        j.patch (b, 11, " four ", NULL);
+        /* no commit */
+      }
+
+      spit (b, other);
+
+      {
+        WriteJournal j (jdir, 10);
+        BOOST_REQUIRE (j.open ());
+        BOOST_CHECK_EQUAL (j.recover (), 0);
+        BOOST_CHECK (!j.pending_recovery ());
+      }
+
+      BOOST_CHECK (slurp (b) == other);
+      spit (b, "X-Keywords: two  \n\nbody\n");
+    }
+
+    /* unchanged file: replayed */
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      j.patch (b, 11, " four ", NULL);
+    }
+
+    {
+      WriteJournal j (jdir, 10);
+      BOOST_REQUIRE (j.open ());
+      BOOST_CHECK_EQUAL (j.recover (), 1);
+    }
+
+    BOOST_CHECK (slurp (b) == "X-Keywords: four \n\nbody\n");
+
+    unlink (a2.c_str ());
+    unlink (b.c_str ());
+    unlink (jpath.c_str ());
+    rmdir (jdir.c_str ());
+    rmdir ((root + "/cur").c_str ());
+    rmdir ((root + "/new").c_str ());
+    rmdir (root.c_str ());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,124 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <sstream>
+# include <vector>
+# include <thread>
+# include <cstdio>
+
+# include "logger.hh"
+
+using namespace std;
+
+static string contents (FILE * f) {
+  fflush (f);
+  rewind (f);
+
+  string s;
+  char   buf[4096];
+  size_t r;
+  while ((r = fread (buf, 1, sizeof (buf), f)) > 0) s.append (buf, r);
+
+  return s;
+}
+
+BOOST_AUTO_TEST_SUITE(LoggerTest)
+
+  BOOST_AUTO_TEST_CASE(order_and_levels)
+  {
+    FILE * f = tmpfile ();
+    BOOST_REQUIRE (f);
+
+    Logger l (8);
+    l.set_level (LEVEL_VERBOSE);
+    l.start (f, f);
+
+    BOOST_CHECK (l.enabled (LEVEL_WARN));
+    BOOST_CHECK (l.enabled (LEVEL_VERBOSE));
+    BOOST_CHECK (!l.enabled (LEVEL_DEBUG));
+
+    /* more lines than the ring holds */
+    for (int i = 0; i < 100; i++) l.write (LEVEL_INFO, "line " + to_string (i));
+    l.write (LEVEL_WARN, "warning");
+    l.write (LEVEL_VERBOSE, "after");
+
+    l.flush ();
+
+    ostringstream e;
+    for (int i = 0; i < 100; i++) e << "line " << i << "\n";
+    e << "warning\nafter\n";
+
+    BOOST_CHECK_EQUAL (contents (f), e.str ());
+
+    l.stop ();
+    fclose (f);
+  }
+
+  BOOST_AUTO_TEST_CASE(not_evaluated)
+  {
+    FILE * f = tmpfile ();
+    BOOST_REQUIRE (f);
+
+    logger.set_level (LEVEL_INFO);
+    logger.start (f, f);
+
+    int evaluated = 0;
+    auto count = [&] () { return ++evaluated; };
+
+    LOG_DEBUG ("debug " << count ());
+    LOG_INFO ("info " << count ());
+
+    logger.stop ();
+
+    BOOST_CHECK_EQUAL (evaluated, 1);
+    BOOST_CHECK_EQUAL (contents (f), "info 1\n");
+
+    fclose (f);
+  }
+
+  BOOST_AUTO_TEST_CASE(threads)
+  {
+    FILE * f = tmpfile ();
+    BOOST_REQUIRE (f);
+
+    Logger l (64);
+    l.start (f, f);
+
+    vector<thread> ts;
+    for (int t = 0; t < 4; t++) {
+      ts.push_back (thread ([&l, t] {
+            for (int i = 0; i < 5000; i++) {
+              l.write (LEVEL_INFO, to_string (t) + ":" + to_string (i));
+            }
+          }));
+    }
+
+    for (auto & t : ts) t.join ();
+
+    /* everything queued is written on stop */
+    l.stop ();
+
+    istringstream s (contents (f));
+    string line;
+    int    last[4] = { -1, -1, -1, -1 };
+    int    n = 0;
+    bool   ordered = true;
+
+    while (getline (s, line)) {
+      int t = stoi (line.substr (0, line.find (':')));
+      int i = stoi (line.substr (line.find (':') + 1));
+
+      if (i != last[t] + 1) ordered = false;
+      last[t] = i;
+      n++;
+    }
+
+    BOOST_CHECK_EQUAL (n, 20000);
+    BOOST_CHECK (ordered);
+
+    fclose (f);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
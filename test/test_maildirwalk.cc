@@ -0,0 +1,85 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <fstream>
+# include <algorithm>
+# include <cstdlib>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "maildirwalk.hh"
+
+using namespace std;
+
+static void set_mtime (const string & p, time_t t) {
+  struct timespec ts[2];
+  ts[0].tv_sec = ts[1].tv_sec = t;
+  ts[0].tv_nsec = ts[1].tv_nsec = 0;
+  BOOST_REQUIRE (utimensat (AT_FDCWD, p.c_str (), ts, 0) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE(MaildirWalkTest)
+
+  BOOST_AUTO_TEST_CASE(changed_files_and_pruning)
+  {
+    char root_fname[] = "/tmp/test_maildirwalk-XXXXXX";
+    BOOST_REQUIRE (mkdtemp (root_fname) != NULL);
+    string root = root_fname;
+
+    vector<string> dirs = { "/a", "/a/cur", "/a/new", "/a/tmp", "/b", "/b/cur", "/b/new", "/b/tmp" };
+    for (auto & d : dirs) BOOST_REQUIRE (mkdir ((root + d).c_str (), 0700) == 0);
+
+    time_t old_t = 1000000000;
+    time_t new_t = 1400000000;
+    time_t threshold = 1300000000;
+
+    /* a/cur: one old, one new file */
+    ofstream (root + "/a/cur/1:2,S") << "X-Keywords: \n\n";
+    ofstream (root + "/a/cur/2:2,S") << "X-Keywords: \n\n";
+    ofstream (root + "/a/tmp/3") << "X-Keywords: \n\n";
+    set_mtime (root + "/a/cur/1:2,S", old_t);
+    set_mtime (root + "/a/cur/2:2,S", new_t);
+    set_mtime (root + "/a/tmp/3", new_t);
+
+    /* b/cur: new file in a directory that looks unchanged */
+    ofstream (root + "/b/cur/4:2,") << "X-Keywords: \n\n";
+    set_mtime (root + "/b/cur/4:2,", new_t);
+
+    for (auto & d : dirs) set_mtime (root + d, old_t);
+    set_mtime (root + "/a/cur", new_t);
+
+    vector<string>   paths;
+    MaildirWalkStats ws;
+
+    BOOST_REQUIRE (maildir_walk (root, threshold, true, paths, ws));
+
+    BOOST_CHECK_EQUAL (paths.size (), 1u);
+    BOOST_CHECK (paths[0] == root + "/a/cur/2:2,S");
+    BOOST_CHECK_EQUAL (ws.files, 2u);
+    BOOST_CHECK_EQUAL (ws.pruned, 3u); /* a/new, b/cur, b/new */
+
+    paths.clear ();
+    ws = MaildirWalkStats ();
+
+    BOOST_REQUIRE (maildir_walk (root, threshold, false, paths, ws));
+
+    sort (paths.begin (), paths.end ());
+    BOOST_CHECK_EQUAL (paths.size (), 2u);
+    BOOST_CHECK_EQUAL (ws.files, 3u);
+    BOOST_CHECK_EQUAL (ws.pruned, 0u);
+
+    BOOST_CHECK (!maildir_walk (root + "/does-not-exist", threshold, true, paths, ws));
+
+    unlink ((root + "/a/cur/1:2,S").c_str ());
+    unlink ((root + "/a/cur/2:2,S").c_str ());
+    unlink ((root + "/a/tmp/3").c_str ());
+    unlink ((root + "/b/cur/4:2,").c_str ());
+    for (auto d = dirs.rbegin (); d != dirs.rend (); d++) rmdir ((root + *d).c_str ());
+    rmdir (root.c_str ());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,130 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <sstream>
+# include <fstream>
+# include <thread>
+# include <vector>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "metrics.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(MetricsTest)
+
+  BOOST_AUTO_TEST_CASE(buckets)
+  {
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (0), 0);
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (1024), 0);
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (1025), 1);
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (2048), 1);
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (2049), 2);
+    BOOST_CHECK_EQUAL (Metrics::bucket_of (1ull << 40), Metrics::BUCKETS - 1);
+
+    for (int b = 0; b < Metrics::BUCKETS - 1; b++) {
+      BOOST_CHECK_EQUAL (Metrics::bucket_of (Metrics::bucket_bound (b)), b);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(record)
+  {
+    Metrics m;
+
+    m.record (PHASE_READ, 500);
+    m.record (PHASE_READ, 3000);
+    m.record (PHASE_PARSE, 100);
+
+    {
+      PhaseTimer t (m, PHASE_DIFF);
+    }
+
+    {
+      PhaseTimer t (m, PHASE_DIFF);
+      t.cancel ();
+    }
+
+    {
+      PhaseTimer t (m, PHASE_QUERY);
+      t.stop ();
+    }
+
+    BOOST_CHECK_EQUAL (m.count (PHASE_READ), 2);
+    BOOST_CHECK_EQUAL (m.total_ns (PHASE_READ), 3500);
+    BOOST_CHECK_EQUAL (m.bucket (PHASE_READ, 0), 1);
+    BOOST_CHECK_EQUAL (m.bucket (PHASE_READ, 2), 1);
+    BOOST_CHECK_EQUAL (m.count (PHASE_PARSE), 1);
+    BOOST_CHECK_EQUAL (m.count (PHASE_DIFF), 1);
+    BOOST_CHECK_EQUAL (m.count (PHASE_QUERY), 1);
+    BOOST_CHECK_EQUAL (m.count (PHASE_STAT), 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(threads)
+  {
+    Metrics m;
+
+    vector<thread> ts;
+    for (int i = 0; i < 4; i++) {
+      ts.push_back (thread ([&] {
+            for (int j = 0; j < 10000; j++) {
+              m.record (PHASE_STAT, 2000);
+              m.add_read (10);
+            }
+          }));
+    }
+
+    for (auto & t : ts) t.join ();
+
+    BOOST_CHECK_EQUAL (m.count (PHASE_STAT), 40000);
+    BOOST_CHECK_EQUAL (m.bucket (PHASE_STAT, 1), 40000);
+    BOOST_CHECK_EQUAL (m.read (), 400000);
+  }
+
+  BOOST_AUTO_TEST_CASE(export_formats)
+  {
+    Metrics m;
+    m.record (PHASE_READ, 1500);
+    m.record (PHASE_READ, 1500000);
+    m.add_read (4096);
+    m.add_written (100);
+
+    ostringstream p;
+    m.write_prometheus (p);
+    string s = p.str ();
+
+    BOOST_CHECK (s.find ("# TYPE keywsync_phase_seconds histogram\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_phase_seconds_bucket{phase=\"read\",le=\"1.024e-06\"} 0\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_phase_seconds_bucket{phase=\"read\",le=\"2.048e-06\"} 1\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_phase_seconds_bucket{phase=\"read\",le=\"+Inf\"} 2\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_phase_seconds_count{phase=\"read\"} 2\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_phase_seconds_count{phase=\"rewrite\"} 0\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_read_bytes_total 4096\n") != string::npos);
+    BOOST_CHECK (s.find ("keywsync_written_bytes_total 100\n") != string::npos);
+
+    ostringstream j;
+    m.write_json (j);
+    s = j.str ();
+
+    BOOST_CHECK (s.find ("\"bytes_read\": 4096") != string::npos);
+    BOOST_CHECK (s.find ("\"read\": { \"count\": 2, \"total_ns\": 1501500, \"max_ns\": 1500000") != string::npos);
+
+    char fname[] = "/tmp/test_metrics-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+
+    BOOST_CHECK (m.save_prometheus (fname));
+
+    ifstream f (fname);
+    stringstream c;
+    c << f.rdbuf ();
+    BOOST_CHECK (c.str ().find ("keywsync_read_bytes_total 4096\n") != string::npos);
+    BOOST_CHECK (access ((string (fname) + ".tmp").c_str (), F_OK) != 0);
+
+    unlink (fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
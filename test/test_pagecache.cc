@@ -0,0 +1,73 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <fstream>
+# include <cstdlib>
+# include <fcntl.h>
+# include <unistd.h>
+
+# include "pagecache.hh"
+# include "xkeywords.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(PageCacheTest)
+
+  BOOST_AUTO_TEST_CASE(accounting)
+  {
+    char fname[] = "/tmp/test_pagecache-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+
+    {
+      ofstream f (fname);
+      f << "Subject: test\nX-Keywords: inbox,work\n\nbody\n" << string (100000, 'b');
+    }
+
+    PageCacheStats  stats;
+    PageCachePolicy policy;
+    policy.drop  = true;
+    policy.stats = &stats;
+
+    /* was cached before: never dropped */
+    policy.was_cached = 4096;
+
+    XKeywordsHeader h;
+    BOOST_REQUIRE (scan_x_keywords (fname, h, &policy));
+    BOOST_CHECK_EQUAL (h.joined (), "inbox,work");
+
+    BOOST_CHECK_EQUAL (stats.files, 1u);
+    BOOST_CHECK (stats.bytes > 0u);
+    BOOST_CHECK (stats.bytes < 100000u); /* only the header block */
+    BOOST_CHECK_EQUAL (stats.cached, stats.bytes);
+    BOOST_CHECK_EQUAL (stats.dropped, 0u);
+    BOOST_CHECK_EQUAL (stats.footprint (), 0u);
+
+    /* was not cached: dropped again */
+    policy.was_cached = 0;
+    BOOST_REQUIRE (scan_x_keywords (fname, h, &policy));
+
+    BOOST_CHECK_EQUAL (stats.files, 2u);
+    BOOST_CHECK_EQUAL (stats.dropped, stats.bytes / 2);
+    BOOST_CHECK_EQUAL (stats.footprint (), 0u);
+
+    /* not dropping */
+    policy.drop = false;
+    BOOST_REQUIRE (scan_x_keywords (fname, h, &policy));
+    BOOST_CHECK_EQUAL (stats.footprint (), stats.bytes / 3);
+
+    /* the cached pages are only checked when dropping */
+    BOOST_CHECK_EQUAL (stats.measured, 2u);
+
+    fd = open (fname, O_RDONLY);
+    BOOST_REQUIRE (fd >= 0);
+    BOOST_CHECK (cached_bytes (fd, 4096) <= 4096u);
+    close (fd);
+
+    unlink (fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
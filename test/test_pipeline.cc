@@ -0,0 +1,203 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <atomic>
+# include <thread>
+# include <stdexcept>
+# include <sys/resource.h>
+
+# include "pipeline.hh"
+# include "xkeywords.hh"
+# include "tokenizer.hh"
+# include "tagset.hh"
+
+using namespace std;
+
+static atomic<long> live { 0 };
+
+struct Job {
+  Job (int n) : n (n) { live++; }
+  ~Job () { live--; }
+
+  int    n;
+  string header;
+  TagSet tags;
+};
+
+static long peak_rss_kb () {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+BOOST_AUTO_TEST_SUITE(PipelineTest)
+
+  BOOST_AUTO_TEST_CASE(in_order)
+  {
+    for (int threads : { 1, 4 }) {
+      vector<int> committed;
+
+      {
+        Pipeline<Job> p (threads, 8,
+            [] (Job & j) { j.n *= 2; },
+            [&] (Job & j) { committed.push_back (j.n); });
+
+        for (int i = 0; i < 1000; i++) p.submit (new Job (i));
+      }
+
+      BOOST_REQUIRE_EQUAL (committed.size (), 1000);
+      for (int i = 0; i < 1000; i++) BOOST_CHECK_EQUAL (committed[i], 2 * i);
+      BOOST_CHECK_EQUAL (live, 0);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(work_error)
+  {
+    for (int threads : { 1, 4 }) {
+      int committed = 0;
+      bool thrown = false;
+
+      try {
+        Pipeline<Job> p (threads, 8,
+            [] (Job & j) { if (j.n == 100) throw runtime_error ("bad message"); },
+            [&] (Job & j) { committed++; });
+
+        for (int i = 0; i < 1000; i++) p.submit (new Job (i));
+        p.finish ();
+
+      } catch (const runtime_error & e) {
+        thrown = true;
+        BOOST_CHECK_EQUAL (e.what (), string ("bad message"));
+      }
+
+      /* jobs after the failing one are never committed, and all freed */
+      BOOST_CHECK (thrown);
+      BOOST_CHECK_EQUAL (committed, 100);
+      BOOST_CHECK_EQUAL (live, 0);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(commit_error)
+  {
+    bool thrown = false;
+
+    try {
+      Pipeline<Job> p (4, 8,
+          [] (Job &) { },
+          [&] (Job & j) { if (j.n == 10) throw runtime_error ("commit failed"); });
+
+      for (int i = 0; i < 1000; i++) p.submit (new Job (i));
+
+    } catch (const runtime_error &) {
+      thrown = true;
+    }
+
+    BOOST_CHECK (thrown);
+    BOOST_CHECK_EQUAL (live, 0);
+  }
+
+  /* several submitting threads (one per database) on one pool */
+  BOOST_AUTO_TEST_CASE(shared_pool)
+  {
+    WorkerPool pool (4);
+    BOOST_CHECK_EQUAL (pool.size (), 4);
+
+    vector<vector<int>> committed (3);
+    vector<thread> submitters;
+
+    for (int s = 0; s < 3; s++) {
+      submitters.push_back (thread ([&, s] {
+            Pipeline<Job> p (&pool, 8,
+                [s] (Job & j) { j.n += s; },
+                [&, s] (Job & j) { committed[s].push_back (j.n); });
+
+            for (int i = 0; i < 1000; i++) p.submit (new Job (i));
+          }));
+    }
+
+    for (auto & t : submitters) t.join ();
+
+    for (int s = 0; s < 3; s++) {
+      BOOST_REQUIRE_EQUAL (committed[s].size (), 1000);
+      for (int i = 0; i < 1000; i++) BOOST_CHECK_EQUAL (committed[s][i], i + s);
+    }
+
+    /* a failing pipeline does not stop the pool */
+    bool thrown = false;
+    try {
+      Pipeline<Job> p (&pool, 8,
+          [] (Job & j) { if (j.n == 10) throw runtime_error ("bad message"); },
+          [] (Job &) { });
+
+      for (int i = 0; i < 1000; i++) p.submit (new Job (i));
+      p.finish ();
+    } catch (const runtime_error &) {
+      thrown = true;
+    }
+
+    BOOST_CHECK (thrown);
+
+    int after = 0;
+    {
+      Pipeline<Job> p (&pool, 8, [] (Job &) { }, [&] (Job &) { after++; });
+      for (int i = 0; i < 100; i++) p.submit (new Job (i));
+    }
+
+    BOOST_CHECK_EQUAL (after, 100);
+    BOOST_CHECK_EQUAL (live, 0);
+  }
+
+  /* long run: the per-message path (header scan, keyword split, tag sets)
+   * through the pipeline must not grow with the number of messages. */
+  BOOST_AUTO_TEST_CASE(constant_memory)
+  {
+    const char * keywords[] = {
+      "\\Inbox,\\Important",
+      "\\Sent,lists/notmuch,lists/sup-talk",
+      "\\Inbox,todo,work/project-a,work/project-b",
+      "",
+    };
+
+    TagDict dict;
+    TagSet  db_tags = dict.set ({ "inbox", "todo" });
+
+    long changed = 0;
+
+    auto run = [&] (int from, int to) {
+      Pipeline<Job> p (4, 64,
+          [&] (Job & j) {
+            j.header = "From: a@example.com\nSubject: message " + to_string (j.n) +
+                       "\nX-Keywords: " + keywords[j.n % 4] + "\n\n";
+
+            XKeywordsHeader h;
+            scan_x_keywords (j.header.data (), j.header.size (), h);
+
+            string scratch;
+            split_keywords (h.joined (), scratch, [&] (boost::string_view k) {
+                j.tags.add (dict.intern (string (k.data (), k.size ())));
+              });
+          },
+          [&] (Job & j) {
+            if (!(j.tags - db_tags).empty ()) changed++;
+          });
+
+      for (int i = from; i < to; i++) p.submit (new Job (i));
+    };
+
+    run (0, 10000);
+    long rss_10k = peak_rss_kb ();
+
+    run (10000, 1000000);
+    long rss_1m = peak_rss_kb ();
+
+    BOOST_TEST_MESSAGE ("peak rss: 10k messages: " << rss_10k << " KiB, 1M messages: " << rss_1m << " KiB");
+
+    BOOST_CHECK_EQUAL (live, 0);
+    BOOST_CHECK (changed > 0);
+    BOOST_CHECK_LT (rss_1m - rss_10k, 4096);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
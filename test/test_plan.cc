@@ -0,0 +1,132 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <sstream>
+# include <fstream>
+# include <cstdlib>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "plan.hh"
+
+using namespace std;
+
+static string tmp_path () {
+  char fname[] = "/tmp/test_plan-XXXXXX";
+  int fd = mkstemp (fname);
+  close (fd);
+  unlink (fname);
+
+  return fname;
+}
+
+BOOST_AUTO_TEST_SUITE(PlanTest)
+
+  BOOST_AUTO_TEST_CASE(roundtrip)
+  {
+    string fname = tmp_path ();
+
+    struct stat st;
+    BOOST_REQUIRE (stat ("/tmp", &st) == 0);
+
+    {
+      Plan p;
+      p.db_path            = "/home/a/.mail";
+      p.uuid               = "0a1b2c";
+      p.revision           = 42;
+      p.direction          = 2;
+      p.x_keywords_padding = 60;
+      p.flags              = Plan::PARANOID;
+      p.journal_dir        = "/home/a/.mail/.notmuch/keywsync-journal";
+
+      p.add_message ("a@example.com", { "inbox", "todo" }, { "unread" });
+      p.add_message ("b@example.com", { }, { "todo" });
+      p.add_file ("/tmp", "a@example.com", st, "\\Inbox,todo");
+
+      /* tags are only stored once */
+      BOOST_CHECK_EQUAL (p.tags.size (), 3);
+
+      BOOST_CHECK (p.save (fname));
+    }
+
+    {
+      Plan p;
+      BOOST_REQUIRE (p.load (fname));
+
+      BOOST_CHECK_EQUAL (p.db_path, "/home/a/.mail");
+      BOOST_CHECK_EQUAL (p.uuid, "0a1b2c");
+      BOOST_CHECK_EQUAL (p.revision, 42ul);
+      BOOST_CHECK_EQUAL (p.direction, 2);
+      BOOST_CHECK_EQUAL (p.x_keywords_padding, 60);
+      BOOST_CHECK_EQUAL (p.flags, Plan::PARANOID);
+      BOOST_CHECK (p.add_x_keyw_path.empty ());
+
+      BOOST_REQUIRE_EQUAL (p.messages.size (), 2);
+      BOOST_CHECK_EQUAL (p.messages[0].id, "a@example.com");
+      BOOST_REQUIRE_EQUAL (p.messages[0].add.size (), 2);
+      BOOST_CHECK_EQUAL (p.tags[p.messages[0].add[1]], "todo");
+      BOOST_REQUIRE_EQUAL (p.messages[1].rem.size (), 1);
+      BOOST_CHECK_EQUAL (p.tags[p.messages[1].rem[0]], "todo");
+
+      BOOST_REQUIRE_EQUAL (p.files.size (), 1);
+      BOOST_CHECK_EQUAL (p.files[0].id, "a@example.com");
+      BOOST_CHECK_EQUAL (p.files[0].keywords, "\\Inbox,todo");
+      BOOST_CHECK (p.files[0].unchanged (st));
+
+      struct stat other = st;
+      other.st_mtim.tv_nsec++;
+      BOOST_CHECK (!p.files[0].unchanged (other));
+
+      /* ids of a loaded plan continue its tag table */
+      p.add_message ("c@example.com", { "todo", "new" }, { });
+      BOOST_CHECK_EQUAL (p.tags.size (), 4);
+      BOOST_CHECK_EQUAL (p.messages[2].add[0], p.messages[0].add[1]);
+    }
+
+    unlink (fname.c_str ());
+  }
+
+  BOOST_AUTO_TEST_CASE(invalid)
+  {
+    string fname = tmp_path ();
+
+    Plan p;
+    BOOST_CHECK (!p.load (fname));
+
+    {
+      ofstream f (fname);
+      f << "not a plan";
+    }
+    BOOST_CHECK (!p.load (fname));
+
+    /* truncated */
+    p.add_message ("a@example.com", { "inbox" }, { });
+    BOOST_REQUIRE (p.save (fname));
+    BOOST_REQUIRE (truncate (fname.c_str (), 30) == 0);
+
+    Plan q;
+    BOOST_CHECK (!q.load (fname));
+    BOOST_CHECK (q.messages.empty ());
+
+    unlink (fname.c_str ());
+  }
+
+  BOOST_AUTO_TEST_CASE(batch)
+  {
+    Plan p;
+    p.add_message ("a@example.com", { "inbox", "lists/notmuch" }, { "un read" });
+    p.add_message ("b@example.com", { }, { });
+    p.add_message ("c 100%@example.com", { }, { "todo" });
+
+    ostringstream o;
+    p.write_batch (o);
+
+    BOOST_CHECK_EQUAL (o.str (),
+        "# keywsync plan: 3 messages\n"
+        "+inbox +lists%2fnotmuch -un%20read -- id:a@example.com\n"
+        "-todo -- id:c%20100%25@example.com\n");
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,96 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <fstream>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "rules.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(RulesTest)
+
+  BOOST_AUTO_TEST_CASE(builtin)
+  {
+    Rules r;
+
+    BOOST_CHECK_EQUAL (r.to_tag ("\\Inbox"), "inbox");
+    BOOST_CHECK_EQUAL (r.to_keyword ("inbox"), "\\Inbox");
+    BOOST_CHECK_EQUAL (r.to_tag ("foo/bar"), "foo/bar");
+
+    Rules rr;
+    rr.enable_replace_chars = true;
+    BOOST_CHECK_EQUAL (rr.to_tag ("foo/bar"), "foo.bar");
+    BOOST_CHECK_EQUAL (rr.to_keyword ("foo.bar"), "foo/bar");
+  }
+
+  BOOST_AUTO_TEST_CASE(from_file)
+  {
+    char fname[] = "/tmp/test_rules-XXXXXX";
+    close (mkstemp (fname));
+
+    {
+      ofstream f (fname);
+      f << "# comment" << endl;
+      f << "ignore unread" << endl;
+      f << "map \\Starred flagged  # trailing comment" << endl;
+      f << "replace / ." << endl;
+      f << "prefix [Gmail]/ gmail." << endl;
+    }
+
+    Rules r;
+    BOOST_REQUIRE (r.load (fname));
+    r.enable_replace_chars = true;
+
+    BOOST_CHECK_EQUAL (r.ignored ().size (), 1);
+    BOOST_CHECK_EQUAL (r.to_tag ("\\Starred"), "flagged");
+    BOOST_CHECK_EQUAL (r.to_tag ("\\Inbox"), "\\Inbox");
+    BOOST_CHECK_EQUAL (r.to_tag ("[Gmail]/Sent/Old"), "gmail.Sent.Old");
+    BOOST_CHECK_EQUAL (r.to_keyword ("gmail.Sent.Old"), "[Gmail]/Sent/Old");
+
+    {
+      ofstream f (fname);
+      f << "map \"[Gmail]/Sent Mail\" sent" << endl;
+      f << "map 'Old Stuff' \"old \\\"stuff\\\"\"" << endl;
+      f << "map \"\\Important\" important" << endl;
+    }
+
+    BOOST_REQUIRE (r.load (fname));
+    BOOST_CHECK_EQUAL (r.to_tag ("[Gmail]/Sent Mail"), "sent");
+    BOOST_CHECK_EQUAL (r.to_keyword ("sent"), "[Gmail]/Sent Mail");
+    BOOST_CHECK_EQUAL (r.to_tag ("Old Stuff"), "old \"stuff\"");
+    BOOST_CHECK_EQUAL (r.to_tag ("\\Important"), "important");
+
+    /* a '#' in quotes is part of the keyword */
+    {
+      ofstream f (fname);
+      f << "map \"C# code\" csharp # comment" << endl;
+      f << "map '#urgent' urgent" << endl;
+    }
+
+    BOOST_REQUIRE (r.load (fname));
+    BOOST_CHECK_EQUAL (r.to_tag ("C# code"), "csharp");
+    BOOST_CHECK_EQUAL (r.to_keyword ("csharp"), "C# code");
+    BOOST_CHECK_EQUAL (r.to_tag ("#urgent"), "urgent");
+
+    {
+      ofstream f (fname);
+      f << "map onlyone" << endl;
+    }
+
+    BOOST_CHECK (!r.load (fname));
+
+    {
+      ofstream f (fname);
+      f << "map \"unterminated sent" << endl;
+    }
+
+    BOOST_CHECK (!r.load (fname));
+
+    unlink (fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,59 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "state.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(SyncStateTest)
+
+  BOOST_AUTO_TEST_CASE(roundtrip)
+  {
+    char fname[] = "/tmp/test_state-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+    close (fd);
+    unlink (fname);
+
+    SyncState::Entry e;
+
+    {
+      SyncState s (fname);
+      BOOST_CHECK (s.load ());
+      BOOST_CHECK (!s.get ("tag-to-keyword:*", e));
+
+      e.uuid     = "0a1b2c";
+      e.revision = 42;
+      e.time     = 1400000000;
+      s.set ("tag-to-keyword:path:a/** AND tag:x", e);
+
+      e.revision = 7;
+      s.set ("keyword-to-tag:*", e);
+
+      BOOST_CHECK (s.save ());
+    }
+
+    {
+      SyncState s (fname);
+      BOOST_CHECK (s.load ());
+
+      BOOST_REQUIRE (s.get ("tag-to-keyword:path:a/** AND tag:x", e));
+      BOOST_CHECK_EQUAL (e.uuid, "0a1b2c");
+      BOOST_CHECK_EQUAL (e.revision, 42ul);
+      BOOST_CHECK_EQUAL (e.time, 1400000000);
+
+      BOOST_REQUIRE (s.get ("keyword-to-tag:*", e));
+      BOOST_CHECK_EQUAL (e.revision, 7ul);
+
+      BOOST_CHECK (!s.get ("keyword-to-tag:tag:inbox", e));
+    }
+
+    unlink (fname);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
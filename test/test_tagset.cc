@@ -0,0 +1,49 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+
+# include "tagset.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(TagSetTest)
+
+  BOOST_AUTO_TEST_CASE(intern)
+  {
+    TagDict d;
+    BOOST_CHECK_EQUAL (d.intern ("inbox"), 0);
+    BOOST_CHECK_EQUAL (d.intern ("sent"), 1);
+    BOOST_CHECK_EQUAL (d.intern ("inbox"), 0);
+    BOOST_CHECK_EQUAL (d.name (1), "sent");
+    BOOST_CHECK_EQUAL (d.size (), 2);
+  }
+
+  BOOST_AUTO_TEST_CASE(operations)
+  {
+    TagDict d;
+    for (int i = 0; i < 200; i++) d.intern ("tag" + to_string (i));
+
+    TagSet a = d.set ({ "tag1", "tag70", "tag150" });
+    TagSet b = d.set ({ "tag1", "tag150", "tag199" });
+
+    BOOST_CHECK_EQUAL ((a - b).size (), 1);
+    BOOST_CHECK ((a - b).has (d.intern ("tag70")));
+    BOOST_CHECK_EQUAL ((a | b).size (), 4);
+    BOOST_CHECK_EQUAL ((a & b).size (), 2);
+
+    /* difference trims, so that equal sets compare equal */
+    TagSet c = b - d.set ({ "tag199" });
+    BOOST_CHECK (c == (a & b));
+    BOOST_CHECK ((b - b).empty ());
+
+    vector<string> n = d.names (a);
+    BOOST_CHECK_EQUAL (n.size (), 3);
+    BOOST_CHECK_EQUAL (n[0], "tag1");
+    BOOST_CHECK_EQUAL (n[1], "tag150");
+    BOOST_CHECK_EQUAL (n[2], "tag70");
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
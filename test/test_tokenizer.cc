@@ -0,0 +1,60 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+
+# include "tokenizer.hh"
+
+using namespace std;
+
+static vector<string> split (const string & s) {
+  vector<string> r;
+  string scratch;
+  split_keywords (s, scratch, [&] (boost::string_view k) {
+      r.push_back (string (k.data (), k.size ()));
+    });
+
+  return r;
+}
+
+BOOST_AUTO_TEST_SUITE(TokenizerTest)
+
+  BOOST_AUTO_TEST_CASE(plain)
+  {
+    vector<string> r = split ("\\Inbox,\\Important , foo/bar,,  baz  ");
+    BOOST_REQUIRE_EQUAL (r.size (), 4);
+    BOOST_CHECK_EQUAL (r[0], "\\Inbox");
+    BOOST_CHECK_EQUAL (r[1], "\\Important");
+    BOOST_CHECK_EQUAL (r[2], "foo/bar");
+    BOOST_CHECK_EQUAL (r[3], "baz");
+
+    BOOST_CHECK (split ("").empty ());
+    BOOST_CHECK (split (" , ").empty ());
+  }
+
+  BOOST_AUTO_TEST_CASE(quoted)
+  {
+    vector<string> r = split ("a, \"b, c\" ,\" d \",\"e\\\"f\\\\\",\"unterminated");
+    BOOST_REQUIRE_EQUAL (r.size (), 5);
+    BOOST_CHECK_EQUAL (r[0], "a");
+    BOOST_CHECK_EQUAL (r[1], "b, c");
+    BOOST_CHECK_EQUAL (r[2], " d ");
+    BOOST_CHECK_EQUAL (r[3], "e\"f\\");
+    BOOST_CHECK_EQUAL (r[4], "unterminated");
+  }
+
+  BOOST_AUTO_TEST_CASE(quote_roundtrip)
+  {
+    BOOST_CHECK_EQUAL (quote_keyword ("\\Inbox"), "\\Inbox");
+    BOOST_CHECK_EQUAL (quote_keyword ("with space"), "with space");
+
+    for (string k : { "b, c", " d ", "e\"f\\", "\"q" }) {
+      vector<string> r = split (quote_keyword (k));
+      BOOST_REQUIRE_EQUAL (r.size (), 1);
+      BOOST_CHECK_EQUAL (r[0], k);
+    }
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,82 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <vector>
+# include <fstream>
+# include <cstdlib>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "uring.hh"
+# include "xkeywords.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(UringTest)
+
+  BOOST_AUTO_TEST_CASE(read_headers)
+  {
+    UringReader u (4, 64);
+
+    if (!u.init ()) {
+      BOOST_TEST_MESSAGE ("io_uring not available, skipping.");
+      return;
+    }
+
+    char dir_fname[] = "/tmp/test_uring-XXXXXX";
+    BOOST_REQUIRE (mkdtemp (dir_fname) != NULL);
+    string dir = dir_fname;
+
+    /* more files than the queue depth, headers shorter and longer
+     * than a chunk */
+    vector<HeaderRead>   reads (10);
+    vector<HeaderRead *> ptrs;
+
+    for (size_t i = 0; i < reads.size (); i++) {
+      reads[i].path = dir + "/" + to_string (i);
+
+      ofstream f (reads[i].path);
+      f << "Subject: " << string (i * 20, 's') << "\n";
+      f << "X-Keywords: k" << i << "\n";
+      f << "\nbody\n" << string (1000, 'b');
+      f.close ();
+
+      ptrs.push_back (&reads[i]);
+    }
+
+    HeaderRead missing;
+    missing.path = dir + "/missing";
+    ptrs.push_back (&missing);
+
+    BOOST_CHECK (u.stat (ptrs));
+    BOOST_CHECK (u.read (ptrs));
+
+    BOOST_CHECK (!missing.stat_ok);
+    BOOST_CHECK (!missing.read_ok);
+
+    for (size_t i = 0; i < reads.size (); i++) {
+      struct stat st;
+      BOOST_REQUIRE (stat (reads[i].path.c_str (), &st) == 0);
+
+      BOOST_CHECK (reads[i].stat_ok);
+      BOOST_CHECK_EQUAL (reads[i].st.st_ino, st.st_ino);
+      BOOST_CHECK_EQUAL (reads[i].st.st_size, st.st_size);
+      BOOST_CHECK_EQUAL (reads[i].st.st_mtim.tv_nsec, st.st_mtim.tv_nsec);
+
+      BOOST_CHECK (reads[i].read_ok);
+      BOOST_CHECK ((off_t) reads[i].buf.size () < st.st_size);
+
+      XKeywordsHeader h;
+      scan_x_keywords (reads[i].buf.data (), reads[i].buf.size (), h);
+      BOOST_CHECK (h.found);
+      BOOST_CHECK_EQUAL (h.joined (), "k" + to_string (i));
+
+      unlink (reads[i].path.c_str ());
+    }
+
+    rmdir (dir.c_str ());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
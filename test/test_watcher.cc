@@ -0,0 +1,62 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <set>
+# include <fstream>
+# include <cstdlib>
+# include <unistd.h>
+# include <sys/stat.h>
+
+# include "watcher.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(WatcherTest)
+
+  BOOST_AUTO_TEST_CASE(coalesce_writes_and_moves)
+  {
+    char root_fname[] = "/tmp/test_watcher-XXXXXX";
+    BOOST_REQUIRE (mkdtemp (root_fname) != NULL);
+    string root = root_fname;
+
+    string box = root + "/gmail";
+    BOOST_REQUIRE (mkdir (box.c_str (), 0700) == 0);
+    for (auto d : { "/cur", "/new", "/tmp" }) {
+      BOOST_REQUIRE (mkdir ((box + d).c_str (), 0700) == 0);
+    }
+
+    MaildirWatcher w (root);
+    BOOST_REQUIRE (w.start ());
+    BOOST_CHECK_EQUAL (w.watches (), 4u); /* root, gmail, cur and new */
+
+    string a = box + "/cur/a:2,S";
+    string b = box + "/new/b";
+
+    /* written twice, reported once */
+    ofstream (a) << "X-Keywords: inbox\n\nbody\n";
+    ofstream (a) << "X-Keywords: inbox,work\n\nbody\n";
+
+    /* delivered through tmp/ */
+    ofstream (box + "/tmp/b") << "X-Keywords: \n\nbody\n";
+    BOOST_REQUIRE (rename ((box + "/tmp/b").c_str (), b.c_str ()) == 0);
+
+    set<string> paths;
+    bool overflow;
+    BOOST_REQUIRE (w.wait (paths, overflow, 50));
+
+    BOOST_CHECK (!overflow);
+    BOOST_CHECK_EQUAL (paths.size (), 2u);
+    BOOST_CHECK (paths.count (a) == 1);
+    BOOST_CHECK (paths.count (b) == 1);
+
+    unlink (a.c_str ());
+    unlink (b.c_str ());
+    for (auto d : { "/cur", "/new", "/tmp", "" }) {
+      rmdir ((box + d).c_str ());
+    }
+    rmdir (root.c_str ());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,72 @@
+# define BOOST_TEST_DYN_LINK
+# include <boost/test/unit_test.hpp>
+
+# include <string>
+# include <cstdlib>
+# include <unistd.h>
+
+# include "xkeywords.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(XKeywordsScanner)
+
+  BOOST_AUTO_TEST_CASE(simple_header)
+  {
+    string m = "From: a@b\nX-Keywords: inbox,\\Important\nSubject: x\n\nbody\nX-Keywords: not-a-header\n";
+    XKeywordsHeader h;
+    scan_x_keywords (m.data (), m.size (), h);
+
+    BOOST_CHECK (h.found);
+    BOOST_CHECK_EQUAL (h.fields.size (), 1);
+    BOOST_CHECK_EQUAL (h.fields[0].value, "inbox,\\Important");
+    BOOST_CHECK_EQUAL (h.header_end, m.find ("body"));
+    BOOST_CHECK_EQUAL (m.substr (h.fields[0].value_begin, h.fields[0].value_end - h.fields[0].value_begin), " inbox,\\Important");
+  }
+
+  BOOST_AUTO_TEST_CASE(folded_and_case)
+  {
+    string m = "x-keywords  : one,\r\n\ttwo\r\nX-KEYWORDS: three\r\n\r\nbody";
+    XKeywordsHeader h;
+    scan_x_keywords (m.data (), m.size (), h);
+
+    BOOST_CHECK (h.found);
+    BOOST_CHECK_EQUAL (h.fields.size (), 2);
+    BOOST_CHECK_EQUAL (h.fields[0].value, "one,\ttwo");
+    BOOST_CHECK_EQUAL (h.fields[1].value, "three");
+    BOOST_CHECK_EQUAL (h.joined (), "one,\ttwo,three");
+    BOOST_CHECK_EQUAL (m[h.fields[0].value_end], '\r');
+  }
+
+  BOOST_AUTO_TEST_CASE(no_header)
+  {
+    string m = "From: a@b\nX-Keywordsfoo: bar\n\nX-Keywords: body\n";
+    XKeywordsHeader h;
+    scan_x_keywords (m.data (), m.size (), h);
+
+    BOOST_CHECK (!h.found);
+  }
+
+  BOOST_AUTO_TEST_CASE(from_file)
+  {
+    char fname[] = "/tmp/test_xkeywords-XXXXXX";
+    int fd = mkstemp (fname);
+    BOOST_REQUIRE (fd >= 0);
+
+    /* header larger than one read chunk */
+    string m = "Subject: " + string (10000, 'a') + "\nX-Keywords: a,b\n\n" + string (10000, 'b');
+    BOOST_REQUIRE (write (fd, m.data (), m.size ()) == (ssize_t) m.size ());
+    close (fd);
+
+    XKeywordsHeader h;
+    BOOST_CHECK (scan_x_keywords (fname, h));
+    BOOST_CHECK (h.found);
+    BOOST_CHECK_EQUAL (h.joined (), "a,b");
+
+    unlink (fname);
+
+    BOOST_CHECK (!scan_x_keywords (fname, h));
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
+
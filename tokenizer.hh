@@ -0,0 +1,159 @@
+# pragma once
+
+/* X-Keywords tokenizer
+ *
+ * splits the value of an X-Keywords header on ',' without allocating:
+ * keywords are passed to the callback as views into the header. whitespace
+ * around keywords is trimmed and empty keywords are skipped.
+ *
+ * a keyword may be quoted ("foo, bar") to contain ',' or leading or
+ * trailing whitespace, in a quoted keyword '\' escapes the next char.
+ * only quoted keywords with escapes are copied (into scratch).
+ *
+ * job and rule file lines are split into arguments by split_args.
+ */
+
+# include <string>
+# include <vector>
+# include <boost/utility/string_view.hpp>
+
+using namespace std;
+
+inline bool keyword_space (char c) {
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+template<class F> void split_keywords (boost::string_view s, string & scratch, F emit) {
+  size_t n = s.size ();
+  size_t i = 0;
+
+  while (i < n) {
+    while (i < n && keyword_space (s[i])) i++;
+    if (i >= n) break;
+
+    if (s[i] == '"') {
+      /* quoted keyword */
+      size_t b = ++i;
+      bool escaped = false;
+
+      while (i < n && s[i] != '"') {
+        if (s[i] == '\\' && i + 1 < n) {
+          escaped = true;
+          i++;
+        }
+        i++;
+      }
+
+      boost::string_view k = s.substr (b, i - b);
+
+      if (escaped) {
+        scratch.clear ();
+        for (size_t j = 0; j < k.size (); j++) {
+          if (k[j] == '\\' && j + 1 < k.size ()) j++;
+          scratch.push_back (k[j]);
+        }
+
+        k = scratch;
+      }
+
+      if (!k.empty ()) emit (k);
+
+      /* skip anything up to the next separator */
+      while (i < n && s[i] != ',') i++;
+      i++;
+
+    } else {
+      size_t b = i;
+      while (i < n && s[i] != ',') i++;
+
+      size_t e = i;
+      while (e > b && keyword_space (s[e-1])) e--;
+
+      if (e > b) emit (s.substr (b, e - b));
+      i++;
+    }
+  }
+}
+
+/* quote keyword if it can not be written as is */
+inline string quote_keyword (const string & k) {
+  bool quote = k.empty () ||
+               keyword_space (k.front ()) ||
+               keyword_space (k.back ()) ||
+               k.front () == '"' ||
+               k.find (',') != string::npos;
+
+  if (!quote) return k;
+
+  string q = "\"";
+  for (char c : k) {
+    if (c == '"' || c == '\\') q.push_back ('\\');
+    q.push_back (c);
+  }
+  q.push_back ('"');
+
+  return q;
+}
+
+/* split a line into arguments like a shell would (quotes and backslashes),
+ * returns false on an unterminated quote or a trailing backslash. without
+ * escapes a backslash outside of quotes is kept as is (rule files, for
+ * keywords like \Inbox). with comments a '#' outside of quotes ends the
+ * line. */
+inline bool split_args (const string & line, vector<string> & args, bool escapes = true, bool comments = false) {
+  args.clear ();
+
+  string a;
+  bool   in_arg = false;
+  char   quote  = 0;
+
+  for (size_t i = 0; i < line.size (); i++) {
+    char ch = line[i];
+
+    if (quote == '\'') {
+      /* nothing is special until the closing quote */
+      if (ch == '\'') quote = 0;
+      else a += ch;
+
+    } else if (ch == '\\' && (escapes || quote == '"')) {
+      if (++i == line.size ()) return false;
+
+      /* in double quotes only a few characters are escaped */
+      if (quote == '"' && line[i] != '"' && line[i] != '\\' && line[i] != '$' && line[i] != '`') {
+        a += '\\';
+      }
+
+      a += line[i];
+      in_arg = true;
+
+    } else if (quote == '"') {
+      if (ch == '"') quote = 0;
+      else a += ch;
+
+    } else if (ch == '#' && comments) {
+      break;
+
+    } else if (ch == '"' || ch == '\'') {
+      quote  = ch;
+      in_arg = true;
+
+    } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+      if (in_arg) {
+        args.push_back (a);
+        a.clear ();
+        in_arg = false;
+      }
+
+    } else {
+      a += ch;
+      in_arg = true;
+    }
+  }
+
+  if (quote) return false;
+
+  if (in_arg) args.push_back (a);
+
+  return true;
+}
+
@@ -0,0 +1,414 @@
+# include "uring.hh"
+# include "xkeywords.hh"
+# include "logger.hh"
+
+# include <iostream>
+# include <string>
+# include <vector>
+# include <cstring>
+# include <cerrno>
+
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+
+# ifdef HAVE_IO_URING
+# include <linux/io_uring.h>
+# endif
+
+using namespace std;
+
+struct UringReader::Op {
+  int         opcode;
+  size_t      file;   /* index of r in the batch */
+  HeaderRead * r;
+  int         fd;
+  off_t       offset;
+  size_t      len;
+  void *      ptr;
+
+  int         res;
+};
+
+UringReader::UringReader (unsigned int depth, size_t chunk) :
+  depth (depth > 0 ? depth : 1),
+  chunk (chunk)
+{
+}
+
+UringReader::~UringReader () {
+  if (sqes_ptr) munmap (sqes_ptr, sqes_size);
+  if (cq_ptr && cq_ptr != sq_ptr) munmap (cq_ptr, cq_size);
+  if (sq_ptr) munmap (sq_ptr, sq_size);
+  if (ring_fd >= 0) close (ring_fd);
+}
+
+# ifdef HAVE_IO_URING
+
+bool UringReader::init () {
+  struct io_uring_params p;
+  memset (&p, 0, sizeof (p));
+
+  ring_fd = syscall (__NR_io_uring_setup, depth, &p);
+  if (ring_fd < 0) return false;
+
+  /* the opcodes are only checked when submitted: on a kernel without
+   * them (before 5.6) every request would fail instead of falling back
+   * to blocking reads */
+  {
+    const unsigned n = 256;
+    vector<char> buf (sizeof (struct io_uring_probe) + n * sizeof (struct io_uring_probe_op), 0);
+    struct io_uring_probe * probe = (struct io_uring_probe *) buf.data ();
+
+    if (syscall (__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, n) < 0) return false;
+
+    for (int op : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE }) {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+  }
+
+  depth = p.sq_entries;
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_size > sq_size) sq_size = cq_size;
+    cq_size = sq_size;
+  }
+
+  sq_ptr = mmap (NULL, sq_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) { sq_ptr = NULL; return false; }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap (NULL, cq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) { cq_ptr = NULL; return false; }
+  }
+
+  sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  sqes_ptr = mmap (NULL, sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED) { sqes_ptr = NULL; return false; }
+
+  char * sq = (char *) sq_ptr;
+  char * cq = (char *) cq_ptr;
+
+  sq_head  = (unsigned *) (sq + p.sq_off.head);
+  sq_tail  = (unsigned *) (sq + p.sq_off.tail);
+  sq_mask  = (unsigned *) (sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *) (sq + p.sq_off.array);
+  cq_head  = (unsigned *) (cq + p.cq_off.head);
+  cq_tail  = (unsigned *) (cq + p.cq_off.tail);
+  cq_mask  = (unsigned *) (cq + p.cq_off.ring_mask);
+  cqes     = cq + p.cq_off.cqes;
+
+  return true;
+}
+
+bool UringReader::run (vector<Op> & ops, function<void(size_t, vector<Op> &)> next_op) {
+  /* submit all ops, keeping at most depth in flight, and wait for all
+   * completions. results are stored in op.res. each completion is passed
+   * to next_op (if set) as it arrives, which may append the next op of
+   * the file. false if io_uring failed, the ops not run get -ECANCELED. */
+  chrono::time_point<chrono::steady_clock> t0 = chrono::steady_clock::now ();
+
+  struct io_uring_sqe * sqes = (struct io_uring_sqe *) sqes_ptr;
+  struct io_uring_cqe * cqe  = (struct io_uring_cqe *) cqes;
+
+  size_t   next = 0;
+  size_t   completed = 0;
+  unsigned inflight = 0;
+
+  bool failed = false;
+
+  while (completed < ops.size ()) {
+    /* fill submission queue */
+    unsigned tail = *sq_tail;
+
+    while (!failed && next < ops.size () && inflight < depth) {
+      Op & o = ops[next];
+      o.res = -ECANCELED;
+      unsigned idx = tail & *sq_mask;
+      struct io_uring_sqe * s = &sqes[idx];
+
+      memset (s, 0, sizeof (*s));
+      s->opcode    = o.opcode;
+      s->user_data = next;
+
+      switch (o.opcode) {
+        case IORING_OP_STATX:
+          s->fd          = AT_FDCWD;
+          s->addr        = (uint64_t) o.r->path.c_str ();
+          s->len         = STATX_BASIC_STATS;
+          s->off         = (uint64_t) o.ptr;
+          s->statx_flags = AT_STATX_SYNC_AS_STAT;
+          break;
+
+        case IORING_OP_OPENAT:
+          s->fd         = AT_FDCWD;
+          s->addr       = (uint64_t) o.r->path.c_str ();
+          s->open_flags = O_RDONLY | O_CLOEXEC;
+          break;
+
+        case IORING_OP_READ:
+          s->fd   = o.fd;
+          s->addr = (uint64_t) o.ptr;
+          s->len  = o.len;
+          s->off  = o.offset;
+          break;
+
+        case IORING_OP_CLOSE:
+          s->fd = o.fd;
+          break;
+      }
+
+      sq_array[idx] = idx;
+      tail++;
+      next++;
+      inflight++;
+    }
+
+    __atomic_store_n (sq_tail, tail, __ATOMIC_RELEASE);
+
+    /* including any left over from an interrupted call, none once
+     * failed: only wait for the requests in flight */
+    unsigned to_submit = (failed ? 0 : tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE));
+
+    if (inflight > max_inflight) max_inflight = inflight;
+
+    int r = syscall (__NR_io_uring_enter, ring_fd, to_submit, 1,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+    enters++;
+
+    if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      if (failed) {
+        /* the kernel may still write into the buffers of the requests in
+         * flight, the callers leak them (see lost) */
+        LOG_ERROR ("uring: io_uring_enter failed: " << strerror (errno) << ", " << inflight << " requests lost.");
+        lost = true;
+        break;
+      }
+
+      /* stop submitting and wait for the requests in flight before any
+       * of their buffers may be freed, the queued ones are taken back */
+      LOG_ERROR ("uring: io_uring_enter failed: " << strerror (errno));
+
+      unsigned queued = tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+      __atomic_store_n (sq_tail, tail - queued, __ATOMIC_RELEASE);
+
+      for (size_t i = next; i < ops.size (); i++) ops[i].res = -ECANCELED;
+
+      failed     = true;
+      inflight  -= queued;
+      completed += queued + (ops.size () - next);
+      next       = ops.size ();
+    }
+
+    /* reap completions */
+    unsigned head = *cq_head;
+    while (head != __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe & c = cqe[head & *cq_mask];
+      ops[c.user_data].res = c.res;
+
+      head++;
+      inflight--;
+      completed++;
+
+      if (next_op && !failed) next_op (c.user_data, ops);
+    }
+
+    __atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  ops_total += ops.size ();
+  io_time += chrono::steady_clock::now () - t0;
+
+  return !failed;
+}
+
+static void statx_to_stat (const struct statx & sx, struct stat & st) {
+  memset (&st, 0, sizeof (st));
+
+  st.st_dev   = makedev (sx.stx_dev_major, sx.stx_dev_minor);
+  st.st_ino   = sx.stx_ino;
+  st.st_mode  = sx.stx_mode;
+  st.st_nlink = sx.stx_nlink;
+  st.st_uid   = sx.stx_uid;
+  st.st_gid   = sx.stx_gid;
+  st.st_size  = sx.stx_size;
+
+  st.st_mtim.tv_sec  = sx.stx_mtime.tv_sec;
+  st.st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+  st.st_ctim.tv_sec  = sx.stx_ctime.tv_sec;
+  st.st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+  st.st_atim.tv_sec  = sx.stx_atime.tv_sec;
+  st.st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+}
+
+bool UringReader::stat (vector<HeaderRead *> & reads) {
+  if (lost) return false;
+
+  vector<struct statx> sx (reads.size ());
+  vector<Op> ops (reads.size ());
+
+  for (size_t i = 0; i < reads.size (); i++) {
+    ops[i].opcode = IORING_OP_STATX;
+    ops[i].r      = reads[i];
+    ops[i].ptr    = &sx[i];
+  }
+
+  bool ok = run (ops);
+
+  if (lost) {
+    /* still written to by the kernel */
+    (void) new vector<struct statx> (move (sx));
+
+    for (HeaderRead * r : reads) r->stat_ok = false;
+    return false;
+  }
+
+  for (size_t i = 0; i < reads.size (); i++) {
+    reads[i]->stat_ok = (ops[i].res == 0);
+    if (reads[i]->stat_ok) statx_to_stat (sx[i], reads[i]->st);
+  }
+
+  return ok;
+}
+
+bool UringReader::read (vector<HeaderRead *> & reads) {
+  /* each file is opened, read and closed in its own chain: the next op
+   * of a file is submitted as soon as its previous one completes, so a
+   * slow file does not hold up the others. */
+  if (lost) return false;
+
+  vector<int>  fds (reads.size (), -1);
+  vector<long> cached (reads.size (), -1);
+
+  vector<Op> ops (reads.size ());
+  for (size_t i = 0; i < reads.size (); i++) {
+    ops[i].opcode = IORING_OP_OPENAT;
+    ops[i].file   = i;
+    ops[i].r      = reads[i];
+
+    reads[i]->read_ok = false;
+    reads[i]->buf.clear ();
+  }
+
+  auto read_chunk = [&] (size_t i, vector<Op> & ops) {
+    HeaderRead * r = reads[i];
+    size_t off = r->buf.size ();
+    r->buf.resize (off + chunk);
+
+    Op o = Op ();
+    o.opcode = IORING_OP_READ;
+    o.file   = i;
+    o.r      = r;
+    o.fd     = fds[i];
+    o.offset = off;
+    o.len    = chunk;
+    o.ptr    = &r->buf[off];
+    ops.push_back (o);
+  };
+
+  auto close_file = [&] (size_t i, vector<Op> & ops) {
+    if (policy && reads[i]->read_ok) {
+      finish_read (fds[i], reads[i]->buf.size (), cached[i], *policy);
+    }
+
+    Op o = Op ();
+    o.opcode = IORING_OP_CLOSE;
+    o.file   = i;
+    o.r      = reads[i];
+    o.fd     = fds[i];
+    ops.push_back (o);
+  };
+
+  bool ok = run (ops, [&] (size_t k, vector<Op> & ops) {
+      /* copied, ops may grow */
+      Op o = ops[k];
+      size_t i = o.file;
+      HeaderRead * r = o.r;
+
+      switch (o.opcode) {
+        case IORING_OP_OPENAT:
+          if (o.res < 0) break;
+
+          fds[i] = o.res;
+          if (policy) cached[i] = cached_before (fds[i], chunk, *policy);
+
+          read_chunk (i, ops);
+          break;
+
+        case IORING_OP_READ:
+          {
+            /* read until the end of the header block has been seen */
+            if (o.res < 0) {
+              r->buf.resize (o.offset);
+              r->read_ok = false;
+              close_file (i, ops);
+              break;
+            }
+
+            r->buf.resize (o.offset + o.res);
+            r->read_ok = true;
+            bytes += o.res;
+
+            if ((size_t) o.res == chunk && !has_header_end (r->buf, o.offset)) {
+              read_chunk (i, ops);
+            } else {
+              close_file (i, ops);
+            }
+          }
+          break;
+
+        case IORING_OP_CLOSE:
+          fds[i] = -1;
+          break;
+      }
+    });
+
+  if (!ok) {
+    /* none of the batch is used */
+    for (size_t i = 0; i < reads.size (); i++) {
+      /* still written to by the kernel */
+      if (lost) (void) new string (move (reads[i]->buf));
+
+      reads[i]->buf.clear ();
+      reads[i]->read_ok = false;
+
+      if (fds[i] >= 0) close (fds[i]);
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+# else
+
+bool UringReader::init () {
+  return false;
+}
+
+bool UringReader::run (vector<Op> &, function<void(size_t, vector<Op> &)>) { return false; }
+bool UringReader::stat (vector<HeaderRead *> &) { return false; }
+bool UringReader::read (vector<HeaderRead *> &) { return false; }
+
+# endif
+
+void UringReader::print_stats () {
+  double t = io_time.count ();
+
+  cout << "*  io_uring: queue depth: " << depth << " (max in flight: " << max_inflight
+       << "), " << ops_total << " ops in " << enters << " calls, "
+       << (bytes / 1024) << " KiB read, "
+       << (t > 0 ? (unsigned long) (ops_total / t) : 0) << " IOPS" << endl;
+}
+
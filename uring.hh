@@ -0,0 +1,103 @@
+# pragma once
+
+/* batched header reads with io_uring
+ *
+ * stats, opens and reads the header block of many message files with a
+ * handful of io_uring_enter calls instead of one blocking call per file.
+ * the files are stat'ed in one step, then each file is opened, read and
+ * closed in a chain of its own: the completions are consumed as they
+ * arrive and the next op of the file is submitted right away, at most
+ * `depth` operations are in flight. a read is only extended (in chunks)
+ * when the header block runs past the first chunk. the headers are parsed
+ * once read () returns.
+ *
+ * the ring is set up with raw syscalls (no liburing). if io_uring is not
+ * available init () returns false and the caller falls back to blocking
+ * reads on the worker threads.
+ *
+ * not thread safe, use from one thread.
+ */
+
+# include <string>
+# include <vector>
+# include <chrono>
+# include <functional>
+# include <sys/stat.h>
+
+# include "pagecache.hh"
+
+using namespace std;
+
+struct HeaderRead {
+  string      path;
+
+  struct stat st;
+  bool        stat_ok = false;
+
+  string      buf;             /* header block (may include some of the body) */
+  bool        read_ok = false;
+};
+
+class UringReader {
+  public:
+    UringReader (unsigned int depth, size_t chunk = 4096);
+    ~UringReader ();
+
+    /* set up the ring, returns false if io_uring is not available */
+    bool init ();
+
+    /* stat all files, false if io_uring failed (the files not done are
+     * marked as failed) */
+    bool stat (vector<HeaderRead *> & reads);
+
+    /* read the header block of all files, false if io_uring failed (none
+     * are marked as read) */
+    bool read (vector<HeaderRead *> & reads);
+
+    unsigned int queue_depth () const { return depth; }
+
+    /* page cache policy for reads, see pagecache.hh */
+    void set_policy (PageCachePolicy * p) { policy = p; }
+
+    void print_stats ();
+
+  private:
+    unsigned int depth;
+    size_t       chunk;
+
+    PageCachePolicy * policy = NULL;
+
+    int    ring_fd = -1;
+
+    /* mapped rings */
+    void * sq_ptr = NULL;
+    size_t sq_size = 0;
+    void * cq_ptr = NULL;
+    size_t cq_size = 0;
+    void * sqes_ptr = NULL;
+    size_t sqes_size = 0;
+
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    void *     cqes;
+
+    struct Op;
+    bool run (vector<Op> & ops, function<void(size_t, vector<Op> &)> next_op = NULL);
+
+    /* requests were left in flight after io_uring failed, the reader can
+     * not be used anymore */
+    bool lost = false;
+
+    /* stats */
+    unsigned long ops_total = 0;
+    unsigned long enters = 0;
+    unsigned long bytes = 0;
+    unsigned int  max_inflight = 0;
+    chrono::duration<double> io_time = chrono::duration<double>::zero ();
+};
+
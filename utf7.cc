@@ -0,0 +1,70 @@
+# include "utf7.hh"
+
+# include <iostream>
+# include <string>
+# include <unordered_map>
+# include <mutex>
+
+# include <glib.h>
+
+# include "spruce-imap-utils.h"
+# include "handles.hh"
+
+using namespace std;
+
+Utf7Codec::Utf7Codec (size_t max_entries) : max_entries (max_entries) {
+}
+
+Utf7Codec::Result Utf7Codec::decode (const string & in, string & out) {
+  return convert (decoded, spruce_imap_utf7_utf8, true, in, out);
+}
+
+Utf7Codec::Result Utf7Codec::encode (const string & in, string & out) {
+  return convert (encoded, spruce_imap_utf8_utf7, false, in, out);
+}
+
+Utf7Codec::Result Utf7Codec::convert (
+    unordered_map<string, Entry> & memo,
+    char * (*conv) (const char *),
+    bool validate,
+    const string & in,
+    string & out)
+{
+  if (spruce_imap_utf7_is_plain (in.data (), in.size ())) {
+    plain.fetch_add (1, memory_order_relaxed);
+    return PLAIN;
+  }
+
+  {
+    unique_lock<mutex> lk (m);
+    auto f = memo.find (in);
+    if (f != memo.end ()) {
+      hits.fetch_add (1, memory_order_relaxed);
+      out = f->second.value;
+      return (f->second.valid ? CONVERTED : INVALID);
+    }
+  }
+
+  GChars c (conv (in.c_str ()));
+
+  Entry e;
+  e.value = c.get ();
+  e.valid = (!validate || g_utf8_validate (c.get (), -1, NULL));
+
+  out = e.value;
+
+  misses.fetch_add (1, memory_order_relaxed);
+
+  unique_lock<mutex> lk (m);
+
+  /* keep the table bounded */
+  if (memo.size () >= max_entries) memo.clear ();
+  memo[in] = e;
+
+  return (e.valid ? CONVERTED : INVALID);
+}
+
+void Utf7Codec::print_stats () {
+  cout << "*  utf7: " << plain.load (memory_order_relaxed) << " plain, " << hits.load (memory_order_relaxed) << " memoized, " << misses.load (memory_order_relaxed) << " converted." << endl;
+}
+
@@ -0,0 +1,53 @@
+# pragma once
+
+/* IMAP modified UTF-7 codec for keywords
+ *
+ * strings that are their own encoding (printable US-ASCII without '&'),
+ * which is nearly all keywords, are detected without allocating and left
+ * alone. other strings are converted with the spruce functions and the
+ * results are memoized in both directions, up to max_entries each.
+ */
+
+# include <string>
+# include <unordered_map>
+# include <mutex>
+# include <atomic>
+
+using namespace std;
+
+class Utf7Codec {
+  public:
+    Utf7Codec (size_t max_entries = 4096);
+
+    enum Result {
+      PLAIN,     /* in is unchanged, out is not set */
+      CONVERTED, /* converted string is in out */
+      INVALID,   /* converted string is in out, but it is not valid UTF-8 */
+    };
+
+    Result decode (const string & in, string & out); /* UTF-7 to UTF-8 */
+    Result encode (const string & in, string & out); /* UTF-8 to UTF-7 */
+
+    void print_stats ();
+
+  private:
+    struct Entry {
+      string value;
+      bool   valid;
+    };
+
+    size_t max_entries;
+
+    mutex m;   /* the tables */
+    unordered_map<string, Entry> decoded;
+    unordered_map<string, Entry> encoded;
+
+    /* counted without the lock (relaxed), plain strings take no lock */
+    atomic<unsigned long> plain { 0 };
+    atomic<unsigned long> hits { 0 };
+    atomic<unsigned long> misses { 0 };
+
+    Result convert (unordered_map<string, Entry> &, char * (*) (const char *),
+                    bool validate, const string & in, string & out);
+};
+
@@ -0,0 +1,183 @@
+# include "watcher.hh"
+# include "logger.hh"
+
+# include <iostream>
+# include <string>
+# include <set>
+# include <chrono>
+# include <cerrno>
+# include <climits>
+# include <cstring>
+
+# include <unistd.h>
+# include <poll.h>
+# include <dirent.h>
+# include <sys/inotify.h>
+
+using namespace std;
+
+static const uint32_t dir_mask  = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+MaildirWatcher::MaildirWatcher (string root) : root (root) {
+}
+
+MaildirWatcher::~MaildirWatcher () {
+  if (fd >= 0) close (fd);
+}
+
+bool MaildirWatcher::start () {
+  fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+  if (fd < 0) {
+    LOG_ERROR ("watch: could not initialize inotify: " << strerror (errno));
+    return false;
+  }
+
+  add_tree (root);
+
+  if (dirs.empty ()) {
+    LOG_ERROR ("watch: could not watch: " << root);
+    return false;
+  }
+
+  return true;
+}
+
+size_t MaildirWatcher::watches () const {
+  return dirs.size ();
+}
+
+void MaildirWatcher::add_tree (const string & dir) {
+  int wd = inotify_add_watch (fd, dir.c_str (), dir_mask);
+  if (wd < 0) {
+    LOG_ERROR ("watch: could not watch directory: " << dir << ": " << strerror (errno));
+    return;
+  }
+
+  dirs[wd] = dir;
+
+  DIR * d = opendir (dir.c_str ());
+  if (d == NULL) return;
+
+  struct dirent * e;
+  while ((e = readdir (d)) != NULL) {
+    if (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN) continue;
+    if (strcmp (e->d_name, ".") == 0 || strcmp (e->d_name, "..") == 0) continue;
+
+    /* skip hidden directories (e.g. .notmuch) and the maildir tmp/ */
+    if (e->d_name[0] == '.' || strcmp (e->d_name, "tmp") == 0) continue;
+
+    string sub = dir + "/" + e->d_name;
+
+    if (e->d_type == DT_UNKNOWN) {
+      DIR * t = opendir (sub.c_str ());
+      if (t == NULL) continue;
+      closedir (t);
+    }
+
+    add_tree (sub);
+  }
+
+  closedir (d);
+}
+
+static bool is_message_dir (const string & dir) {
+  size_t s = dir.rfind ('/');
+  string base = (s == string::npos ? dir : dir.substr (s + 1));
+
+  return (base == "cur" || base == "new");
+}
+
+bool MaildirWatcher::read_events (set<string> & paths, bool & overflow) {
+  /* read all queued events, returns true if any were relevant */
+  alignas (struct inotify_event) char buf[64 * 1024];
+  bool any = false;
+
+  while (true) {
+    ssize_t r = read (fd, buf, sizeof (buf));
+
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      break; /* EAGAIN: queue drained */
+    }
+
+    if (r == 0) break;
+
+    for (char * p = buf; p < buf + r; ) {
+      struct inotify_event * ev = (struct inotify_event *) p;
+      p += sizeof (struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        overflow = true;
+        any = true;
+        continue;
+      }
+
+      if (ev->mask & IN_IGNORED) {
+        dirs.erase (ev->wd);
+        continue;
+      }
+
+      auto d = dirs.find (ev->wd);
+      if (d == dirs.end () || ev->len == 0) continue;
+
+      string dir = d->second;
+      string path = dir + "/" + ev->name;
+
+      if (ev->mask & IN_ISDIR) {
+        if (ev->name[0] != '.' && strcmp (ev->name, "tmp") != 0) {
+          /* files may have been added before the watch was set up */
+          add_tree (path);
+          overflow = true;
+          any = true;
+        }
+        continue;
+      }
+
+      if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_message_dir (dir)) {
+        paths.insert (path);
+        any = true;
+      }
+    }
+  }
+
+  return any;
+}
+
+bool MaildirWatcher::wait (set<string> & paths, bool & overflow, int debounce_ms) {
+  overflow = false;
+
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+
+  /* wait for the first relevant event */
+  while (true) {
+    int r = poll (&pfd, 1, -1);
+    if (r < 0) {
+      if (errno == EINTR) return false;
+      LOG_ERROR ("watch: poll failed: " << strerror (errno));
+      return false;
+    }
+
+    if (read_events (paths, overflow)) break;
+  }
+
+  /* coalesce the burst: wait until it has been quiet for debounce_ms,
+   * but not longer than 10 times that in total. */
+  auto deadline = chrono::steady_clock::now () + chrono::milliseconds (10 * debounce_ms);
+
+  while (chrono::steady_clock::now () < deadline) {
+    int r = poll (&pfd, 1, debounce_ms);
+    if (r < 0) {
+      if (errno == EINTR) return false;
+      break;
+    }
+
+    if (r == 0) break;
+
+    read_events (paths, overflow);
+  }
+
+  return true;
+}
+
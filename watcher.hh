@@ -0,0 +1,41 @@
+# pragma once
+
+/* inotify watcher for maildir trees
+ *
+ * watches every directory below a root (new directories are picked up as
+ * they are created) and reports message files in cur/ and new/ that have
+ * been closed after writing or moved in. events are coalesced: wait ()
+ * returns once no new events have arrived for `debounce` ms.
+ */
+
+# include <string>
+# include <set>
+# include <unordered_map>
+
+using namespace std;
+
+class MaildirWatcher {
+  public:
+    MaildirWatcher (string root);
+    ~MaildirWatcher ();
+
+    /* set up watches, returns false on failure */
+    bool start ();
+
+    /* block until files have changed, changed files are added to paths.
+     * returns false if interrupted by a signal. overflow is set if events
+     * were lost and the whole tree should be re-checked. */
+    bool wait (set<string> & paths, bool & overflow, int debounce_ms);
+
+    size_t watches () const;
+
+  private:
+    string root;
+    int    fd = -1;
+
+    unordered_map<int, string> dirs; /* watch descriptor -> directory */
+
+    void add_tree (const string & dir);
+    bool read_events (set<string> & paths, bool & overflow);
+};
+
@@ -0,0 +1,162 @@
+# include "xkeywords.hh"
+# include "pagecache.hh"
+
+# include <string>
+# include <vector>
+# include <cstring>
+# include <cerrno>
+# include <strings.h>
+
+# include <fcntl.h>
+# include <unistd.h>
+
+using namespace std;
+
+static const char   xkeywords_name[] = "X-Keywords";
+static const size_t xkeywords_name_len = sizeof (xkeywords_name) - 1;
+
+string XKeywordsHeader::joined () const {
+  string j;
+  bool first = true;
+  for (auto & f : fields) {
+    if (f.value.empty ()) continue;
+    if (!first) j += ",";
+    first = false;
+    j += f.value;
+  }
+
+  return j;
+}
+
+static bool is_wsp (char c) {
+  return (c == ' ' || c == '\t');
+}
+
+/* check if line is the start of an X-Keywords field, if so colon is set to
+ * the offset of the ':' in the line. */
+static bool is_x_keywords (const char * line, size_t len, size_t & colon) {
+  if (len <= xkeywords_name_len) return false;
+  if (strncasecmp (line, xkeywords_name, xkeywords_name_len) != 0) return false;
+
+  size_t i = xkeywords_name_len;
+  while (i < len && is_wsp (line[i])) i++;
+
+  if (i < len && line[i] == ':') {
+    colon = i;
+    return true;
+  }
+
+  return false;
+}
+
+static void trim (string & s) {
+  size_t b = 0;
+  while (b < s.size () && (is_wsp (s[b]) || s[b] == '\r' || s[b] == '\n')) b++;
+
+  size_t e = s.size ();
+  while (e > b && (is_wsp (s[e-1]) || s[e-1] == '\r' || s[e-1] == '\n')) e--;
+
+  s = s.substr (b, e - b);
+}
+
+bool has_header_end (const string & buf, size_t from) {
+  if (buf.compare (0, 1, "\n") == 0 || buf.compare (0, 2, "\r\n") == 0)
+    return true;
+
+  from = (from >= 2 ? from - 2 : 0);
+
+  return (buf.find ("\n\n", from) != string::npos ||
+          buf.find ("\n\r\n", from) != string::npos);
+}
+
+void scan_x_keywords (const char * buf, size_t len, XKeywordsHeader & header) {
+  header.found = false;
+  header.header_end = len;
+  header.fields.clear ();
+
+  size_t pos = 0;
+  bool   in_field = false; /* last field started was X-Keywords */
+
+  while (pos < len) {
+    const char * nl = (const char *) memchr (buf + pos, '\n', len - pos);
+    size_t eol = (nl ? nl - buf : len);
+
+    size_t content_end = eol;
+    if (content_end > pos && buf[content_end - 1] == '\r') content_end--;
+
+    if (content_end == pos) {
+      /* empty line: end of headers */
+      header.header_end = (nl ? eol + 1 : len);
+      break;
+    }
+
+    if (is_wsp (buf[pos])) {
+      /* continuation of previous field */
+      if (in_field) {
+        XKeywordsField & f = header.fields.back ();
+        f.value.append (buf + pos, content_end - pos);
+        f.value_end = content_end;
+      }
+    } else {
+      size_t colon;
+      in_field = is_x_keywords (buf + pos, content_end - pos, colon);
+
+      if (in_field) {
+        XKeywordsField f;
+        f.line_begin  = pos;
+        f.value_begin = pos + colon + 1;
+        f.value_end   = content_end;
+        f.value       = string (buf + f.value_begin, content_end - f.value_begin);
+
+        header.fields.push_back (f);
+        header.found = true;
+      }
+    }
+
+    pos = eol + 1;
+  }
+
+  for (auto & f : header.fields) trim (f.value);
+}
+
+bool read_header_block (const char * path, string & buf, PageCachePolicy * policy) {
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  long cached = (policy ? cached_before (fd, 4096, *policy) : -1);
+
+  /* read chunks until the end of the header block has been seen */
+  char    chunk[4096];
+  ssize_t r;
+
+  buf.clear ();
+
+  while ((r = read (fd, chunk, sizeof (chunk))) != 0) {
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      close (fd);
+      return false;
+    }
+
+    size_t scanned = buf.size ();
+    buf.append (chunk, r);
+
+    if (has_header_end (buf, scanned)) break;
+  }
+
+  if (policy) finish_read (fd, buf.size (), cached, *policy);
+
+  close (fd);
+
+  return true;
+}
+
+bool scan_x_keywords (const char * path, XKeywordsHeader & header, PageCachePolicy * policy) {
+  string buf;
+  if (!read_header_block (path, buf, policy)) return false;
+
+  scan_x_keywords (buf.data (), buf.size (), header);
+
+  return true;
+}
+
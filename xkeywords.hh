@@ -0,0 +1,51 @@
+# pragma once
+
+/* header scanner for the X-Keywords header
+ *
+ * reads only the header block of a message file (up to the first empty
+ * line) and returns the raw value(s) of any X-Keywords fields. the name
+ * is matched case-insensitively and folded fields are unfolded. the body
+ * of the message is never read.
+ */
+
+# include <string>
+# include <vector>
+# include <sys/types.h>
+
+using namespace std;
+
+struct XKeywordsField {
+  string value;       /* unfolded value with surrounding whitespace trimmed */
+
+  off_t  line_begin;  /* offset of the field name */
+  off_t  value_begin; /* offset of the first byte after the ':' */
+  off_t  value_end;   /* offset of the line break ending the (last line of the) field */
+};
+
+struct XKeywordsHeader {
+  bool  found = false;
+  off_t header_end = 0; /* offset of the first byte after the header block */
+
+  vector<XKeywordsField> fields;
+
+  /* all field values joined with ',' */
+  string joined () const;
+};
+
+struct PageCachePolicy;
+
+/* scan the header block of the file at path, returns false if the
+ * file could not be read. see pagecache.hh for policy. */
+bool scan_x_keywords (const char * path, XKeywordsHeader & header, PageCachePolicy * policy = NULL);
+
+/* read the header block of the file at path into buf (it may include
+ * some of the body), returns false if the file could not be read. */
+bool read_header_block (const char * path, string & buf, PageCachePolicy * policy = NULL);
+
+/* true if buf contains an empty line, i.e. the end of the header block.
+ * only the part after from (less a line break) is searched. */
+bool has_header_end (const string & buf, size_t from);
+
+/* scan an in-memory header block, stops at the first empty line */
+void scan_x_keywords (const char * buf, size_t len, XKeywordsHeader & header);
+